@@ -22,6 +22,12 @@
 // Stack
 #include "otbTensorflowSource.h"
 
+// Binary patches file
+#include "otbTensorflowPatchesFile.h"
+
+// TFRecord files
+#include "otbTensorflowRecordWriter.h"
+
 namespace otb
 {
 
@@ -59,6 +65,8 @@ public:
 
     std::string                        m_KeyIn;   // Key of input image list
     std::string                        m_KeyOut;  // Key of output samples image
+    std::string                        m_KeyOutPatches; // Key of output patches file
+    std::string                        m_KeyPatchesType; // Key of data type of output patches file
     std::string                        m_KeyPszX; // Key for samples sizes X
     std::string                        m_KeyPszY; // Key for samples sizes Y
   };
@@ -68,6 +76,7 @@ public:
   // Add an input source, which includes:
   // -an input image list
   // -an output image (samples)
+  // -an output patches file (samples)
   // -an input patchsize (dimensions of samples)
   //
   void AddAnInputImage()
@@ -77,11 +86,14 @@ public:
 
     // Create keys and descriptions
     std::stringstream ss_group_key, ss_desc_group, ss_key_in, ss_key_out, ss_desc_in,
-    ss_desc_out, ss_key_dims_x, ss_desc_dims_x, ss_key_dims_y, ss_desc_dims_y;
+    ss_desc_out, ss_key_out_patches, ss_desc_out_patches, ss_key_patches_type, ss_key_dims_x, ss_desc_dims_x, ss_key_dims_y, ss_desc_dims_y;
     ss_group_key   << "source"                    << inputNumber;
     ss_desc_group  << "Parameters for source "    << inputNumber;
     ss_key_out     << ss_group_key.str()          << ".out";
     ss_desc_out    << "Output patches for image " << inputNumber;
+    ss_key_out_patches  << ss_group_key.str()     << ".outpatches";
+    ss_desc_out_patches << "Output binary patches file for image " << inputNumber;
+    ss_key_patches_type << ss_group_key.str()     << ".patchestype";
     ss_key_in      << ss_group_key.str()          << ".il";
     ss_desc_in     << "Input image(s) "           << inputNumber;
     ss_key_dims_x  << ss_group_key.str()          << ".patchsizex";
@@ -93,6 +105,19 @@ public:
     AddParameter(ParameterType_Group,          ss_group_key.str(),  ss_desc_group.str());
     AddParameter(ParameterType_InputImageList, ss_key_in.str(),     ss_desc_in.str() );
     AddParameter(ParameterType_OutputImage,    ss_key_out.str(),    ss_desc_out.str());
+    MandatoryOff                              (ss_key_out.str());
+    AddParameter(ParameterType_OutputFilename, ss_key_out_patches.str(), ss_desc_out_patches.str());
+    SetParameterDescription                   (ss_key_out_patches.str(), "Samples in a binary file "
+        "which can be mapped in memory by TensorflowModelTrain (NHWC values, and the positions of the samples)");
+    MandatoryOff                              (ss_key_out_patches.str());
+    AddParameter(ParameterType_Choice,         ss_key_patches_type.str(), "Data type of the values of the patches file");
+    SetParameterDescription                   (ss_key_patches_type.str(), "Values are rounded and clamped for integer types. "
+        "Use the native type of the image to save space (e.g. uint16 for most satellite images)");
+    AddChoice                                 (ss_key_patches_type.str() + ".float",  "32 bits floating point");
+    AddChoice                                 (ss_key_patches_type.str() + ".uint8",  "8 bits unsigned integer");
+    AddChoice                                 (ss_key_patches_type.str() + ".int16",  "16 bits signed integer");
+    AddChoice                                 (ss_key_patches_type.str() + ".uint16", "16 bits unsigned integer");
+    AddChoice                                 (ss_key_patches_type.str() + ".int32",  "32 bits signed integer");
     AddParameter(ParameterType_Int,            ss_key_dims_x.str(), ss_desc_dims_x.str());
     SetMinimumParameterIntValue               (ss_key_dims_x.str(), 1);
     AddParameter(ParameterType_Int,            ss_key_dims_y.str(), ss_desc_dims_y.str());
@@ -102,6 +127,8 @@ public:
     SourceBundle bundle;
     bundle.m_KeyIn   = ss_key_in.str();
     bundle.m_KeyOut  = ss_key_out.str();
+    bundle.m_KeyOutPatches = ss_key_out_patches.str();
+    bundle.m_KeyPatchesType = ss_key_patches_type.str();
     bundle.m_KeyPszX = ss_key_dims_x.str();
     bundle.m_KeyPszY = ss_key_dims_y.str();
 
@@ -126,6 +153,36 @@ public:
     }
   }
 
+  //
+  // Write a patches file, with the values of the given type (index of the
+  // choices of sourceN.patchestype)
+  //
+  void WritePatchesFile(const std::string & fileName, FloatVectorImageType::Pointer image,
+      const FloatVectorImageType::SizeType & patchSize, const SamplerType::PointListType & positions,
+      int type)
+  {
+    const unsigned int compression = GetParameterInt("patches.compression");
+    const unsigned int chunkSize = GetParameterInt("patches.chunksize");
+    switch (type)
+    {
+    case 0:
+      tf::WritePatchesFile<float, FloatVectorImageType>(fileName, image, patchSize, positions, compression, chunkSize);
+      break;
+    case 1:
+      tf::WritePatchesFile<unsigned char, FloatVectorImageType>(fileName, image, patchSize, positions, compression, chunkSize);
+      break;
+    case 2:
+      tf::WritePatchesFile<short, FloatVectorImageType>(fileName, image, patchSize, positions, compression, chunkSize);
+      break;
+    case 3:
+      tf::WritePatchesFile<unsigned short, FloatVectorImageType>(fileName, image, patchSize, positions, compression, chunkSize);
+      break;
+    default:
+      tf::WritePatchesFile<int, FloatVectorImageType>(fileName, image, patchSize, positions, compression, chunkSize);
+      break;
+    }
+  }
+
   void DoUpdateParameters()
   {
   }
@@ -166,10 +223,39 @@ public:
     AddParameter(ParameterType_OutputImage, "outlabels", "output labels");
     SetDefaultOutputPixelType              ("outlabels", ImagePixelType_uint8);
     MandatoryOff                           ("outlabels");
+    AddParameter(ParameterType_OutputFilename, "outlabelspatches", "output labels binary patches file");
+    SetParameterDescription                   ("outlabelspatches", "Labels in a binary file "
+        "which can be mapped in memory by TensorflowModelTrain (int32 values, and the positions of the samples)");
+    MandatoryOff                              ("outlabelspatches");
+
+    // Patches files compression
+    AddParameter(ParameterType_Group,          "patches",             "Binary patches files");
+    AddParameter(ParameterType_Choice,         "patches.compression", "Compression of the patches files");
+    AddChoice                                 ("patches.compression.none", "No compression (the samples are mapped in memory)");
+    AddChoice                                 ("patches.compression.lz4",  "LZ4 compression of the chunks (fast)");
+    AddChoice                                 ("patches.compression.zstd", "zstd compression of the chunks (smaller)");
+    AddParameter(ParameterType_Int,            "patches.chunksize",   "Number of samples of the compressed chunks");
+    SetParameterDescription                   ("patches.chunksize",   "Chunks are compressed independently. "
+        "For training, use the same value for training.blocksize.");
+    SetMinimumParameterIntValue               ("patches.chunksize",   1);
+    SetDefaultParameterInt                    ("patches.chunksize",   256);
 
     // Class field
     AddParameter(ParameterType_String, "field", "field of class in the vector data");
 
+    // TFRecord files
+    AddParameter(ParameterType_Group,          "tfrecord",        "TFRecord output");
+    AddParameter(ParameterType_OutputFilename, "tfrecord.out",    "Output TFRecord file");
+    SetParameterDescription                   ("tfrecord.out",    "Samples written as tf.train.Example protos, "
+        "with one float feature per source (\"source1\", \"source2\", ...), the \"label\" int64 feature and the "
+        "\"position\" float feature (coordinates of the center of the sample)");
+    MandatoryOff                              ("tfrecord.out");
+    AddParameter(ParameterType_Int,            "tfrecord.shards", "Number of shards, written in parallel");
+    SetParameterDescription                   ("tfrecord.shards", "When greater than 1, the samples are distributed "
+        "over files named like out-00000-of-00004.tfrecord");
+    SetMinimumParameterIntValue               ("tfrecord.shards", 1);
+    SetDefaultParameterInt                    ("tfrecord.shards", 1);
+
     // Examples values
     SetDocExampleParameterValue("vec",                "points.sqlite");
     SetDocExampleParameterValue("source1.il",         "$s2_list");
@@ -186,6 +272,15 @@ public:
 
     PrepareInputs();
 
+    // Check outputs
+    for (auto& bundle: m_Bundles)
+    {
+      if (!HasValue(bundle.m_KeyOut) && !HasValue(bundle.m_KeyOutPatches) && !HasValue("tfrecord.out"))
+      {
+        otbAppLogFATAL("No output is set for " << bundle.m_KeyOut << " or " << bundle.m_KeyOutPatches);
+      }
+    }
+
     // Setup the filter
     SamplerType::Pointer sampler = SamplerType::New();
     sampler->SetInputVectorData(GetParameterVectorData("vec"));
@@ -206,7 +301,17 @@ public:
     // Save patches image
     for (unsigned int i = 0 ; i < m_Bundles.size() ; i++)
     {
-      SetParameterOutputImage(m_Bundles[i].m_KeyOut, sampler->GetOutputPatchImages()[i]);
+      if (HasValue(m_Bundles[i].m_KeyOut))
+      {
+        SetParameterOutputImage(m_Bundles[i].m_KeyOut, sampler->GetOutputPatchImages()[i]);
+      }
+      if (HasValue(m_Bundles[i].m_KeyOutPatches))
+      {
+        const std::string fileName = GetParameterString(m_Bundles[i].m_KeyOutPatches);
+        otbAppLogINFO("Writing patches file " << fileName);
+        WritePatchesFile(fileName, sampler->GetOutputPatchImages()[i], m_Bundles[i].m_PatchSize,
+            sampler->GetOutputPositions(), GetParameterInt(m_Bundles[i].m_KeyPatchesType));
+      }
     }
 
 
@@ -215,6 +320,29 @@ public:
     {
       SetParameterOutputImage("outlabels", sampler->GetOutputLabelImage());
     }
+    if (HasValue("outlabelspatches"))
+    {
+      const std::string fileName = GetParameterString("outlabelspatches");
+      otbAppLogINFO("Writing labels patches file " << fileName);
+      FloatVectorImageType::SizeType labelPatchSize;
+      labelPatchSize.Fill(1);
+      WritePatchesFile(fileName, sampler->GetOutputLabelImage(), labelPatchSize, sampler->GetOutputPositions(), 4); // int32
+    }
+
+    // Save TFRecord files (if needed)
+    if (HasValue("tfrecord.out"))
+    {
+      std::vector<std::string> names;
+      for (unsigned int i = 0 ; i < m_Bundles.size() ; i++)
+      {
+        names.push_back("source" + std::to_string(i + 1));
+      }
+      const std::string fileName = GetParameterString("tfrecord.out");
+      const unsigned int shards = GetParameterInt("tfrecord.shards");
+      otbAppLogINFO("Writing TFRecord file " << fileName << " (" << shards << " shard(s))");
+      tf::WriteTFRecordShards<FloatVectorImageType>(fileName, shards, sampler->GetOutputPatchImages(), names,
+          sampler->GetOutputLabelImage(), sampler->GetOutputPositions());
+    }
 
   }
 private:
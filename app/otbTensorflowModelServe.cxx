@@ -19,6 +19,7 @@
 // Tensorflow stuff
 #include "tensorflow/core/public/session.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/lib/io/path.h"
 
 // Tensorflow model filter
 #include "otbTensorflowMultisourceModelFilter.h"
@@ -31,6 +32,11 @@
 
 // Streaming
 #include "otbTensorflowStreamerFilter.h"
+#include <algorithm>
+
+// Sharding
+#include "otbMultiChannelExtractROI.h"
+#include "otbTensorflowCommon.h"
 
 namespace otb
 {
@@ -59,6 +65,13 @@ public:
   typedef otb::ImageRegionSquareTileSplitter<FloatVectorImageType::ImageDimension> TileSplitterType;
   typedef otb::TensorflowStreamerFilter<FloatVectorImageType, FloatVectorImageType> StreamingFilterType;
 
+  /** Typedef for sharding */
+  typedef otb::MultiChannelExtractROI<FloatVectorImageType::InternalPixelType,
+      FloatVectorImageType::InternalPixelType> ExtractROIFilterType;
+
+  /** Typedef for profiling */
+  typedef otb::TensorflowProfiler ProfilerType;
+
   /** Typedefs for images */
   typedef FloatVectorImageType::SizeType SizeType;
 
@@ -173,6 +186,13 @@ public:
     SetParameterDescription                  ("model.userplaceholders", "Syntax to use is \"placeholder_1=value_1 ... placeholder_N=value_N\"");
     AddParameter(ParameterType_Bool,          "model.fullyconv", "Fully convolutional");
     MandatoryOff                             ("model.fullyconv");
+    AddParameter(ParameterType_Choice,        "model.tta",       "Test-time augmentation");
+    SetParameterDescription                  ("model.tta", "The transformed copies of the inputs are processed in the same batch, "
+        "then the outputs are inverse-transformed and averaged. Use it for scores or regression outputs, not for labels.");
+    AddChoice                                ("model.tta.none",  "No test-time augmentation");
+    AddChoice                                ("model.tta.flip",  "Flips (4 transforms)");
+    AddChoice                                ("model.tta.d4",    "Flips and 90 degrees rotations (8 transforms, requires square receptive fields, "
+        "flips only in fully convolutional mode)");
 
     // Output tensors parameters
     AddParameter(ParameterType_Group,         "output",          "Output tensors parameters");
@@ -203,6 +223,37 @@ public:
     AddParameter(ParameterType_Int,           "optim.tilesizey", "Tile height used to stream the filter output");
     SetMinimumParameterIntValue              ("optim.tilesizey", 1);
     SetDefaultParameterInt                   ("optim.tilesizey", 16);
+    AddParameter(ParameterType_Directory,     "optim.journal", "Journal directory used to resume an interrupted processing");
+    MandatoryOff                             ("optim.journal");
+    SetParameterDescription                  ("optim.journal", "Each computed tile is stored in this directory and recorded in a journal. "
+        "When the application is run again with the same directory, the recorded tiles are read back instead of being computed. "
+        "The journal is deleted once the output is written. Requires the tiling. With shards, each shard has its own "
+        "journal, so the shards can use the same directory.");
+
+    // Sharding
+    AddParameter(ParameterType_Group,         "shard",       "Split the processing between multiple processes");
+    SetParameterDescription                  ("shard", "The rows of tiles of the output are split into disjoint bands. Each process "
+        "computes one band, with the same tiling as the processing of the whole image. Bands can then be merged, e.g. with "
+        "gdalbuildvrt.");
+    AddParameter(ParameterType_Int,           "shard.index", "Index of the shard to compute (starting at 0)");
+    SetMinimumParameterIntValue              ("shard.index", 0);
+    SetDefaultParameterInt                   ("shard.index", 0);
+    AddParameter(ParameterType_Int,           "shard.count", "Number of shards");
+    SetMinimumParameterIntValue              ("shard.count", 1);
+    SetDefaultParameterInt                   ("shard.count", 1);
+
+    // Profiling
+    AddParameter(ParameterType_Group,          "profiling",       "Profiling");
+    AddParameter(ParameterType_OutputFilename, "profiling.trace", "Chrome trace-event JSON file");
+    SetParameterDescription                   ("profiling.trace", "When set, the upstream update, the tensors population, "
+        "the session run and the writeback of each tile are recorded and exported in this file, which can be opened with "
+        "chrome://tracing. A summary of the latencies and the throughput is logged at the end of the processing.");
+    MandatoryOff                              ("profiling.trace");
+    AddParameter(ParameterType_Int,            "profiling.opperiod", "Trace the TensorFlow ops every Nth session run (0: disabled)");
+    SetParameterDescription                   ("profiling.opperiod", "The step stats of the traced session runs are added to the "
+        "trace, and the ops types are ranked by total time at the end of the processing. Requires profiling.trace.");
+    SetMinimumParameterIntValue               ("profiling.opperiod", 0);
+    SetDefaultParameterInt                    ("profiling.opperiod", 0);
 
     // Output image
     AddParameter(ParameterType_OutputImage, "out", "output image");
@@ -282,6 +333,31 @@ public:
       m_TFFilter->SetFullyConvolutional(true);
     }
 
+    // Test-time augmentation
+    if (GetParameterInt("model.tta") == 1) // flip
+    {
+      otbAppLogINFO("Test-time augmentation with flips");
+      m_TFFilter->SetTestTimeAugmentationTransforms(4);
+    }
+    else if (GetParameterInt("model.tta") == 2) // d4
+    {
+      otbAppLogINFO("Test-time augmentation with flips and 90 degrees rotations");
+      m_TFFilter->SetTestTimeAugmentationTransforms(8);
+    }
+
+    // Profiling
+    if (HasValue("profiling.trace"))
+    {
+      m_Profiler = ProfilerType::New();
+      m_Profiler->StartChromeTrace(GetParameterAsString("profiling.trace"));
+      m_TFFilter->SetProfiler(m_Profiler);
+      m_TFFilter->SetTracingPeriod(GetParameterInt("profiling.opperiod"));
+    }
+    else if (GetParameterInt("profiling.opperiod") > 0)
+    {
+      otbAppLogWARNING("The tracing of the ops requires profiling.trace: profiling.opperiod is ignored");
+    }
+
     // Output field of expression
     FloatVectorImageType::SizeType foe;
     foe[0] = GetParameterInt("output.efieldx");
@@ -290,6 +366,10 @@ public:
 
     otbAppLogINFO("Output field of expression: " << m_TFFilter->GetOutputExpressionFields()[0]);
 
+    // Output image, and grid used to split the output in shards
+    FloatVectorImageType::Pointer outputImage;
+    SizeType gridSize = foe;
+
     // Streaming
     if (GetParameterInt("optim.disabletiling") != 1)
     {
@@ -317,13 +397,137 @@ public:
       m_StreamFilter = StreamingFilterType::New();
       m_StreamFilter->SetOutputGridSize(tileSize);
       m_StreamFilter->SetInput(m_TFFilter->GetOutput());
-
-      SetParameterOutputImage("out", m_StreamFilter->GetOutput());
+      m_StreamFilter->SetProfiler(m_Profiler);
+
+      // Journal of processed tiles
+      if (HasValue("optim.journal"))
+      {
+        otbAppLogINFO("Using the journal directory " << GetParameterAsString("optim.journal"));
+        m_StreamFilter->SetJournalDirectory(GetParameterAsString("optim.journal"));
+        m_StreamFilter->SetJournalKey(GetJournalKey());
+
+        // Each shard has its own journal: the shards can share the directory
+        if (GetParameterInt("shard.count") > 1)
+        {
+          m_StreamFilter->SetJournalName("journal_shard_" + std::to_string(GetParameterInt("shard.index")) +
+              "_of_" + std::to_string(GetParameterInt("shard.count")));
+        }
+      }
+
+      outputImage = m_StreamFilter->GetOutput();
+      gridSize = tileSize;
     }
     else
     {
       otbAppLogINFO("Tiling disabled");
-      SetParameterOutputImage("out", m_TFFilter->GetOutput());
+      if (HasValue("optim.journal"))
+      {
+        otbAppLogWARNING("The journal requires the tiling: optim.journal is ignored");
+      }
+      outputImage = m_TFFilter->GetOutput();
+    }
+
+    // Sharding
+    const unsigned int shardCount = GetParameterInt("shard.count");
+    if (shardCount > 1)
+    {
+      const unsigned int shardIndex = GetParameterInt("shard.index");
+      outputImage->UpdateOutputInformation();
+      FloatVectorImageType::RegionType shardRegion = tf::GetShardRegion<FloatVectorImageType>(
+          outputImage->GetLargestPossibleRegion(), gridSize, shardIndex, shardCount);
+
+      otbAppLogINFO("Computing shard #" << shardIndex << " of " << shardCount << ": "
+          << "start " << shardRegion.GetIndex() << ", size " << shardRegion.GetSize());
+
+      m_ShardFilter = ExtractROIFilterType::New();
+      m_ShardFilter->SetInput(outputImage);
+      m_ShardFilter->SetExtractionRegion(shardRegion);
+      outputImage = m_ShardFilter->GetOutput();
+    }
+    else if (GetParameterInt("shard.index") != 0)
+    {
+      otbAppLogFATAL("Shard index must be 0 when there is only one shard");
+    }
+
+    SetParameterOutputImage("out", outputImage);
+  }
+
+  //
+  // Size and modification time of a file (empty if the file can't be read)
+  //
+  std::string GetFileStatistics(const std::string & fileName)
+  {
+    tensorflow::FileStatistics stats;
+    if (!tensorflow::Env::Default()->Stat(fileName, &stats).ok())
+      return "";
+    return std::to_string(stats.length) + " " + std::to_string(stats.mtime_nsec);
+  }
+
+  //
+  // Key of the journal: the model files and the input files (their size and
+  // modification time), and all the parameters that change the output values
+  //
+  std::string GetJournalKey()
+  {
+    std::stringstream key;
+
+    // Model
+    const std::string modelDir = GetParameterAsString("model.dir");
+    std::vector<std::string> modelFiles = {tensorflow::io::JoinPath(modelDir, "saved_model.pb"),
+        tensorflow::io::JoinPath(modelDir, "saved_model.pbtxt")};
+    std::vector<std::string> variablesFiles;
+    if (tensorflow::Env::Default()->GetMatchingPaths(tensorflow::io::JoinPath(modelDir, "variables", "*"),
+        &variablesFiles).ok())
+    {
+      std::sort(variablesFiles.begin(), variablesFiles.end());
+      modelFiles.insert(modelFiles.end(), variablesFiles.begin(), variablesFiles.end());
+    }
+    key << "model.dir " << modelDir << "\n";
+    for (auto& fileName: modelFiles)
+      key << fileName << " " << GetFileStatistics(fileName) << "\n";
+
+    // Sources (the extended filenames are removed to get the files)
+    for (auto& bundle: m_Bundles)
+    {
+      for (auto& fileName: GetParameterStringList(bundle.m_KeyIn))
+        key << bundle.m_KeyIn << " " << fileName << " " << GetFileStatistics(fileName.substr(0, fileName.find('?'))) << "\n";
+      for (auto& paramKey: {bundle.m_KeyPszX, bundle.m_KeyPszY, bundle.m_KeyPHName})
+        key << paramKey << " " << GetParameterAsString(paramKey) << "\n";
+    }
+
+    // Parameters of the model and of the outputs
+    for (auto& paramKey: {"model.userplaceholders", "output.names"})
+    {
+      key << paramKey;
+      if (HasValue(paramKey))
+        for (auto& value: GetParameterStringList(paramKey))
+          key << " " << value;
+      key << "\n";
+    }
+    for (auto& paramKey: {"model.fullyconv", "model.tta", "output.spcscale", "output.efieldx", "output.efieldy"})
+      key << paramKey << " " << GetParameterAsString(paramKey) << "\n";
+
+    return key.str();
+  }
+
+  void AfterExecuteAndWriteOutputs()
+  {
+    // The output is written: the tiles of the journal are not needed anymore
+    if (m_StreamFilter && !m_StreamFilter->GetJournalDirectory().empty())
+    {
+      otbAppLogINFO("Deleting the journal in " << m_StreamFilter->GetJournalDirectory());
+      m_StreamFilter->RemoveJournal();
+    }
+
+    // Export the profiling
+    if (m_Profiler)
+    {
+      const std::string fileName = GetParameterAsString("profiling.trace");
+      otbAppLogINFO("Profiling summary:\n" << m_Profiler->GetSummary({TFModelFilterType::GetOpProfilingCategory()}));
+      if (GetParameterInt("profiling.opperiod") > 0)
+        otbAppLogINFO("TensorFlow ops ranked by total time:\n" << m_Profiler->GetCostTable(TFModelFilterType::GetOpProfilingCategory()));
+      m_Profiler->FinishChromeTrace();
+      otbAppLogINFO("Trace written to " << fileName);
     }
   }
 
@@ -331,6 +535,8 @@ private:
 
   TFModelFilterType::Pointer   m_TFFilter;
   StreamingFilterType::Pointer m_StreamFilter;
+  ExtractROIFilterType::Pointer m_ShardFilter;
+  ProfilerType::Pointer        m_Profiler;
   tensorflow::SavedModelBundle m_SavedModel; // must be alive during all the execution of the application !
 
   std::vector<ProcessObjectsBundle>           m_Bundles;
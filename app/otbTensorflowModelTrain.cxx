@@ -10,6 +10,7 @@
 =========================================================================*/
 #include "itkFixedArray.h"
 #include "itkObjectFactory.h"
+#include "itkImageRegionConstIterator.h"
 #include "otbWrapperApplicationFactory.h"
 
 // Application engine
@@ -23,13 +24,24 @@
 // Tensorflow model train
 #include "otbTensorflowMultisourceModelTrain.h"
 #include "otbTensorflowMultisourceModelValidate.h"
+#include "otbTensorflowMultisourceModelRegressionValidate.h"
 
 // Tensorflow graph load
 #include "otbTensorflowGraphOperations.h"
+#include "otbTensorflowCheckpointManager.h"
+#include "itkCommand.h"
 
 // Layerstack
 #include "otbTensorflowSource.h"
 
+// Binary patches file
+#include "otbTensorflowPatchesFileReader.h"
+#include "otbTensorflowPatchesConcatenation.h"
+#include "otbImageFileReader.h"
+
+// Background validation
+#include <future>
+
 // Metrics
 #include "otbConfusionMatrixMeasurements.h"
 
@@ -55,14 +67,35 @@ public:
 
   /** Typedefs for TensorFlow */
   typedef otb::TensorflowMultisourceModelTrain<FloatVectorImageType>    TrainModelFilterType;
+  typedef otb::TensorflowMultisourceModelValidateBase<FloatVectorImageType> ValidateModelBaseFilterType;
   typedef otb::TensorflowMultisourceModelValidate<FloatVectorImageType> ValidateModelFilterType;
+  typedef otb::TensorflowMultisourceModelRegressionValidate<FloatVectorImageType> RegressionValidateModelFilterType;
   typedef otb::TensorflowSource<FloatVectorImageType>                   TFSource;
+  typedef otb::TensorflowPatchesFileReader<FloatVectorImageType>        PatchesReaderType;
+  typedef otb::TensorflowPatchesConcatenation<FloatVectorImageType>     PatchesConcatenationType;
+  typedef otb::ImageFileReader<FloatVectorImageType>                    ImageReaderType;
+  typedef otb::TensorflowProfiler                                       ProfilerType;
+  typedef otb::TensorflowCheckpointManager                              CheckpointManagerType;
+  typedef itk::SimpleMemberCommand<Self>                                CommandType;
 
   /* Typedefs for evaluation metrics */
   typedef ValidateModelFilterType::ConfMatType                          ConfMatType;
   typedef ValidateModelFilterType::MapOfClassesType                     MapOfClassesType;
   typedef ValidateModelFilterType::LabelValueType                       LabelValueType;
   typedef otb::ConfusionMatrixMeasurements<ConfMatType, LabelValueType> ConfusionMatrixCalculatorType;
+  typedef RegressionValidateModelFilterType::MetricsListType            RegressionMetricsListType;
+  typedef ValidateModelFilterType::IndexListType                        IndexListType;
+  typedef TrainModelFilterType::DatasetSizesType                        DatasetSizesType;
+
+  //
+  // Readers of the patches files of one source (one per dataset), and their
+  // concatenation when there is more than one dataset
+  //
+  struct PatchesSource
+  {
+    std::vector<PatchesReaderType::Pointer> readers;
+    PatchesConcatenationType::Pointer       concatenation;
+  };
 
   //
   // Store stuff related to one source
@@ -71,10 +104,19 @@ public:
   {
     TFSource tfSource;
     TFSource tfSourceForValidation;
+    PatchesSource patchesSource;
+    PatchesSource patchesSourceForValidation;
+
+    // Own pipeline of the learning data, for the background validation
+    TFSource tfSourceForEvaluation;
+    PatchesSource patchesSourceForEvaluation;
+    std::vector<ImageReaderType::Pointer> readersForEvaluation;
 
     // Parameters keys
     std::string m_KeyInForTrain;     // Key of input image list (training)
     std::string m_KeyInForValid;     // Key of input image list (validation)
+    std::string m_KeyPatchesForTrain; // Key of input patches files (training)
+    std::string m_KeyPatchesForValid; // Key of input patches files (validation)
     std::string m_KeyPHNameForTrain; // Key for placeholder name in the TensorFlow model (training)
     std::string m_KeyPHNameForValid; // Key for placeholder name in the TensorFlow model (validation)
     std::string m_KeyPszX;   // Key for samples sizes X
@@ -86,6 +128,18 @@ public:
   typedef std::vector<FloatVectorImageType::SizeType> SizeList;
   typedef std::vector<std::string>                    StringList;
 
+  //
+  // Metrics of one evaluation
+  //
+  struct ValidationResults
+  {
+    std::string                            dataName;          // Name of the evaluated data
+    std::vector<ConfMatType>               confusionMatrices; // Confusion matrices (classification)
+    std::vector<MapOfClassesType>          mapsOfClasses;     // Maps of classes (classification)
+    std::vector<RegressionMetricsListType> regressionMetrics; // Metrics of each channel (regression)
+  };
+  typedef std::vector<ValidationResults>              ValidationResultsList;
+
   void DoUpdateParameters()
   {
   }
@@ -93,8 +147,10 @@ public:
   //
   // Add an input source, which includes:
   // -an input image list        (for training)
+  // -input patches files        (for training, instead of the image list, one per dataset)
   // -an input image placeholder (for training)
   // -an input image list        (for validation)
+  // -input patches files        (for validation, instead of the image list, one per dataset)
   // -an input image placeholder (for validation)
   // -an input patchsize, which is the dimensions of samples. Same for training and validation.
   //
@@ -108,6 +164,8 @@ public:
     ss_key_val_group, ss_desc_val_group,
     ss_key_tr_in, ss_desc_tr_in,
     ss_key_val_in, ss_desc_val_in,
+    ss_key_tr_patches, ss_desc_tr_patches,
+    ss_key_val_patches, ss_desc_val_patches,
     ss_key_dims_x, ss_desc_dims_x,
     ss_key_dims_y, ss_desc_dims_y,
     ss_key_tr_ph, ss_desc_tr_ph,
@@ -122,6 +180,8 @@ public:
     // Parameter group keys
     ss_key_tr_in   << ss_key_tr_group.str()  << ".il";
     ss_key_val_in  << ss_key_val_group.str() << ".il";
+    ss_key_tr_patches  << ss_key_tr_group.str()  << ".patches";
+    ss_key_val_patches << ss_key_val_group.str() << ".patches";
     ss_key_dims_x  << ss_key_tr_group.str()  << ".patchsizex";
     ss_key_dims_y  << ss_key_tr_group.str()  << ".patchsizey";
     ss_key_tr_ph   << ss_key_tr_group.str()  << ".placeholder";
@@ -130,6 +190,8 @@ public:
     // Parameter group descriptions
     ss_desc_tr_in  << "Input image (or list to stack) for source #" << inputNumber << " (training)";
     ss_desc_val_in << "Input image (or list to stack) for source #" << inputNumber << " (validation)";
+    ss_desc_tr_patches  << "Input patches files for source #"       << inputNumber << " (training, replaces the image list, one per dataset)";
+    ss_desc_val_patches << "Input patches files for source #"       << inputNumber << " (validation, replaces the image list, one per dataset)";
     ss_desc_dims_x << "Patch size (x) for source #"                 << inputNumber;
     ss_desc_dims_y << "Patch size (y) for source #"                 << inputNumber;
     ss_desc_tr_ph  << "Name of the input placeholder for source #"  << inputNumber << " (training)";
@@ -139,6 +201,9 @@ public:
     // Populate group
     AddParameter(ParameterType_Group,          ss_key_tr_group.str(),  ss_desc_tr_group.str());
     AddParameter(ParameterType_InputImageList, ss_key_tr_in.str(),     ss_desc_tr_in.str() );
+    MandatoryOff                              (ss_key_tr_in.str());
+    AddParameter(ParameterType_InputFilenameList, ss_key_tr_patches.str(), ss_desc_tr_patches.str());
+    MandatoryOff                              (ss_key_tr_patches.str());
     AddParameter(ParameterType_Int,            ss_key_dims_x.str(),    ss_desc_dims_x.str());
     SetMinimumParameterIntValue               (ss_key_dims_x.str(),    1);
     AddParameter(ParameterType_Int,            ss_key_dims_y.str(),    ss_desc_dims_y.str());
@@ -146,12 +211,17 @@ public:
     AddParameter(ParameterType_String,         ss_key_tr_ph.str(),     ss_desc_tr_ph.str());
     AddParameter(ParameterType_Group,          ss_key_val_group.str(), ss_desc_val_group.str());
     AddParameter(ParameterType_InputImageList, ss_key_val_in.str(),    ss_desc_val_in.str() );
+    MandatoryOff                              (ss_key_val_in.str());
+    AddParameter(ParameterType_InputFilenameList, ss_key_val_patches.str(), ss_desc_val_patches.str());
+    MandatoryOff                              (ss_key_val_patches.str());
     AddParameter(ParameterType_String,         ss_key_val_ph.str(),    ss_desc_val_ph.str());
 
     // Add a new bundle
     ProcessObjectsBundle bundle;
     bundle.m_KeyInForTrain     = ss_key_tr_in.str();
     bundle.m_KeyInForValid     = ss_key_val_in.str();
+    bundle.m_KeyPatchesForTrain = ss_key_tr_patches.str();
+    bundle.m_KeyPatchesForValid = ss_key_val_patches.str();
     bundle.m_KeyPHNameForTrain = ss_key_tr_ph.str();
     bundle.m_KeyPHNameForValid = ss_key_val_ph.str();
     bundle.m_KeyPszX           = ss_key_dims_x.str();
@@ -180,6 +250,8 @@ public:
     AddParameter(ParameterType_Directory,   "model.dir",          "Tensorflow model_save directory");
     MandatoryOn                            ("model.dir");
     AddParameter(ParameterType_String,      "model.restorefrom",  "Restore model from path");
+    SetParameterDescription                ("model.restorefrom",  "Path of the variables to restore, or directory of "
+        "checkpoints (the latest complete checkpoint is restored)");
     MandatoryOff                           ("model.restorefrom");
     AddParameter(ParameterType_String,      "model.saveto",       "Save model to path");
     MandatoryOff                           ("model.saveto");
@@ -198,9 +270,84 @@ public:
     AddParameter(ParameterType_StringList,  "training.targetnodes",    "Names of the target nodes");
     MandatoryOn                            ("training.targetnodes");
     AddParameter(ParameterType_StringList,  "training.outputtensors",  "Names of the output tensors to display");
+    SetParameterDescription                ("training.outputtensors",  "The values of the output tensors with one element "
+        "(e.g. the loss) are reported in the telemetry of the batches");
     MandatoryOff                           ("training.outputtensors");
     AddParameter(ParameterType_Bool,        "training.usestreaming",   "Use the streaming through patches (slower but can process big dataset)");
     MandatoryOff                           ("training.usestreaming");
+    AddParameter(ParameterType_Int,         "training.blocksize",      "Number of samples read at once in streaming mode (0: one by one)");
+    SetMinimumParameterIntValue            ("training.blocksize",      0);
+    SetDefaultParameterInt                 ("training.blocksize",      0);
+    AddParameter(ParameterType_Int,         "training.cacheram",       "Size of the cache of blocks read in streaming mode (MB)");
+    SetMinimumParameterIntValue            ("training.cacheram",       1);
+    SetDefaultParameterInt                 ("training.cacheram",       256);
+    AddParameter(ParameterType_Int,         "training.epochcache",     "Size of the cache of compact blocks kept across epochs in streaming mode (MB, 0: disabled)");
+    SetMinimumParameterIntValue            ("training.epochcache",     0);
+    SetDefaultParameterInt                 ("training.epochcache",     0);
+    AddParameter(ParameterType_Choice,      "training.epochcachecompression", "Compression of the blocks of the epoch cache");
+    AddChoice                              ("training.epochcachecompression.none", "No compression");
+    AddChoice                              ("training.epochcachecompression.lz4",  "LZ4 compression (fast)");
+    AddChoice                              ("training.epochcachecompression.zstd", "zstd compression (smaller)");
+    AddParameter(ParameterType_Choice,      "training.shuffle",        "Shuffle strategy");
+    AddChoice                              ("training.shuffle.full",   "Full permutation of the samples");
+    AddChoice                              ("training.shuffle.blocks", "Shuffle chunks of contiguous samples, then draw samples from a shuffle buffer");
+    AddParameter(ParameterType_Int,         "training.shuffle.blocks.chunksize", "Number of samples of the chunks (0: use training.blocksize)");
+    SetMinimumParameterIntValue            ("training.shuffle.blocks.chunksize", 0);
+    SetDefaultParameterInt                 ("training.shuffle.blocks.chunksize", 0);
+    AddParameter(ParameterType_Int,         "training.shuffle.blocks.buffer",    "Number of samples of the shuffle buffer");
+    SetMinimumParameterIntValue            ("training.shuffle.blocks.buffer",    1);
+    SetDefaultParameterInt                 ("training.shuffle.blocks.buffer",    10000);
+    AddParameter(ParameterType_Choice,      "training.sampling",       "Sampling of the samples of each epoch");
+    AddChoice                              ("training.sampling.uniform",  "All the samples, shuffled");
+    AddChoice                              ("training.sampling.balanced", "Draw the classes with a target distribution");
+    AddParameter(ParameterType_String,      "training.sampling.balanced.labels",  "Name of the input placeholder of the labels");
+    MandatoryOff                           ("training.sampling.balanced.labels");
+    AddParameter(ParameterType_StringList,  "training.sampling.balanced.weights", "Weights of the classes, as class=weight (default: uniform)");
+    MandatoryOff                           ("training.sampling.balanced.weights");
+    AddChoice                              ("training.sampling.weighted", "Draw the samples with per-sample weights");
+    AddParameter(ParameterType_InputImage,  "training.sampling.weighted.weights", "Image of the weights of the samples (one pixel per sample)");
+    MandatoryOff                           ("training.sampling.weighted.weights");
+    AddChoice                              ("training.sampling.hard",     "Oversample the samples with the highest losses");
+    AddParameter(ParameterType_String,      "training.sampling.hard.tensor",   "Name of the output tensor of the per-sample losses");
+    MandatoryOff                           ("training.sampling.hard.tensor");
+    AddParameter(ParameterType_Float,       "training.sampling.hard.fraction", "Fraction of the samples with the highest losses");
+    SetMinimumParameterFloatValue          ("training.sampling.hard.fraction", 0.0);
+    SetMaximumParameterFloatValue          ("training.sampling.hard.fraction", 1.0);
+    SetDefaultParameterFloat               ("training.sampling.hard.fraction", 0.2);
+    AddParameter(ParameterType_Float,       "training.sampling.hard.ratio",    "Share of each epoch drawn from the hardest samples");
+    SetMinimumParameterFloatValue          ("training.sampling.hard.ratio",    0.0);
+    SetMaximumParameterFloatValue          ("training.sampling.hard.ratio",    1.0);
+    SetDefaultParameterFloat               ("training.sampling.hard.ratio",    0.5);
+    AddParameter(ParameterType_StringList,  "training.datasetratios",  "Sampling ratios of the datasets, i.e. of the patches files of the sources (default: their numbers of samples)");
+    MandatoryOff                           ("training.datasetratios");
+    AddParameter(ParameterType_Int,         "training.epochsize",      "Number of samples of each epoch (0: number of samples)");
+    SetMinimumParameterIntValue            ("training.epochsize",      0);
+    SetDefaultParameterInt                 ("training.epochsize",      0);
+    AddParameter(ParameterType_Int,         "training.seed",           "Seed of the random generator");
+    MandatoryOff                           ("training.seed");
+    AddParameter(ParameterType_Int,         "training.prefetch",       "Number of batches prepared in background (0: no prefetching)");
+    SetMinimumParameterIntValue            ("training.prefetch",       0);
+    SetDefaultParameterInt                 ("training.prefetch",       0);
+    AddParameter(ParameterType_Group,       "training.telemetry",      "Telemetry of the batches");
+    AddParameter(ParameterType_OutputFilename, "training.telemetry.file", "Telemetry file of the batches (CSV, or JSON lines with the .json extension)");
+    MandatoryOff                           ("training.telemetry.file");
+    AddParameter(ParameterType_Int,         "training.telemetry.period", "Log the telemetry every Nth batches (0: disabled)");
+    SetMinimumParameterIntValue            ("training.telemetry.period", 0);
+    SetDefaultParameterInt                 ("training.telemetry.period", 0);
+    AddParameter(ParameterType_Int,         "training.telemetry.window", "Number of batches of the moving averages");
+    SetMinimumParameterIntValue            ("training.telemetry.window", 1);
+    SetDefaultParameterInt                 ("training.telemetry.window", 100);
+    AddParameter(ParameterType_Group,       "training.augmentation",   "Augmentation of the patches");
+    AddParameter(ParameterType_Int,         "training.augmentation.d4", "Number of D4 transforms drawn from (1: none, 2: flip x, 4: flips, 8: flips and transpositions)");
+    SetDefaultParameterInt                 ("training.augmentation.d4", 1);
+    AddParameter(ParameterType_Float,       "training.augmentation.gain", "Maximum deviation of the gains of the jittered bands from 1");
+    SetMinimumParameterFloatValue          ("training.augmentation.gain", 0);
+    SetDefaultParameterFloat               ("training.augmentation.gain", 0);
+    AddParameter(ParameterType_Float,       "training.augmentation.offset", "Maximum absolute value of the offsets of the jittered bands");
+    SetMinimumParameterFloatValue          ("training.augmentation.offset", 0);
+    SetDefaultParameterFloat               ("training.augmentation.offset", 0);
+    AddParameter(ParameterType_StringList,  "training.augmentation.jittered", "Placeholders of the jittered inputs");
+    MandatoryOff                           ("training.augmentation.jittered");
 
     // Metrics
     AddParameter(ParameterType_Group,       "validation",              "Validation parameters");
@@ -211,12 +358,54 @@ public:
     AddParameter(ParameterType_Choice,      "validation.mode",         "Metrics to compute");
     AddChoice                              ("validation.mode.none",    "No validation step");
     AddChoice                              ("validation.mode.class",   "Classification metrics");
-    AddChoice                              ("validation.mode.rmse",    "Root mean square error");
+    AddChoice                              ("validation.mode.rmse",    "Regression metrics (RMSE, MAE, bias, R2)");
+    AddParameter(ParameterType_Float,       "validation.mode.rmse.nodata", "No-data value of the references");
+    MandatoryOff                           ("validation.mode.rmse.nodata");
     AddParameter(ParameterType_StringList,  "validation.userplaceholders",
                  "Additional single-valued placeholders for validation. Supported types: int, float, bool.");
     MandatoryOff                           ("validation.userplaceholders");
+    AddParameter(ParameterType_Int,         "validation.batchsize",    "Batch size of the validation (default: training.batchsize)");
+    SetMinimumParameterIntValue            ("validation.batchsize",    1);
+    MandatoryOff                           ("validation.batchsize");
+    AddParameter(ParameterType_Int,         "validation.batchram",     "Size of the batch tensors of the validation, in MB, to compute the batch size (0: use validation.batchsize)");
+    SetMinimumParameterIntValue            ("validation.batchram",     0);
+    SetDefaultParameterInt                 ("validation.batchram",     0);
+    MandatoryOff                           ("validation.batchram");
     AddParameter(ParameterType_Bool,        "validation.usestreaming", "Use the streaming through patches (slower but can process big dataset)");
     MandatoryOff                           ("validation.usestreaming");
+    AddParameter(ParameterType_Int,         "validation.learningsubset", "Number of learning samples used to evaluate the metrics on the learning data (0: all)");
+    SetMinimumParameterIntValue            ("validation.learningsubset", 0);
+    SetDefaultParameterInt                 ("validation.learningsubset", 0);
+    MandatoryOff                           ("validation.learningsubset");
+    AddParameter(ParameterType_Bool,        "validation.background",   "Validate a snapshot of the model in a background thread, while the training goes on");
+    MandatoryOff                           ("validation.background");
+
+    // Checkpoints
+    AddParameter(ParameterType_Group,       "checkpoint",         "Periodic checkpoints of the model");
+    AddParameter(ParameterType_Directory,   "checkpoint.dir",     "Directory of the checkpoints");
+    MandatoryOff                           ("checkpoint.dir");
+    AddParameter(ParameterType_Int,         "checkpoint.epochs",  "Save a checkpoint every Nth epochs (0: disabled)");
+    SetMinimumParameterIntValue            ("checkpoint.epochs",  0);
+    SetDefaultParameterInt                 ("checkpoint.epochs",  1);
+    AddParameter(ParameterType_Int,         "checkpoint.batches", "Save a checkpoint every Nth batches (0: disabled)");
+    SetMinimumParameterIntValue            ("checkpoint.batches", 0);
+    SetDefaultParameterInt                 ("checkpoint.batches", 0);
+    AddParameter(ParameterType_Int,         "checkpoint.keep",    "Number of checkpoints to keep");
+    SetMinimumParameterIntValue            ("checkpoint.keep",    1);
+    SetDefaultParameterInt                 ("checkpoint.keep",    3);
+
+    // Profiling
+    AddParameter(ParameterType_Group,          "profiling",       "Profiling");
+    AddParameter(ParameterType_OutputFilename, "profiling.trace", "Chrome trace-event JSON file");
+    SetParameterDescription                   ("profiling.trace", "When set, the tensors population and the session run "
+        "of each batch are recorded and exported in this file, which can be opened with chrome://tracing. A summary of "
+        "the latencies and the throughput is logged at the end of the processing.");
+    MandatoryOff                              ("profiling.trace");
+    AddParameter(ParameterType_Int,            "profiling.opperiod", "Trace the TensorFlow ops every Nth session run (0: disabled)");
+    SetParameterDescription                   ("profiling.opperiod", "The step stats of the traced session runs are added to the "
+        "trace, and the ops types are ranked by total time at the end of the processing. Requires profiling.trace.");
+    SetMinimumParameterIntValue               ("profiling.opperiod", 0);
+    SetDefaultParameterInt                    ("profiling.opperiod", 0);
 
     // Input/output images
     AddAnInputImage();
@@ -241,6 +430,106 @@ public:
 
   }
 
+  //
+  // Get the learning data of a source, for the evaluation. With the background
+  // validation, the evaluation runs while the training reads the learning
+  // data, so the images are read again through their own pipeline.
+  //
+  FloatVectorImageType::Pointer GetLearningDataImageForEvaluation(ProcessObjectsBundle & bundle,
+      FloatVectorImageType::Pointer trainImage)
+  {
+    if (!GetParameterInt("validation.background"))
+      {
+      return trainImage;
+      }
+
+    if (HasValue(bundle.m_KeyPatchesForTrain))
+      {
+      return GetPatchesImage(bundle.m_KeyPatchesForTrain, bundle.patchesSourceForEvaluation);
+      }
+
+    FloatVectorImageListType::Pointer stack = FloatVectorImageListType::New();
+    bundle.readersForEvaluation.clear();
+    for (auto& fileName: GetParameterStringList(bundle.m_KeyInForTrain))
+      {
+      ImageReaderType::Pointer reader = ImageReaderType::New();
+      reader->SetFileName(fileName);
+      reader->UpdateOutputInformation();
+      bundle.readersForEvaluation.push_back(reader);
+      stack->PushBack(reader->GetOutput());
+      }
+    bundle.tfSourceForEvaluation.Set(stack);
+    FloatVectorImageType::Pointer image = bundle.tfSourceForEvaluation.Get();
+    image->UpdateOutputInformation();
+    return image;
+  }
+
+  //
+  // Get the image of the patches files of a source: the image read from the
+  // file, or the concatenation of the images of the files (one per dataset)
+  //
+  FloatVectorImageType::Pointer GetPatchesImage(const std::string & keyPatches, PatchesSource & source)
+  {
+    source.readers.clear();
+    source.concatenation = nullptr;
+    for (auto& fileName: GetParameterStringList(keyPatches))
+      {
+      PatchesReaderType::Pointer reader = PatchesReaderType::New();
+      reader->SetFileName(fileName);
+      reader->UpdateOutputInformation();
+      source.readers.push_back(reader);
+      }
+    if (source.readers.size() == 1)
+      {
+      return source.readers[0]->GetOutput();
+      }
+
+    source.concatenation = PatchesConcatenationType::New();
+    for (auto& reader: source.readers)
+      {
+      source.concatenation->AddImage(reader->GetOutput());
+      }
+    source.concatenation->UpdateOutputInformation();
+    return source.concatenation->GetOutput();
+  }
+
+  //
+  // Get the image of one source: the image read from the patches files if
+  // they are set, or the stack of the images of the list otherwise
+  //
+  FloatVectorImageType::Pointer GetSourceImage(const std::string & keyIn, const std::string & keyPatches,
+      const FloatVectorImageType::SizeType & patchSize, TFSource & source, PatchesSource & patchesSource,
+      DatasetSizesType & datasetSizes)
+  {
+    datasetSizes.clear();
+    if (HasValue(keyPatches))
+      {
+      FloatVectorImageType::Pointer image = GetPatchesImage(keyPatches, patchesSource);
+      for (auto& reader: patchesSource.readers)
+        {
+        if (reader->GetPatchSize() != patchSize)
+          {
+          otbAppLogFATAL("The patch size of " << reader->GetFileName() << " is " << reader->GetPatchSize()
+              << " but the patch size of the source is " << patchSize);
+          }
+        otbAppLogINFO("Patches file             : " << reader->GetFileName() << " ("
+            << reader->GetHeader().numberOfSamples << " samples of type "
+            << tf::GetPatchesFileDataTypeName(reader->GetHeader().dataType) << ", compression: "
+            << tf::GetPatchesFileCompressionName(reader->GetHeader().compression) << ")");
+        datasetSizes.push_back(reader->GetHeader().numberOfSamples);
+        }
+      return image;
+      }
+
+    if (!HasValue(keyIn))
+      {
+      otbAppLogFATAL("No input is set for " << keyIn << " or " << keyPatches);
+      }
+    FloatVectorImageListType::Pointer stack = GetParameterImageList(keyIn);
+    source.Set(stack);
+    return source.Get();
+  }
+
   //
   // Prepare bundles
   // Here, we populate the two following groups:
@@ -277,25 +566,43 @@ public:
     m_InputTargetsForEvaluationAgainstValidationData.clear();
     m_InputTargetsForEvaluationAgainstLearningData.clear();
 
+    // Clear datasets
+    m_DatasetSizes.clear();
+
 
     // Prepare the bundles
     for (auto& bundle: m_Bundles)
       {
-      // Source
-      FloatVectorImageListType::Pointer trainStack = GetParameterImageList(bundle.m_KeyInForTrain);
-      bundle.tfSource.Set(trainStack);
-      m_InputSourcesForTraining.push_back(bundle.tfSource.Get());
-
-      // Placeholder
-      std::string placeholderForTraining = GetParameterAsString(bundle.m_KeyPHNameForTrain);
-      m_InputPlaceholdersForTraining.push_back(placeholderForTraining);
-
       // Patch size
       FloatVectorImageType::SizeType patchSize;
       patchSize[0] = GetParameterInt(bundle.m_KeyPszX);
       patchSize[1] = GetParameterInt(bundle.m_KeyPszY);
       m_InputPatchesSizeForTraining.push_back(patchSize);
 
+      // Source
+      DatasetSizesType datasetSizes;
+      FloatVectorImageType::Pointer trainImage = GetSourceImage(bundle.m_KeyInForTrain, bundle.m_KeyPatchesForTrain,
+          patchSize, bundle.tfSource, bundle.patchesSource, datasetSizes);
+      m_InputSourcesForTraining.push_back(trainImage);
+
+      // Datasets: the sources with several patches files must have the same datasets
+      if (datasetSizes.size() > 1)
+        {
+        if (m_DatasetSizes.empty())
+          {
+          m_DatasetSizes = datasetSizes;
+          }
+        else if (datasetSizes != m_DatasetSizes)
+          {
+          otbAppLogFATAL("The patches files of " << bundle.m_KeyPatchesForTrain << " do not have the same numbers "
+              "of samples as the patches files of the previous sources");
+          }
+        }
+
+      // Placeholder
+      std::string placeholderForTraining = GetParameterAsString(bundle.m_KeyPHNameForTrain);
+      m_InputPlaceholdersForTraining.push_back(placeholderForTraining);
+
       otbAppLogINFO("New source:");
       otbAppLogINFO("Patch size               : "<< patchSize);
       otbAppLogINFO("Placeholder (training)   : "<< placeholderForTraining);
@@ -303,13 +610,14 @@ public:
       // Prepare validation sources
       if (GetParameterInt("validation.mode") != 0)
         {
-        // Get the stack
-        if (!HasValue(bundle.m_KeyInForValid))
+        // Get the stack, or the patches file
+        if (!HasValue(bundle.m_KeyInForValid) && !HasValue(bundle.m_KeyPatchesForValid))
           {
           otbAppLogFATAL("No validation input is set for this source");
           }
-        FloatVectorImageListType::Pointer validStack = GetParameterImageList(bundle.m_KeyInForValid);
-        bundle.tfSourceForValidation.Set(validStack);
+        DatasetSizesType validDatasetSizes;
+        FloatVectorImageType::Pointer validImage = GetSourceImage(bundle.m_KeyInForValid, bundle.m_KeyPatchesForValid,
+            patchSize, bundle.tfSourceForValidation, bundle.patchesSourceForValidation, validDatasetSizes);
 
         // We check if the placeholder is the same for training and for validation
         // If yes, it means that its not an output tensor on which perform the validation
@@ -322,8 +630,8 @@ public:
         if (placeholderForValidation.compare(placeholderForTraining) == 0)
           {
           // Source
-          m_InputSourcesForEvaluationAgainstValidationData.push_back(bundle.tfSourceForValidation.Get());
-          m_InputSourcesForEvaluationAgainstLearningData.push_back(bundle.tfSource.Get());
+          m_InputSourcesForEvaluationAgainstValidationData.push_back(validImage);
+          m_InputSourcesForEvaluationAgainstLearningData.push_back(GetLearningDataImageForEvaluation(bundle, trainImage));
 
           // Placeholder
           m_InputPlaceholdersForValidation.push_back(placeholderForValidation);
@@ -338,8 +646,8 @@ public:
         else
           {
           // Source
-          m_InputTargetsForEvaluationAgainstValidationData.push_back(bundle.tfSourceForValidation.Get());
-          m_InputTargetsForEvaluationAgainstLearningData.push_back(bundle.tfSource.Get());
+          m_InputTargetsForEvaluationAgainstValidationData.push_back(validImage);
+          m_InputTargetsForEvaluationAgainstLearningData.push_back(GetLearningDataImageForEvaluation(bundle, trainImage));
 
           // Placeholder
           m_TargetTensorsNames.push_back(placeholderForValidation);
@@ -372,6 +680,305 @@ public:
     return dict;
   }
 
+  //
+  // Get the sampling ratios of the datasets (empty: their numbers of samples)
+  //
+  TrainModelFilterType::DatasetRatiosType GetDatasetRatios(const std::string key)
+  {
+    TrainModelFilterType::DatasetRatiosType ratios;
+    if (!HasValue(key))
+      {
+      return ratios;
+      }
+    for (auto& exp: GetParameterStringList(key))
+      {
+      try
+        {
+        ratios.push_back(std::stof(exp));
+        }
+      catch (const std::exception & e)
+        {
+        otbAppLogFATAL("Unable to read the dataset ratio \"" << exp << "\"");
+        }
+      }
+    if (ratios.size() != m_DatasetSizes.size())
+      {
+      otbAppLogFATAL("There are " << ratios.size() << " dataset ratios but " << m_DatasetSizes.size() << " datasets");
+      }
+    return ratios;
+  }
+
+  //
+  // Get the weights of the classes, from "class=weight" expressions
+  //
+  TrainModelFilterType::ClassWeightsType GetClassWeights(const std::string key)
+  {
+    TrainModelFilterType::ClassWeightsType weights;
+    for (auto& exp: GetParameterStringList(key))
+      {
+      const std::string::size_type pos = exp.find('=');
+      if (pos == std::string::npos)
+        {
+        otbAppLogFATAL("The class weight \"" << exp << "\" is not formatted as class=weight");
+        }
+      try
+        {
+        weights[std::stoi(exp.substr(0, pos))] = std::stof(exp.substr(pos + 1));
+        }
+      catch (const std::exception & e)
+        {
+        otbAppLogFATAL("Unable to read the class weight \"" << exp << "\"");
+        }
+      }
+    return weights;
+  }
+
+  //
+  // Get the weights of the samples, from the first band of an image
+  //
+  TrainModelFilterType::SampleWeightsType GetSampleWeights(const std::string key)
+  {
+    FloatVectorImageType::Pointer image = GetParameterFloatVectorImage(key);
+    image->Update();
+    TrainModelFilterType::SampleWeightsType weights;
+    weights.reserve(image->GetLargestPossibleRegion().GetNumberOfPixels());
+    itk::ImageRegionConstIterator<FloatVectorImageType> it(image, image->GetLargestPossibleRegion());
+    for (it.GoToBegin() ; !it.IsAtEnd() ; ++it)
+      {
+      weights.push_back(it.Get()[0]);
+      }
+    return weights;
+  }
+
+  //
+  // Print the regression metrics of each channel
+  //
+  void PrintRegressionMetrics(const RegressionMetricsListType & metrics)
+  {
+    for (unsigned int c = 0 ; c < metrics.size() ; c++)
+      {
+      otbAppLogINFO("Channel " << c << ": " << metrics[c].count << " values, RMSE: " << metrics[c].rmse
+          << ", MAE: " << metrics[c].mae << ", bias: " << metrics[c].bias << ", R2: " << metrics[c].r2);
+      }
+    otbAppLogINFO("\t");
+  }
+
+  //
+  // Setup the parameters common to the validation filters
+  //
+  void SetupValidationFilter(ValidateModelBaseFilterType * filter, tensorflow::SavedModelBundle & model)
+  {
+    filter->SetGraph(model.meta_graph_def.graph_def());
+    filter->SetSession(model.session.get());
+    filter->SetBatchSize(GetParameterInt(HasValue("validation.batchsize") ? "validation.batchsize" : "training.batchsize"));
+    filter->SetBatchRAM(GetParameterInt("validation.batchram"));
+    filter->SetPrefetchDepth(GetParameterInt("training.prefetch"));
+    filter->SetStreamingBlockSize(GetParameterInt("training.blocksize"));
+    filter->SetStreamingCacheRAM(GetParameterInt("training.cacheram"));
+    filter->SetUserPlaceholders(GetUserPlaceholders("validation.userplaceholders"));
+    filter->SetInputPlaceholders(m_InputPlaceholdersForValidation);
+    filter->SetInputReceptiveFields(m_InputPatchesSizeForValidation);
+    filter->SetOutputTensors(m_TargetTensorsNames);
+    filter->SetOutputExpressionFields(m_TargetPatchesSize);
+    filter->SetProfiler(m_Profiler);
+    filter->SetTracingPeriod(GetParameterInt("profiling.opperiod"));
+  }
+
+  //
+  // Run a validation filter over some sources and references
+  //
+  void RunValidationFilter(ValidateModelBaseFilterType * filter,
+      const std::vector<FloatVectorImageType::Pointer> & sources,
+      const std::vector<FloatVectorImageType::Pointer> & targets, const IndexListType & subset, bool useStreaming,
+      const std::string & dataName, bool reportProgress)
+  {
+    for (unsigned int i = 0 ; i < sources.size() ; i++)
+      {
+      filter->SetInput(i, sources[i]);
+      }
+    filter->SetInputReferences(targets);
+    filter->SetSampleSubset(subset);
+    filter->SetUseStreaming(useStreaming);
+
+    // Update
+    if (reportProgress)
+      {
+      AddProcess(filter, "Evaluate model (" + dataName + ")");
+      }
+    filter->Update();
+    if (reportProgress && filter->GetBatchRAM() > 0)
+      {
+      otbAppLogINFO("Batch size of the validation (" << dataName << "): " << filter->GetBatchSize());
+      }
+  }
+
+  //
+  // Evaluate the model over some sources and references
+  //
+  ValidationResults EvaluateModel(const std::vector<FloatVectorImageType::Pointer> & sources,
+      const std::vector<FloatVectorImageType::Pointer> & targets, const IndexListType & subset, bool useStreaming,
+      const std::string & dataName, bool reportProgress)
+  {
+    ValidationResults results;
+    results.dataName = dataName;
+    if (m_ValidateModelFilter)
+      {
+      RunValidationFilter(m_ValidateModelFilter.GetPointer(), sources, targets, subset, useStreaming, dataName,
+          reportProgress);
+      for (unsigned int i = 0 ; i < m_TargetTensorsNames.size() ; i++)
+        {
+        results.confusionMatrices.push_back(m_ValidateModelFilter->GetConfusionMatrix(i));
+        results.mapsOfClasses.push_back(m_ValidateModelFilter->GetMapOfClasses(i));
+        }
+      }
+    else if (m_RegressionValidateModelFilter)
+      {
+      RunValidationFilter(m_RegressionValidateModelFilter.GetPointer(), sources, targets, subset, useStreaming,
+          dataName, reportProgress);
+      for (unsigned int i = 0 ; i < m_TargetTensorsNames.size() ; i++)
+        {
+        results.regressionMetrics.push_back(m_RegressionValidateModelFilter->GetMetrics(i));
+        }
+      }
+    return results;
+  }
+
+  //
+  // Evaluate the model against the learning data and the validation data
+  //
+  ValidationResultsList EvaluateModel(bool reportProgress)
+  {
+    ValidationResultsList resultsList;
+
+    // 1. Evaluate the metrics against the learning data (or the subset of the learning data)
+    // As we use the learning data here, it's rational to use the same option as streaming during training
+    resultsList.push_back(EvaluateModel(m_InputSourcesForEvaluationAgainstLearningData,
+        m_InputTargetsForEvaluationAgainstLearningData, m_LearningDataSubset, GetParameterInt("training.usestreaming"),
+        "Learning data", reportProgress));
+
+    // 2. Evaluate the metrics against the validation data
+    resultsList.push_back(EvaluateModel(m_InputSourcesForEvaluationAgainstValidationData,
+        m_InputTargetsForEvaluationAgainstValidationData, IndexListType(), GetParameterInt("validation.usestreaming"),
+        "Validation data", reportProgress));
+
+    return resultsList;
+  }
+
+  //
+  // Print the metrics of the evaluations
+  //
+  void PrintValidationResults(const ValidationResultsList & resultsList, int epoch)
+  {
+    for (auto& results: resultsList)
+      {
+      otbAppLogINFO("Evaluation of the model of epoch #" << epoch << " (" << results.dataName << ")");
+      for (unsigned int i = 0 ; i < m_TargetTensorsNames.size() ; i++)
+        {
+        otbAppLogINFO("Metrics for target \"" << m_TargetTensorsNames[i] << "\":");
+        if (i < results.confusionMatrices.size())
+          PrintClassificationMetrics(results.confusionMatrices[i], results.mapsOfClasses[i]);
+        if (i < results.regressionMetrics.size())
+          PrintRegressionMetrics(results.regressionMetrics[i]);
+        }
+      }
+  }
+
+  //
+  // Print the metrics of the background validation, when they are ready (or
+  // wait for them)
+  //
+  void ReportBackgroundValidation(bool wait)
+  {
+    if (!m_BackgroundValidation.valid())
+      return;
+    if (!wait && m_BackgroundValidation.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+      return;
+    PrintValidationResults(m_BackgroundValidation.get(), m_BackgroundValidationEpoch);
+  }
+
+  //
+  // Start the validation of a snapshot of the variables in a background thread.
+  // The variables are saved, then restored in the session of validation. Like
+  // the checkpoints, the snapshot is saved in this thread between two training
+  // steps, so the save ops of the session never run concurrently (the
+  // checkpoint thread only renames and removes files).
+  //
+  void StartBackgroundValidation(int epoch)
+  {
+    ReportBackgroundValidation(true);
+    tf::SaveModel(m_SnapshotPath, m_SavedModel);
+    tf::RestoreModel(m_SnapshotPath, m_ValidationModel);
+    m_BackgroundValidationEpoch = epoch;
+    m_BackgroundValidation = std::async(std::launch::async, [this]() { return EvaluateModel(false); });
+  }
+
+  //
+  // Remove the files of the snapshot of the variables
+  //
+  void RemoveSnapshot()
+  {
+    tensorflow::Env * env = tensorflow::Env::Default();
+    std::vector<std::string> files;
+    if (env->GetMatchingPaths(m_SnapshotPath + "*", &files).ok())
+      {
+      for (auto& file: files)
+        env->DeleteFile(file);
+      }
+  }
+
+  //
+  // Save a checkpoint, named after the number of trained batches. Called
+  // between two training steps: the variables are saved before the training
+  // goes on, and the checkpoint is finalized in background.
+  //
+  void StartCheckpoint()
+  {
+    if (m_NumberOfTrainedBatches == m_LastCheckpointStep)
+      return;
+    otbAppLogINFO("Saving checkpoint of step " << m_NumberOfTrainedBatches);
+    m_CheckpointManager->Save(m_NumberOfTrainedBatches);
+    m_LastCheckpointStep = m_NumberOfTrainedBatches;
+  }
+
+  //
+  // Log the telemetry of the last training batch
+  //
+  void PrintBatchTelemetry()
+  {
+    const TrainModelFilterType::BatchTelemetryType & telemetry = m_TrainModelFilter->GetLastBatchTelemetry();
+    const StringList names = m_TrainModelFilter->GetOutputTensors();
+    std::stringstream ss;
+    ss << "Epoch " << telemetry.epoch << ", batch " << telemetry.batch << ":";
+    for (unsigned int i = 0 ; i < telemetry.values.size() && i < names.size() ; i++)
+      {
+      if (!std::isnan(telemetry.values[i]))
+        ss << " " << names[i] << "=" << telemetry.values[i] << " (average " << telemetry.averages[i] << "),";
+      }
+    const double batchTime = telemetry.assemblyTime + telemetry.runTime;
+    const double assemblyShare = batchTime > 0 ? 100.0 * telemetry.assemblyTime / batchTime : 0;
+    ss << " " << telemetry.samplesPerSecond << " samples/s, assembly " << telemetry.assemblyTime << " s ("
+        << assemblyShare << "%), session run " << telemetry.runTime << " s (" << 100.0 - assemblyShare << "%)";
+    otbAppLogINFO(ss.str());
+  }
+
+  //
+  // Called after each training batch
+  //
+  void TrainingBatchDone()
+  {
+    m_NumberOfTrainedBatches++;
+    const int telemetryPeriod = GetParameterInt("training.telemetry.period");
+    if (telemetryPeriod > 0 && m_NumberOfTrainedBatches % telemetryPeriod == 0)
+      {
+      PrintBatchTelemetry();
+      }
+    const int period = GetParameterInt("checkpoint.batches");
+    if (m_CheckpointManager && period > 0 && m_NumberOfTrainedBatches % period == 0)
+      {
+      StartCheckpoint();
+      }
+  }
+
   //
   // Print some classification metrics
   //
@@ -410,7 +1017,16 @@ public:
     // Check if we have to restore variables from somewhere
     if (HasValue("model.restorefrom"))
       {
-      const std::string path = GetParameterAsString("model.restorefrom");
+      std::string path = GetParameterAsString("model.restorefrom");
+      if (tensorflow::Env::Default()->IsDirectory(path).ok())
+        {
+        const std::string checkpoint = CheckpointManagerType::GetLatestCheckpoint(path);
+        if (checkpoint.empty())
+          {
+          otbAppLogFATAL("No complete checkpoint in the directory " << path);
+          }
+        path = checkpoint;
+        }
       otbAppLogINFO("Restoring model from " + path);
       tf::RestoreModel(path, m_SavedModel);
       }
@@ -427,6 +1043,109 @@ public:
     m_TrainModelFilter->SetBatchSize(GetParameterInt("training.batchsize"));
     m_TrainModelFilter->SetUserPlaceholders(GetUserPlaceholders("training.userplaceholders"));
     m_TrainModelFilter->SetUseStreaming(GetParameterInt("training.usestreaming"));
+    m_TrainModelFilter->SetPrefetchDepth(GetParameterInt("training.prefetch"));
+    m_TrainModelFilter->SetStreamingBlockSize(GetParameterInt("training.blocksize"));
+    m_TrainModelFilter->SetStreamingCacheRAM(GetParameterInt("training.cacheram"));
+    m_TrainModelFilter->SetEpochCacheRAM(GetParameterInt("training.epochcache"));
+    m_TrainModelFilter->SetEpochCacheCompression(GetParameterInt("training.epochcachecompression"));
+    m_TrainModelFilter->SetTelemetryWindow(GetParameterInt("training.telemetry.window"));
+    if (HasValue("training.telemetry.file"))
+      {
+      m_TrainModelFilter->SetTelemetryFileName(GetParameterAsString("training.telemetry.file"));
+      }
+
+    // Shuffle
+    if (GetParameterInt("training.shuffle") == 1) // blocks
+      {
+      m_TrainModelFilter->SetShuffleMode(TrainModelFilterType::SHUFFLE_BLOCKS);
+      m_TrainModelFilter->SetShuffleChunkSize(GetParameterInt("training.shuffle.blocks.chunksize"));
+      m_TrainModelFilter->SetShuffleBufferSize(GetParameterInt("training.shuffle.blocks.buffer"));
+      }
+    const int d4 = GetParameterInt("training.augmentation.d4");
+    if (d4 != 1 && d4 != 2 && d4 != 4 && d4 != 8)
+      {
+      otbAppLogFATAL("The number of D4 transforms must be 1, 2, 4 or 8");
+      }
+    m_TrainModelFilter->SetAugmentationTransforms(d4);
+    m_TrainModelFilter->SetGainJitter(GetParameterFloat("training.augmentation.gain"));
+    m_TrainModelFilter->SetOffsetJitter(GetParameterFloat("training.augmentation.offset"));
+    if (HasValue("training.augmentation.jittered"))
+      {
+      m_TrainModelFilter->SetJitteredPlaceholders(GetParameterStringList("training.augmentation.jittered"));
+      }
+
+    // Sampling
+    m_TrainModelFilter->SetEpochSize(GetParameterInt("training.epochsize"));
+    if (GetParameterInt("training.sampling") == 1) // balanced
+      {
+      if (!HasValue("training.sampling.balanced.labels"))
+        {
+        otbAppLogFATAL("The balanced sampling requires training.sampling.balanced.labels");
+        }
+      m_TrainModelFilter->SetSamplingMode(TrainModelFilterType::SAMPLING_BALANCED);
+      m_TrainModelFilter->SetLabelsPlaceholder(GetParameterString("training.sampling.balanced.labels"));
+      m_TrainModelFilter->SetClassWeights(GetClassWeights("training.sampling.balanced.weights"));
+      }
+    else if (GetParameterInt("training.sampling") == 2) // weighted
+      {
+      if (!HasValue("training.sampling.weighted.weights"))
+        {
+        otbAppLogFATAL("The weighted sampling requires training.sampling.weighted.weights");
+        }
+      m_TrainModelFilter->SetSamplingMode(TrainModelFilterType::SAMPLING_WEIGHTED);
+      m_TrainModelFilter->SetSampleWeights(GetSampleWeights("training.sampling.weighted.weights"));
+      }
+    else if (GetParameterInt("training.sampling") == 3) // hard
+      {
+      if (!HasValue("training.sampling.hard.tensor"))
+        {
+        otbAppLogFATAL("The hard examples sampling requires training.sampling.hard.tensor");
+        }
+      const std::string lossesTensor = GetParameterString("training.sampling.hard.tensor");
+      std::vector<std::string> outputTensors = GetParameterStringList("training.outputtensors");
+      if (std::find(outputTensors.begin(), outputTensors.end(), lossesTensor) == outputTensors.end())
+        {
+        outputTensors.push_back(lossesTensor);
+        m_TrainModelFilter->SetOutputTensors(outputTensors);
+        }
+      m_TrainModelFilter->SetSamplingMode(TrainModelFilterType::SAMPLING_HARD);
+      m_TrainModelFilter->SetSampleLossesTensor(lossesTensor);
+      m_TrainModelFilter->SetHardExamplesFraction(GetParameterFloat("training.sampling.hard.fraction"));
+      m_TrainModelFilter->SetHardExamplesRatio(GetParameterFloat("training.sampling.hard.ratio"));
+      }
+
+    if (m_DatasetSizes.size() > 1)
+      {
+      if (GetParameterInt("training.sampling") != 0)
+        {
+        otbAppLogFATAL("The patches files of several datasets require the uniform sampling");
+        }
+      m_TrainModelFilter->SetDatasetSizes(m_DatasetSizes);
+      m_TrainModelFilter->SetDatasetRatios(GetDatasetRatios("training.datasetratios"));
+      otbAppLogINFO("Number of datasets: " << m_DatasetSizes.size());
+      }
+    else if (HasValue("training.datasetratios"))
+      {
+      otbAppLogWARNING("The training data have one dataset: training.datasetratios is ignored");
+      }
+
+    if (HasValue("training.seed"))
+      {
+      m_TrainModelFilter->SetSeed(GetParameterInt("training.seed"));
+      }
+
+    // Profiling
+    if (HasValue("profiling.trace"))
+      {
+      m_Profiler = ProfilerType::New();
+      m_Profiler->StartChromeTrace(GetParameterAsString("profiling.trace"));
+      m_TrainModelFilter->SetProfiler(m_Profiler);
+      m_TrainModelFilter->SetTracingPeriod(GetParameterInt("profiling.opperiod"));
+      }
+    else if (GetParameterInt("profiling.opperiod") > 0)
+      {
+      otbAppLogWARNING("The tracing of the ops requires profiling.trace: profiling.opperiod is ignored");
+      }
 
     // Set inputs
     for (unsigned int i = 0 ; i < m_InputSourcesForTraining.size() ; i++)
@@ -437,28 +1156,68 @@ public:
           m_InputSourcesForTraining[i]);
       }
 
+    // Setup the checkpoints
+    m_NumberOfTrainedBatches = 0;
+    m_LastCheckpointStep = 0;
+    if (HasValue("checkpoint.dir"))
+      {
+      m_CheckpointManager = CheckpointManagerType::New();
+      m_CheckpointManager->SetDirectory(GetParameterAsString("checkpoint.dir"));
+      m_CheckpointManager->SetMaxToKeep(GetParameterInt("checkpoint.keep"));
+      m_CheckpointManager->SetModel(&m_SavedModel);
+      }
+    CommandType::Pointer batchCommand = CommandType::New();
+    batchCommand->SetCallbackFunction(this, &TensorflowModelTrain::TrainingBatchDone);
+    m_TrainModelFilter->AddObserver(itk::IterationEvent(), batchCommand);
+
     // Setup the validation filter
     const bool do_validation = HasUserValue("validation.mode");
+    const bool background = do_validation && GetParameterInt("validation.background");
+    tensorflow::SavedModelBundle & validationModel = background ? m_ValidationModel : m_SavedModel;
+    if (background)
+      {
+      // Second session, in which the variables are restored before each validation
+      otbAppLogINFO("The validation runs in background, on a snapshot of the model");
+      tf::LoadModel(GetParameterAsString("model.dir"), m_ValidationModel);
+      std::vector<std::string> tempDirs;
+      tensorflow::Env::Default()->GetLocalTempDirectories(&tempDirs);
+      m_SnapshotPath = (tempDirs.empty() ? std::string(".") : tempDirs[0]) + "/otbtf_validation_snapshot_" +
+          std::to_string(tensorflow::Env::Default()->NowMicros());
+      }
     if (GetParameterInt("validation.mode")==1) // class
       {
       otbAppLogINFO("Set validation mode to classification validation");
 
       m_ValidateModelFilter = ValidateModelFilterType::New();
-      m_ValidateModelFilter->SetGraph(m_SavedModel.meta_graph_def.graph_def());
-      m_ValidateModelFilter->SetSession(m_SavedModel.session.get());
-      m_ValidateModelFilter->SetBatchSize(GetParameterInt("training.batchsize"));
-      m_ValidateModelFilter->SetUserPlaceholders(GetUserPlaceholders("validation.userplaceholders"));
-      m_ValidateModelFilter->SetInputPlaceholders(m_InputPlaceholdersForValidation);
-      m_ValidateModelFilter->SetInputReceptiveFields(m_InputPatchesSizeForValidation);
-      m_ValidateModelFilter->SetOutputTensors(m_TargetTensorsNames);
-      m_ValidateModelFilter->SetOutputExpressionFields(m_TargetPatchesSize);
+      SetupValidationFilter(m_ValidateModelFilter.GetPointer(), validationModel);
       }
-    else if (GetParameterInt("validation.mode")==2) // rmse)
+    else if (GetParameterInt("validation.mode")==2) // rmse
       {
-      otbAppLogINFO("Set validation mode to classification RMSE evaluation");
-      otbAppLogFATAL("Not implemented yet !"); // XD
+      otbAppLogINFO("Set validation mode to regression metrics evaluation");
 
-      // TODO
+      m_RegressionValidateModelFilter = RegressionValidateModelFilterType::New();
+      SetupValidationFilter(m_RegressionValidateModelFilter.GetPointer(), validationModel);
+      if (HasValue("validation.mode.rmse.nodata"))
+        {
+        m_RegressionValidateModelFilter->SetNoDataValue(GetParameterFloat("validation.mode.rmse.nodata"));
+        m_RegressionValidateModelFilter->UseNoDataValueOn();
+        }
+      }
+
+    // Subset of the learning data, drawn once: the metrics of all the epochs are computed on the same samples
+    m_LearningDataSubset.clear();
+    if (do_validation && GetParameterInt("validation.mode") != 0 && GetParameterInt("validation.learningsubset") > 0)
+      {
+      if (m_InputTargetsForEvaluationAgainstLearningData.empty())
+        {
+        otbAppLogFATAL("validation.learningsubset requires a target, i.e. a source whose validation name differs "
+            "from its training placeholder");
+        }
+      const unsigned int seed = HasValue("training.seed") ? GetParameterInt("training.seed") : std::random_device()();
+      m_LearningDataSubset = tf::DrawSamplesSubset<FloatVectorImageType>(m_InputTargetsForEvaluationAgainstLearningData[0],
+          m_TargetPatchesSize[0], GetParameterInt("validation.learningsubset"), GetParameterInt("validation.mode")==1, seed);
+      otbAppLogINFO("The metrics on the learning data are evaluated on a subset of " << m_LearningDataSubset.size()
+          << " samples");
       }
 
     // Epoch
@@ -467,57 +1226,50 @@ public:
       // Train the model
       AddProcess(m_TrainModelFilter, "Training epoch #" + std::to_string(epoch));
       m_TrainModelFilter->Update();
+      if (GetParameterInt("training.usestreaming") && GetParameterInt("training.epochcache") > 0)
+        {
+        otbAppLogINFO("Epoch cache: " << m_TrainModelFilter->GetEpochCacheNumberOfBlocks() << " blocks, "
+            << m_TrainModelFilter->GetEpochCacheBytes() / (1024.0 * 1024.0) << " MB, "
+            << m_TrainModelFilter->GetEpochCacheHits() << " blocks decoded during this epoch");
+        }
+
+      // Save a checkpoint
+      const int checkpointPeriod = GetParameterInt("checkpoint.epochs");
+      if (m_CheckpointManager && checkpointPeriod > 0 && epoch % checkpointPeriod == 0)
+        {
+        StartCheckpoint();
+        }
 
       if (do_validation)
       {
         // Validate the model
         if (epoch % GetParameterInt("validation.step") == 0)
         {
-          // 1. Evaluate the metrics against the learning data
-
-          for (unsigned int i = 0 ; i < m_InputSourcesForEvaluationAgainstLearningData.size() ; i++)
-          {
-            m_ValidateModelFilter->SetInput(i, m_InputSourcesForEvaluationAgainstLearningData[i]);
-          }
-          m_ValidateModelFilter->SetInputReferences(m_InputTargetsForEvaluationAgainstLearningData);
-
-          // As we use the learning data here, it's rational to use the same option as streaming during training
-          m_ValidateModelFilter->SetUseStreaming(GetParameterInt("training.usestreaming"));
-
-          // Update
-          AddProcess(m_ValidateModelFilter, "Evaluate model (Learning data)");
-          m_ValidateModelFilter->Update();
-
-          for (unsigned int i = 0 ; i < m_TargetTensorsNames.size() ; i++)
-          {
-            otbAppLogINFO("Metrics for target \"" << m_TargetTensorsNames[i] << "\":");
-            PrintClassificationMetrics(m_ValidateModelFilter->GetConfusionMatrix(i), m_ValidateModelFilter->GetMapOfClasses(i));
-          }
-
-          // 2. Evaluate the metrics against the validation data
-
-          // Here we just change the input sources and references
-          for (unsigned int i = 0 ; i < m_InputSourcesForEvaluationAgainstValidationData.size() ; i++)
-          {
-            m_ValidateModelFilter->SetInput(i, m_InputSourcesForEvaluationAgainstValidationData[i]);
-          }
-          m_ValidateModelFilter->SetInputReferences(m_InputTargetsForEvaluationAgainstValidationData);
-          m_ValidateModelFilter->SetUseStreaming(GetParameterInt("validation.usestreaming"));
-
-          // Update
-          AddProcess(m_ValidateModelFilter, "Evaluate model (Validation data)");
-          m_ValidateModelFilter->Update();
-
-          for (unsigned int i = 0 ; i < m_TargetTensorsNames.size() ; i++)
-          {
-            otbAppLogINFO("Metrics for target \"" << m_TargetTensorsNames[i] << "\":");
-            PrintClassificationMetrics(m_ValidateModelFilter->GetConfusionMatrix(i), m_ValidateModelFilter->GetMapOfClasses(i));
-          }
+          if (background)
+            StartBackgroundValidation(epoch);
+          else
+            PrintValidationResults(EvaluateModel(true), epoch);
         } // Step is OK to perform validation
+
+        // Report the background validation, if it is done
+        ReportBackgroundValidation(false);
       } // Do the validation against the validation data
 
       } // Next epoch
 
+    // Wait for the last background validation
+    if (background)
+      {
+      ReportBackgroundValidation(true);
+      RemoveSnapshot();
+      }
+
+    // Wait for the last checkpoint
+    if (m_CheckpointManager)
+      {
+      m_CheckpointManager->Wait();
+      }
+
     // Check if we have to save variables to somewhere
     if (HasValue("model.saveto"))
       {
@@ -526,15 +1278,41 @@ public:
       tf::SaveModel(path, m_SavedModel);
       }
 
+    // Export the profiling
+    if (m_Profiler)
+      {
+      const std::string fileName = GetParameterAsString("profiling.trace");
+      otbAppLogINFO("Profiling summary:\n" << m_Profiler->GetSummary({TrainModelFilterType::GetOpProfilingCategory()}));
+      if (GetParameterInt("profiling.opperiod") > 0)
+        otbAppLogINFO("TensorFlow ops ranked by total time:\n" << m_Profiler->GetCostTable(TrainModelFilterType::GetOpProfilingCategory()));
+      m_Profiler->FinishChromeTrace();
+      otbAppLogINFO("Trace written to " << fileName);
+      }
+
   }
 
 private:
 
   tensorflow::SavedModelBundle     m_SavedModel; // must be alive during all the execution of the application !
 
+  // Background validation
+  tensorflow::SavedModelBundle       m_ValidationModel;           // Session of validation
+  std::string                        m_SnapshotPath;              // Path of the snapshot of the variables
+  std::future<ValidationResultsList> m_BackgroundValidation;      // Metrics of the running validation
+  int                                m_BackgroundValidationEpoch; // Epoch of the running validation
+
   // Filters
   TrainModelFilterType::Pointer    m_TrainModelFilter;
   ValidateModelFilterType::Pointer m_ValidateModelFilter;
+  RegressionValidateModelFilterType::Pointer m_RegressionValidateModelFilter;
+
+  // Profiling
+  ProfilerType::Pointer            m_Profiler;
+
+  // Checkpoints
+  CheckpointManagerType::Pointer   m_CheckpointManager;
+  unsigned long                    m_NumberOfTrainedBatches; // Number of batches trained since the start
+  unsigned long                    m_LastCheckpointStep;     // Step of the last started checkpoint
 
   // Inputs
   BundleList m_Bundles;
@@ -556,6 +1334,12 @@ private:
   std::vector<FloatVectorImageType::Pointer> m_InputTargetsForEvaluationAgainstLearningData;
   std::vector<FloatVectorImageType::Pointer> m_InputTargetsForEvaluationAgainstValidationData;
 
+  // Subset of the learning data for the evaluation (empty: all the samples)
+  IndexListType m_LearningDataSubset;
+
+  // Number of samples of the training datasets (empty: one dataset)
+  DatasetSizesType m_DatasetSizes;
+
 }; // end of class
 
 } // namespace wrapper
@@ -0,0 +1,255 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbTensorflowCheckpointManager.h"
+
+#include "itkMacro.h"
+#include "tensorflow/core/lib/io/path.h"
+
+// STD
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+namespace otb
+{
+
+namespace
+{
+
+//
+// Name of the state file of a directory of checkpoints
+//
+std::string GetCheckpointStateFileName(const std::string & directory)
+{
+  return tensorflow::io::JoinPath(directory, "checkpoint");
+}
+
+//
+// Value of a line "key: "value"" of the state file (empty if the key does not match)
+//
+std::string GetCheckpointStateValue(const std::string & line, const std::string & key)
+{
+  if (line.compare(0, key.size() + 1, key + ":") != 0)
+    return std::string();
+  const std::string::size_type first = line.find('"');
+  const std::string::size_type last = line.rfind('"');
+  if (first == std::string::npos || last <= first)
+    return std::string();
+  return line.substr(first + 1, last - first - 1);
+}
+
+} // end anonymous namespace
+
+TensorflowCheckpointManager
+::TensorflowCheckpointManager()
+{
+  m_MaxToKeep = 3;
+  m_Model = nullptr;
+  m_Initialized = false;
+}
+
+TensorflowCheckpointManager
+::~TensorflowCheckpointManager()
+{
+  // The saving thread uses the members
+  if (m_Saving.valid())
+    m_Saving.wait();
+}
+
+//
+// Save the variables under a temporary prefix, in the calling thread, then
+// finalize the checkpoint in a background thread
+//
+void
+TensorflowCheckpointManager
+::Save(unsigned long step)
+{
+  if (m_Model == nullptr || m_Directory.empty())
+  {
+    itkExceptionMacro("The model and the directory of the checkpoints must be set");
+  }
+
+  // Previous checkpoint (and its errors)
+  Wait();
+
+  if (!m_Initialized)
+  {
+    auto status = tensorflow::Env::Default()->RecursivelyCreateDir(m_Directory);
+    if (!status.ok())
+    {
+      itkExceptionMacro("Can't create the directory of the checkpoints: " << status.ToString());
+    }
+    m_Checkpoints = ReadCheckpointState(m_Directory);
+    m_Initialized = true;
+  }
+
+  const std::string name = "ckpt-" + std::to_string(step);
+  const std::string tmpName = "tmp-" + name;
+  RemoveCheckpointFiles(tmpName);
+  tf::SaveModel(tensorflow::io::JoinPath(m_Directory, tmpName), *m_Model);
+  m_Saving = std::async(std::launch::async, [this, tmpName, name]() { FinalizeCheckpoint(tmpName, name); });
+}
+
+bool
+TensorflowCheckpointManager
+::IsSaving() const
+{
+  return m_Saving.valid() && m_Saving.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+}
+
+void
+TensorflowCheckpointManager
+::Wait()
+{
+  if (m_Saving.valid())
+    m_Saving.get();
+}
+
+//
+// Rename the files of the saved variables (index and data shards), then list
+// the checkpoint in the state file: a checkpoint of the state file is always
+// complete. Then remove the old checkpoints.
+//
+void
+TensorflowCheckpointManager
+::FinalizeCheckpoint(const std::string & tmpName, const std::string & name)
+{
+  // A checkpoint of the same name is replaced: it is not complete meanwhile
+  if (std::find(m_Checkpoints.begin(), m_Checkpoints.end(), name) != m_Checkpoints.end())
+  {
+    m_Checkpoints.erase(std::remove(m_Checkpoints.begin(), m_Checkpoints.end(), name), m_Checkpoints.end());
+    WriteCheckpointState();
+  }
+  RemoveCheckpointFiles(name);
+
+  tensorflow::Env * env = tensorflow::Env::Default();
+  const std::string tmpPrefix = tensorflow::io::JoinPath(m_Directory, tmpName);
+  std::vector<std::string> files;
+  env->GetMatchingPaths(tmpPrefix + ".*", &files);
+  if (files.empty())
+  {
+    itkExceptionMacro("No file was saved for the checkpoint " << name);
+  }
+  for (auto& file: files)
+  {
+    const std::string target = tensorflow::io::JoinPath(m_Directory, name) + file.substr(tmpPrefix.size());
+    auto status = env->RenameFile(file, target);
+    if (!status.ok())
+    {
+      itkExceptionMacro("Can't rename the file " << file << " of the checkpoint: " << status.ToString());
+    }
+  }
+
+  m_Checkpoints.push_back(name);
+  StringList removed;
+  while (m_MaxToKeep > 0 && m_Checkpoints.size() > m_MaxToKeep)
+  {
+    removed.push_back(m_Checkpoints.front());
+    m_Checkpoints.erase(m_Checkpoints.begin());
+  }
+  WriteCheckpointState();
+
+  for (auto& checkpoint: removed)
+    RemoveCheckpointFiles(checkpoint);
+}
+
+//
+// Remove the files of a checkpoint (index and data shards)
+//
+void
+TensorflowCheckpointManager
+::RemoveCheckpointFiles(const std::string & name)
+{
+  tensorflow::Env * env = tensorflow::Env::Default();
+  std::vector<std::string> files;
+  env->GetMatchingPaths(tensorflow::io::JoinPath(m_Directory, name) + ".*", &files);
+  for (auto& file: files)
+    env->DeleteFile(file);
+}
+
+//
+// Write the state file in a temporary file, then rename it
+//
+void
+TensorflowCheckpointManager
+::WriteCheckpointState()
+{
+  const std::string fileName = GetCheckpointStateFileName(m_Directory);
+  const std::string tmpFileName = fileName + ".tmp";
+  std::ofstream ofs(tmpFileName.c_str());
+  if (!m_Checkpoints.empty())
+    ofs << "model_checkpoint_path: \"" << m_Checkpoints.back() << "\"\n";
+  for (auto& checkpoint: m_Checkpoints)
+    ofs << "all_model_checkpoint_paths: \"" << checkpoint << "\"\n";
+  ofs.close();
+  if (ofs.fail())
+  {
+    itkExceptionMacro("Error while writing the checkpoint state file " << tmpFileName);
+  }
+
+  auto status = tensorflow::Env::Default()->RenameFile(tmpFileName, fileName);
+  if (!status.ok())
+  {
+    itkExceptionMacro("Can't write the checkpoint state file: " << status.ToString());
+  }
+}
+
+//
+// Read the checkpoints listed in the state file. The latest checkpoint
+// (model_checkpoint_path) is put last.
+//
+TensorflowCheckpointManager::StringList
+TensorflowCheckpointManager
+::ReadCheckpointState(const std::string & directory)
+{
+  StringList checkpoints;
+  std::ifstream ifs(GetCheckpointStateFileName(directory).c_str());
+  if (!ifs.is_open())
+    return checkpoints;
+
+  std::string latest;
+  std::string line;
+  while (std::getline(ifs, line))
+  {
+    const std::string all = GetCheckpointStateValue(line, "all_model_checkpoint_paths");
+    if (!all.empty())
+      checkpoints.push_back(all);
+    const std::string model = GetCheckpointStateValue(line, "model_checkpoint_path");
+    if (!model.empty())
+      latest = model;
+  }
+  if (!latest.empty())
+  {
+    checkpoints.erase(std::remove(checkpoints.begin(), checkpoints.end(), latest), checkpoints.end());
+    checkpoints.push_back(latest);
+  }
+  return checkpoints;
+}
+
+//
+// Path of the latest complete checkpoint of a directory. Paths of the state
+// file can be relative to the directory.
+//
+std::string
+TensorflowCheckpointManager
+::GetLatestCheckpoint(const std::string & directory)
+{
+  const StringList checkpoints = ReadCheckpointState(directory);
+  if (checkpoints.empty())
+    return std::string();
+  const std::string & latest = checkpoints.back();
+  if (tensorflow::io::IsAbsolutePath(latest))
+    return latest;
+  return tensorflow::io::JoinPath(directory, latest);
+}
+
+} // end namespace otb
@@ -0,0 +1,127 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowCheckpointManager_h
+#define otbTensorflowCheckpointManager_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+// Tensorflow SavedModel
+#include "otbTensorflowGraphOperations.h"
+
+// STD
+#include <future>
+#include <string>
+#include <vector>
+
+namespace otb
+{
+
+/**
+ * \class TensorflowCheckpointManager
+ * \brief This class saves rotating checkpoints of the variables of a model.
+ *
+ * Save() saves the variables of the model in a checkpoint of the directory,
+ * named "ckpt-<step>". It must be called between two training steps: the
+ * save op runs in the calling thread and writes the variables under a
+ * temporary prefix ("tmp-ckpt-<step>"), so that the checkpoint holds the
+ * variables of one step. Then the files are renamed, the state file is
+ * updated and the old checkpoints are removed in a background thread, and
+ * Save() returns. Only one checkpoint is finalized at a time: Save() first
+ * waits for the previous one.
+ *
+ * The directory holds a "checkpoint" state file, in the format of the
+ * TensorFlow CheckpointState, which lists the complete checkpoints: it is
+ * updated (atomically) once the files of a checkpoint are written. Only the
+ * last MaxToKeep checkpoints are kept, the older ones are removed.
+ *
+ * GetLatestCheckpoint() returns the path of the latest complete checkpoint of
+ * a directory, which can be restored with tf::RestoreModel().
+ *
+ * \ingroup OTBTensorflow
+ */
+class ITK_EXPORT TensorflowCheckpointManager : public itk::Object
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef TensorflowCheckpointManager        Self;
+  typedef itk::Object                        Superclass;
+  typedef itk::SmartPointer<Self>            Pointer;
+  typedef itk::SmartPointer<const Self>      ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(TensorflowCheckpointManager, itk::Object);
+
+  typedef std::vector<std::string>           StringList;
+
+  /** Directory of the checkpoints */
+  itkSetMacro(Directory, std::string);
+  itkGetMacro(Directory, std::string);
+
+  /** Number of checkpoints to keep */
+  itkSetMacro(MaxToKeep, unsigned int);
+  itkGetMacro(MaxToKeep, unsigned int);
+
+  /** Model to save (must be alive until the saving is done) */
+  void SetModel(tensorflow::SavedModelBundle * model) { m_Model = model; }
+
+  /** Save the variables of the checkpoint of the given step, and start its finalization */
+  void Save(unsigned long step);
+
+  /** True if a checkpoint is being finalized */
+  bool IsSaving() const;
+
+  /** Wait for the checkpoint being finalized. Errors of the finalization are thrown here. */
+  void Wait();
+
+  /** Path of the latest complete checkpoint of a directory (empty if none) */
+  static std::string GetLatestCheckpoint(const std::string & directory);
+
+protected:
+  TensorflowCheckpointManager();
+  virtual ~TensorflowCheckpointManager();
+
+  /** Read the checkpoints listed in the state file of a directory (latest last) */
+  static StringList ReadCheckpointState(const std::string & directory);
+
+  /** Write the state file of the directory */
+  void WriteCheckpointState();
+
+  /** Rename the files of the saved variables, update the state file, remove the old checkpoints */
+  void FinalizeCheckpoint(const std::string & tmpName, const std::string & name);
+
+  /** Remove the files of a checkpoint */
+  void RemoveCheckpointFiles(const std::string & name);
+
+private:
+  TensorflowCheckpointManager(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  std::string                   m_Directory;    // Directory of the checkpoints
+  unsigned int                  m_MaxToKeep;    // Number of checkpoints to keep
+  tensorflow::SavedModelBundle* m_Model;        // Model to save
+
+  // Internal
+  bool                          m_Initialized;  // The existing checkpoints of the directory have been read
+  StringList                    m_Checkpoints;  // Names of the complete checkpoints (latest last)
+  std::future<void>             m_Saving;       // Checkpoint being finalized
+
+}; // end class
+
+} // end namespace otb
+
+#include "otbTensorflowCheckpointManager.cxx"
+
+#endif
@@ -130,5 +130,244 @@ bool SampleImage(const typename TImage::Pointer inPtr, typename TImage::Pointer
 
 }
 
+//
+// Compute the region of one shard of an image.
+// The rows of tiles of the grid (aligned on the origin of the largest region)
+// are split into shardCount bands of consecutive rows. Bands are disjoint,
+// their union is the largest region, and their borders are aligned on the grid.
+//
+template<class TImage>
+typename TImage::RegionType GetShardRegion(const typename TImage::RegionType & largestRegion,
+    const typename TImage::SizeType & gridSize, unsigned int shardIndex, unsigned int shardCount)
+{
+  if (shardIndex >= shardCount)
+  {
+    itkGenericExceptionMacro("Shard index is " << shardIndex << " but the number of shards is " << shardCount);
+  }
+
+  const typename TImage::SizeValueType sizeY = largestRegion.GetSize(1);
+  const typename TImage::SizeValueType nRows = (sizeY + gridSize[1] - 1) / gridSize[1];
+  const typename TImage::SizeValueType firstRow = (shardIndex * nRows) / shardCount;
+  const typename TImage::SizeValueType lastRow = ((shardIndex + 1) * nRows) / shardCount;
+  if (firstRow == lastRow)
+  {
+    itkGenericExceptionMacro("Shard #" << shardIndex << " is empty: the grid has only " << nRows <<
+        " rows of tiles for " << shardCount << " shards");
+  }
+
+  typename TImage::RegionType region(largestRegion);
+  region.SetIndex(1, largestRegion.GetIndex(1) + firstRow * gridSize[1]);
+  region.SetSize(1, std::min(lastRow * gridSize[1], sizeY) - firstRow * gridSize[1]);
+
+  return region;
+}
+
+//
+// Draw a random subset of samples, sorted in ascending order.
+// The share of each class is rounded with the largest remainders, so that the
+// subset has exactly count samples.
+//
+template<class TImage>
+std::vector<typename TImage::IndexValueType> DrawSamplesSubset(typename TImage::Pointer image,
+    const typename TImage::SizeType & patchSize, unsigned long count, bool stratified, unsigned int seed)
+{
+  typedef typename TImage::IndexValueType IndexValueType;
+  typedef std::vector<IndexValueType>     IndexListType;
+
+  image->UpdateOutputInformation();
+  const typename TImage::RegionType largestRegion = image->GetLargestPossibleRegion();
+  const IndexValueType nSamples = largestRegion.GetSize(1) / patchSize[1];
+  IndexListType subset;
+  if (count >= static_cast<unsigned long>(nSamples))
+  {
+    subset.resize(nSamples);
+    std::iota(subset.begin(), subset.end(), 0);
+    return subset;
+  }
+
+  // Samples of each stratum
+  std::map<int, IndexListType> strata;
+  if (stratified)
+  {
+    // The image is read by blocks of samples
+    const IndexValueType blockSize = 1024;
+    typename TImage::IndexType index;
+    index[0] = largestRegion.GetIndex(0) + patchSize[0] / 2;
+    for (IndexValueType blockStart = 0 ; blockStart < nSamples ; blockStart += blockSize)
+    {
+      const IndexValueType blockEnd = std::min(blockStart + blockSize, nSamples);
+      typename TImage::RegionType region = largestRegion;
+      region.SetIndex(1, largestRegion.GetIndex(1) + blockStart * patchSize[1]);
+      region.SetSize(1, (blockEnd - blockStart) * patchSize[1]);
+      PropagateRequestedRegion<TImage>(image, region);
+      for (IndexValueType sample = blockStart ; sample < blockEnd ; sample++)
+      {
+        index[1] = largestRegion.GetIndex(1) + sample * patchSize[1] + patchSize[1] / 2;
+        strata[static_cast<int>(image->GetPixel(index)[0])].push_back(sample);
+      }
+    }
+  }
+  else
+  {
+    IndexListType & samples = strata[0];
+    samples.resize(nSamples);
+    std::iota(samples.begin(), samples.end(), 0);
+  }
+
+  // Share of each stratum
+  std::vector<unsigned long> shares;
+  std::vector<std::pair<double, std::size_t> > remainders;
+  unsigned long total = 0;
+  for (auto& stratum: strata)
+  {
+    const double share = static_cast<double>(count) * stratum.second.size() / nSamples;
+    shares.push_back(static_cast<unsigned long>(share));
+    remainders.push_back(std::make_pair(share - shares.back(), shares.size() - 1));
+    total += shares.back();
+  }
+  std::sort(remainders.begin(), remainders.end(), std::greater<std::pair<double, std::size_t> >());
+  for (std::size_t k = 0 ; total < count && k < remainders.size() ; k++, total++)
+    shares[remainders[k].second]++;
+
+  // Draw the samples of each stratum
+  std::mt19937 generator(seed);
+  std::size_t k = 0;
+  for (auto& stratum: strata)
+  {
+    IndexListType & samples = stratum.second;
+    std::shuffle(samples.begin(), samples.end(), generator);
+    subset.insert(subset.end(), samples.begin(), samples.begin() + shares[k++]);
+  }
+  std::sort(subset.begin(), subset.end());
+
+  return subset;
+}
+
+//
+// Start the worker threads
+//
+ThreadPool::ThreadPool(unsigned int nWorkers)
+{
+  m_Stop = false;
+  for (unsigned int t = 0 ; t < nWorkers ; t++)
+  {
+    m_Workers.push_back(std::thread([this]() { WorkerLoop(); }));
+  }
+}
+
+//
+// Stop the worker threads, once the jobs are done
+//
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Stop = true;
+  }
+  m_JobAvailable.notify_all();
+  for (auto& worker: m_Workers)
+  {
+    worker.join();
+  }
+}
+
+//
+// Process chunks of the jobs, until the pool is stopped
+//
+void ThreadPool::WorkerLoop()
+{
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  while (true)
+  {
+    m_JobAvailable.wait(lock, [this]{ return m_Stop || !m_Jobs.empty(); });
+    if (m_Jobs.empty())
+      return;
+    RunChunk(lock, m_Jobs.front());
+  }
+}
+
+//
+// Process the next chunk of a job which has chunks left. The lock is
+// released while the function is called.
+//
+void ThreadPool::RunChunk(std::unique_lock<std::mutex> & lock, JobPointer job)
+{
+  const unsigned int chunk = job->nextChunk++;
+  if (job->nextChunk == job->nChunks)
+    m_Jobs.erase(std::find(m_Jobs.begin(), m_Jobs.end(), job));
+  lock.unlock();
+
+  std::exception_ptr error;
+  try
+  {
+    (*job->function)((chunk * job->n) / job->nChunks, ((chunk + 1) * job->n) / job->nChunks);
+  }
+  catch (...)
+  {
+    error = std::current_exception();
+  }
+
+  lock.lock();
+  if (error && !job->error)
+    job->error = error;
+  job->doneChunks++;
+  if (job->doneChunks == job->nChunks)
+    m_ChunkDone.notify_all();
+}
+
+//
+// Call a function over the range [0, n), split in at most nChunks contiguous
+// chunks [begin, end) processed by the workers and the calling thread.
+// The first exception thrown by a chunk is rethrown once all chunks are done.
+//
+void ThreadPool::ParallelFor(unsigned long n, unsigned int nChunks, const FunctionType & function)
+{
+  if (n < nChunks)
+    nChunks = n;
+  if (nChunks <= 1 || m_Workers.empty())
+  {
+    if (n > 0)
+      function(0, n);
+    return;
+  }
+
+  JobPointer job(new Job());
+  job->function = &function;
+  job->n = n;
+  job->nChunks = nChunks;
+  job->nextChunk = 0;
+  job->doneChunks = 0;
+
+  std::unique_lock<std::mutex> lock(m_Mutex);
+  m_Jobs.push_back(job);
+  m_JobAvailable.notify_all();
+  while (job->nextChunk < job->nChunks)
+  {
+    RunChunk(lock, job);
+  }
+  m_ChunkDone.wait(lock, [&job]{ return job->doneChunks == job->nChunks; });
+  if (job->error)
+  {
+    std::rethrow_exception(job->error);
+  }
+}
+
+//
+// Call a function over the range [0, n), split in at most nThreads contiguous
+// chunks [begin, end) processed in parallel, by the given pool or by the pool
+// shared by the process. The workers are created once, not at each call.
+// The first exception thrown by a chunk is rethrown once all chunks are done.
+//
+void ParallelFor(unsigned long n, unsigned int nThreads,
+    const std::function<void(unsigned long, unsigned long)> & function, ThreadPool * pool)
+{
+  if (pool == nullptr)
+  {
+    static ThreadPool sharedPool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    pool = &sharedPool;
+  }
+  pool->ParallelFor(n, nThreads, function);
+}
+
 } // end namespace tf
 } // end namespace otb
@@ -16,7 +16,17 @@
 #include <iterator>
 #include <string>
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
 
 namespace otb {
 namespace tf {
@@ -51,6 +61,65 @@ bool SampleImage(const typename TImage::Pointer inPtr, typename TImage::Pointer
     typename TImage::PointType point, unsigned int elemIdx,
     typename TImage::SizeType patchSize);
 
+// Compute the region of one shard, splitting the rows of tiles of a grid into disjoint bands
+template<class TImage>
+typename TImage::RegionType GetShardRegion(const typename TImage::RegionType & largestRegion,
+    const typename TImage::SizeType & gridSize, unsigned int shardIndex, unsigned int shardCount);
+
+// Draw a random subset of count samples of an image of patches concatenated in the y dimension.
+// When stratified, the class of each sample is the first band at the center of its patch, and each
+// class gets a share of the subset proportional to its number of samples.
+template<class TImage>
+std::vector<typename TImage::IndexValueType> DrawSamplesSubset(typename TImage::Pointer image,
+    const typename TImage::SizeType & patchSize, unsigned long count, bool stratified, unsigned int seed);
+
+// Persistent worker threads, which process the chunks of ParallelFor() calls.
+// The calling thread processes chunks of its own call too, so that nested calls
+// (from a chunk) can't deadlock, even when all the workers are busy.
+class ThreadPool
+{
+public:
+  typedef std::function<void(unsigned long, unsigned long)> FunctionType;
+
+  explicit ThreadPool(unsigned int nWorkers);
+  ~ThreadPool();
+
+  unsigned int GetNumberOfWorkers() const { return m_Workers.size(); }
+
+  // Call a function over the range [0, n), split in at most nChunks contiguous chunks processed in parallel
+  void ParallelFor(unsigned long n, unsigned int nChunks, const FunctionType & function);
+
+private:
+  ThreadPool(const ThreadPool&); //purposely not implemented
+  void operator=(const ThreadPool&); //purposely not implemented
+
+  struct Job
+  {
+    const FunctionType * function;   // Function of the call
+    unsigned long        n;          // Size of the range
+    unsigned int         nChunks;    // Number of chunks
+    unsigned int         nextChunk;  // Next chunk to process
+    unsigned int         doneChunks; // Number of processed chunks
+    std::exception_ptr   error;      // First exception thrown by a chunk
+  };
+  typedef std::shared_ptr<Job> JobPointer;
+
+  void WorkerLoop();
+  void RunChunk(std::unique_lock<std::mutex> & lock, JobPointer job);
+
+  std::vector<std::thread> m_Workers;       // Worker threads
+  std::deque<JobPointer>   m_Jobs;          // Jobs with chunks left to process
+  std::mutex               m_Mutex;         // Lock of the jobs
+  std::condition_variable  m_JobAvailable;  // A job was added, or the pool is stopped
+  std::condition_variable  m_ChunkDone;     // A chunk was processed
+  bool                     m_Stop;          // The workers must exit
+};
+
+// Call a function over the range [0, n), split in contiguous chunks processed in parallel.
+// The chunks are processed by the given pool, or by a pool shared by the process when null.
+void ParallelFor(unsigned long n, unsigned int nThreads,
+    const std::function<void(unsigned long, unsigned long)> & function, ThreadPool * pool = nullptr);
+
 } // end namespace tf
 } // end namespace otb
 
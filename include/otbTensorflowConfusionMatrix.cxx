@@ -0,0 +1,113 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbTensorflowConfusionMatrix.h"
+
+#include "otbTensorflowCommon.h"
+
+// STD
+#include <algorithm>
+#include <mutex>
+
+namespace otb {
+namespace tf {
+
+//
+// Add a class. The counts are moved in a larger array when the capacity is
+// reached.
+//
+std::size_t DenseConfusionMatrix::AddClass(LabelValueType label)
+{
+  const std::size_t index = m_Labels.size();
+  m_Labels.push_back(label);
+  if (label >= 0 && label < DIRECT_LOOKUP_SIZE)
+  {
+    if (static_cast<std::size_t>(label) >= m_DirectIndices.size())
+      m_DirectIndices.resize(label + 1, -1);
+    m_DirectIndices[label] = index;
+  }
+  else
+  {
+    m_OtherIndices[label] = index;
+  }
+
+  if (index >= m_Capacity)
+  {
+    const std::size_t capacity = std::max(m_Capacity * 2, (std::size_t) 16);
+    std::vector<CountValueType> counts(capacity * capacity, 0);
+    for (std::size_t r = 0 ; r < m_Capacity ; r++)
+      std::copy(m_Counts.begin() + r * m_Capacity, m_Counts.begin() + (r + 1) * m_Capacity,
+          counts.begin() + r * capacity);
+    m_Counts.swap(counts);
+    m_Capacity = capacity;
+  }
+  return index;
+}
+
+//
+// Add the counts of another matrix, whose classes can have other indices
+//
+void DenseConfusionMatrix::Merge(const DenseConfusionMatrix & other)
+{
+  const std::vector<LabelValueType> & labels = other.GetLabels();
+  std::vector<std::size_t> indices(labels.size());
+  for (std::size_t i = 0 ; i < labels.size() ; i++)
+    indices[i] = GetClassIndex(labels[i]);
+
+  for (std::size_t r = 0 ; r < labels.size() ; r++)
+    for (std::size_t p = 0 ; p < labels.size() ; p++)
+      m_Counts[indices[r] * m_Capacity + indices[p]] += other.GetCount(r, p);
+}
+
+DenseConfusionMatrix::CountValueType DenseConfusionMatrix::GetTotalCount() const
+{
+  CountValueType total = 0;
+  for (auto& count: m_Counts)
+    total += count;
+  return total;
+}
+
+void DenseConfusionMatrix::Clear()
+{
+  m_Labels.clear();
+  m_DirectIndices.clear();
+  m_OtherIndices.clear();
+  m_Counts.clear();
+  m_Capacity = 0;
+}
+
+//
+// Count the (reference, prediction) pairs in parallel. Small arrays are
+// processed by fewer threads, since each thread allocates a partial matrix.
+//
+template<class TReference, class TPredicted>
+void AccumulateConfusionMatrix(DenseConfusionMatrix & matrix,
+    const TReference * references, std::size_t referencesStride,
+    const TPredicted * predictions, std::size_t predictionsStride,
+    unsigned long count, unsigned int nThreads)
+{
+  const unsigned long minimumCountPerThread = 65536;
+  nThreads = std::max(1ul, std::min(static_cast<unsigned long>(nThreads), count / minimumCountPerThread));
+
+  std::mutex mutex;
+  ParallelFor(count, nThreads, [&](unsigned long begin, unsigned long end)
+  {
+    DenseConfusionMatrix partial;
+    for (unsigned long i = begin ; i < end ; i++)
+      partial.Add(static_cast<DenseConfusionMatrix::LabelValueType>(references[i * referencesStride]),
+          static_cast<DenseConfusionMatrix::LabelValueType>(predictions[i * predictionsStride]));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    matrix.Merge(partial);
+  });
+}
+
+} // end namespace tf
+} // end namespace otb
@@ -0,0 +1,107 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowConfusionMatrix_h
+#define otbTensorflowConfusionMatrix_h
+
+// STD
+#include <cstddef>
+#include <map>
+#include <vector>
+
+namespace otb {
+namespace tf {
+
+//
+// Dense confusion matrix, grown when new classes are counted
+//
+// Classes get an index in their order of appearance, and the counts are
+// stored in a dense array (rows: references, columns: predictions), whose
+// capacity is doubled when it is full. The index of a label in [0, 65536) is
+// found with a direct lookup, other labels use a map.
+//
+class DenseConfusionMatrix
+{
+public:
+  typedef unsigned long CountValueType;
+  typedef int           LabelValueType;
+
+  DenseConfusionMatrix() : m_Capacity(0) {}
+
+  // Count a (reference, prediction) pair
+  void Add(LabelValueType reference, LabelValueType predicted, CountValueType count = 1)
+  {
+    const std::size_t r = GetClassIndex(reference);
+    const std::size_t p = GetClassIndex(predicted);
+    m_Counts[r * m_Capacity + p] += count;
+  }
+
+  // Add the counts of another matrix
+  void Merge(const DenseConfusionMatrix & other);
+
+  // Classes, in their order of appearance
+  std::size_t GetNumberOfClasses() const                { return m_Labels.size(); }
+  const std::vector<LabelValueType> & GetLabels() const { return m_Labels; }
+
+  // Count of the (reference, prediction) pair of classes indices
+  CountValueType GetCount(std::size_t referenceIndex, std::size_t predictedIndex) const
+  {
+    return m_Counts[referenceIndex * m_Capacity + predictedIndex];
+  }
+
+  // Total number of counted pairs
+  CountValueType GetTotalCount() const;
+
+  // Remove all classes and counts
+  void Clear();
+
+private:
+  // Index of a class, added if it is new
+  std::size_t GetClassIndex(LabelValueType label)
+  {
+    if (label >= 0 && label < DIRECT_LOOKUP_SIZE)
+    {
+      if (static_cast<std::size_t>(label) < m_DirectIndices.size() && m_DirectIndices[label] >= 0)
+        return m_DirectIndices[label];
+    }
+    else
+    {
+      const auto it = m_OtherIndices.find(label);
+      if (it != m_OtherIndices.end())
+        return it->second;
+    }
+    return AddClass(label);
+  }
+  std::size_t AddClass(LabelValueType label);
+
+  static const LabelValueType DIRECT_LOOKUP_SIZE = 65536;
+
+  std::vector<LabelValueType>           m_Labels;        // Classes, in their order of appearance
+  std::vector<int>                      m_DirectIndices; // Indices of the labels in [0, 65536), -1 if unknown
+  std::map<LabelValueType, std::size_t> m_OtherIndices;  // Indices of the other labels
+  std::vector<CountValueType>           m_Counts;        // Counts (capacity x capacity)
+  std::size_t                           m_Capacity;      // Number of rows and columns of the counts
+};
+
+// Count the (reference, prediction) pairs of two arrays of values read with
+// strides, in parallel: each thread fills a partial matrix, then the partial
+// matrices are merged in the matrix
+template<class TReference, class TPredicted>
+void AccumulateConfusionMatrix(DenseConfusionMatrix & matrix,
+    const TReference * references, std::size_t referencesStride,
+    const TPredicted * predictions, std::size_t predictionsStride,
+    unsigned long count, unsigned int nThreads);
+
+} // end namespace tf
+} // end namespace otb
+
+#include "otbTensorflowConfusionMatrix.cxx"
+
+#endif
@@ -41,6 +41,27 @@ std::string PrintTensorInfos(const tensorflow::Tensor & tensor)
   return s.str();
 }
 
+//
+// Get the value of a tensor with one element (e.g. a loss), as a double
+//
+bool GetScalarValue(const tensorflow::Tensor & tensor, double & value)
+{
+  if (tensor.NumElements() != 1)
+    return false;
+
+  switch (tensor.dtype())
+  {
+  case tensorflow::DT_FLOAT:  value = tensor.flat<float>()(0);             break;
+  case tensorflow::DT_DOUBLE: value = tensor.flat<double>()(0);            break;
+  case tensorflow::DT_INT64:  value = tensor.flat<tensorflow::int64>()(0); break;
+  case tensorflow::DT_INT32:  value = tensor.flat<int>()(0);               break;
+  case tensorflow::DT_UINT8:  value = tensor.flat<unsigned char>()(0);     break;
+  default:
+    return false;
+  }
+  return true;
+}
+
 //
 // Create a tensor with the good datatype
 //
@@ -108,6 +129,65 @@ void RecopyImageRegionToTensorWithCast(const typename TImage::Pointer inputPtr,
     itkGenericExceptionMacro("TF DataType "<< dt << " not currently implemented !");
 }
 
+//
+// Recopy an VectorImage region into a 4D-shaped tensorflow::Tensor ({-1, sz_y, sz_x, sz_bands}).
+// The position of each pixel in the patch is mapped through the transform of
+// the dihedral group D4 (see D4TransformPosition), and each band b is
+// changed to gains[b] * value + offsets[b] (no change if gains and offsets
+// are empty).
+//
+template<class TImage, class TValueType>
+void RecopyImageRegionToTensorWithTransform(const typename TImage::Pointer inputPtr, const typename TImage::RegionType & region,
+    tensorflow::Tensor & tensor, unsigned int elemIdx, unsigned int transform,
+    const std::vector<float> & gains, const std::vector<float> & offsets)
+{
+  typename itk::ImageRegionConstIterator<TImage> inIt(inputPtr, region);
+  const unsigned int nBands = inputPtr->GetNumberOfComponentsPerPixel();
+  const bool jitter = gains.size() > 0;
+  if (jitter && (gains.size() != nBands || offsets.size() != nBands))
+    itkGenericExceptionMacro("The number of gains and offsets must be the number of bands (" << nBands << ")");
+
+  const tensorflow::int64 sz_y = region.GetSize(1);
+  const tensorflow::int64 sz_x = region.GetSize(0);
+  auto tMap = tensor.tensor<TValueType, 4>();
+  for (inIt.GoToBegin(); !inIt.IsAtEnd(); ++inIt)
+  {
+    tensorflow::int64 y = inIt.GetIndex()[1] - region.GetIndex()[1];
+    tensorflow::int64 x = inIt.GetIndex()[0] - region.GetIndex()[0];
+    D4TransformPosition(transform, sz_y, sz_x, y, x);
+
+    const typename TImage::PixelType & pixel = inIt.Get();
+    for (unsigned int band = 0 ; band < nBands ; band++)
+    {
+      if (jitter)
+        tMap(elemIdx, y, x, band) = static_cast<TValueType>(gains[band] * pixel[band] + offsets[band]);
+      else
+        tMap(elemIdx, y, x, band) = pixel[band];
+    }
+  }
+}
+
+//
+// Type-agnostic version of the 'RecopyImageRegionToTensorWithTransform' function
+//
+template<class TImage>
+void RecopyImageRegionToTensorWithTransform(const typename TImage::Pointer inputPtr, const typename TImage::RegionType & region,
+    tensorflow::Tensor & tensor, unsigned int elemIdx, unsigned int transform,
+    const std::vector<float> & gains, const std::vector<float> & offsets)
+{
+  tensorflow::DataType dt = tensor.dtype();
+  if (dt == tensorflow::DT_FLOAT)
+    RecopyImageRegionToTensorWithTransform<TImage, float>        (inputPtr, region, tensor, elemIdx, transform, gains, offsets);
+  else if (dt == tensorflow::DT_DOUBLE)
+    RecopyImageRegionToTensorWithTransform<TImage, double>       (inputPtr, region, tensor, elemIdx, transform, gains, offsets);
+  else if (dt == tensorflow::DT_INT64)
+    RecopyImageRegionToTensorWithTransform<TImage, long long int>(inputPtr, region, tensor, elemIdx, transform, gains, offsets);
+  else if (dt == tensorflow::DT_INT32)
+    RecopyImageRegionToTensorWithTransform<TImage, int>          (inputPtr, region, tensor, elemIdx, transform, gains, offsets);
+  else
+    itkGenericExceptionMacro("TF DataType "<< dt << " not currently implemented !");
+}
+
 //
 // Sample a centered patch (from index)
 //
@@ -342,5 +422,156 @@ std::pair<std::string, tensorflow::Tensor> ExpressionToTensor(std::string expres
 
 }
 
+//
+// Map a position (y, x) of a grid of size (sy, sx) through the t-th transform
+// of the dihedral group D4 (t in 0..7). The transform is the composition of:
+// -a transposition if (t & 4), which only makes sense for square grids
+// -a flip along x if (t & 1)
+// -a flip along y if (t & 2)
+// Hence transforms 0..3 are flips only, and they keep the grid size unchanged.
+//
+void D4TransformPosition(unsigned int t, tensorflow::int64 sy, tensorflow::int64 sx,
+    tensorflow::int64 & y, tensorflow::int64 & x)
+{
+  if (t & 4)
+  {
+    std::swap(y, x);
+    std::swap(sy, sx);
+  }
+  if (t & 1)
+    x = sx - 1 - x;
+  if (t & 2)
+    y = sy - 1 - y;
+}
+
+//
+// Stack the D4-transformed copies of a 4D-shaped tensor ({n, sz_y, sz_x, sz_c})
+// along its 1st dimension. The copy #t of the element k is at position t * n + k.
+//
+template<class TValueType>
+void AugmentTensorWithD4Transforms(const tensorflow::Tensor & tensor, tensorflow::Tensor & augmented, unsigned int nTransforms)
+{
+  auto inMap = tensor.tensor<TValueType, 4>();
+  auto outMap = augmented.tensor<TValueType, 4>();
+  const tensorflow::int64 sz_n = tensor.dim_size(0);
+  const tensorflow::int64 sz_y = tensor.dim_size(1);
+  const tensorflow::int64 sz_x = tensor.dim_size(2);
+  const tensorflow::int64 sz_c = tensor.dim_size(3);
+  for (unsigned int t = 0 ; t < nTransforms ; t++)
+    for (tensorflow::int64 k = 0 ; k < sz_n ; k++)
+      for (tensorflow::int64 y = 0 ; y < sz_y ; y++)
+        for (tensorflow::int64 x = 0 ; x < sz_x ; x++)
+        {
+          tensorflow::int64 ty = y;
+          tensorflow::int64 tx = x;
+          D4TransformPosition(t, sz_y, sz_x, ty, tx);
+          for (tensorflow::int64 c = 0 ; c < sz_c ; c++)
+            outMap(t * sz_n + k, ty, tx, c) = inMap(k, y, x, c);
+        }
+}
+
+//
+// Type-agnostic version of the 'AugmentTensorWithD4Transforms' function
+// The number of transforms is 1 (identity), 4 (flips only) or 8 (flips and
+// transpositions, which require square patches).
+//
+tensorflow::Tensor AugmentTensorWithD4Transforms(const tensorflow::Tensor & tensor, unsigned int nTransforms)
+{
+  if (tensor.dims() != 4)
+    itkGenericExceptionMacro("D4 transforms can only be applied to 4D-shaped tensors ({n, sz_y, sz_x, sz_c})"
+        " but tensor shape is " << PrintTensorShape(tensor.shape()));
+  if (nTransforms > 4 && tensor.dim_size(1) != tensor.dim_size(2))
+    itkGenericExceptionMacro("D4 transforms with transpositions can only be applied to square patches"
+        " but tensor shape is " << PrintTensorShape(tensor.shape()));
+
+  tensorflow::TensorShape shape(tensor.shape());
+  shape.set_dim(0, nTransforms * tensor.dim_size(0));
+  tensorflow::Tensor augmented(tensor.dtype(), shape);
+
+  tensorflow::DataType dt = tensor.dtype();
+  if (dt == tensorflow::DT_FLOAT)
+    AugmentTensorWithD4Transforms<float>        (tensor, augmented, nTransforms);
+  else if (dt == tensorflow::DT_DOUBLE)
+    AugmentTensorWithD4Transforms<double>       (tensor, augmented, nTransforms);
+  else if (dt == tensorflow::DT_INT64)
+    AugmentTensorWithD4Transforms<long long int>(tensor, augmented, nTransforms);
+  else if (dt == tensorflow::DT_INT32)
+    AugmentTensorWithD4Transforms<int>          (tensor, augmented, nTransforms);
+  else
+    itkGenericExceptionMacro("TF DataType "<< dt << " not currently implemented !");
+
+  return augmented;
+}
+
+//
+// Inverse-transform and average the D4-transformed copies of a tensor.
+// The copies are stacked along the 1st dimension as AugmentTensorWithD4Transforms()
+// does. Only 4D-shaped tensors ({n, sz_y, sz_x, sz_c}) are inverse-transformed,
+// tensors of shape {n} or {n, c} (e.g. one label or vector per patch) are just averaged.
+//
+template<class TValueType>
+void ReduceD4TransformedTensor(const tensorflow::Tensor & tensor, tensorflow::Tensor & reduced, unsigned int nTransforms)
+{
+  auto inFlat = tensor.flat<TValueType>();
+  auto outFlat = reduced.flat<float>();
+  const tensorflow::int64 sz_n = reduced.dim_size(0);
+  const tensorflow::int64 sz_y = (reduced.dims() == 4 ? reduced.dim_size(1) : 1);
+  const tensorflow::int64 sz_x = (reduced.dims() == 4 ? reduced.dim_size(2) : 1);
+  const tensorflow::int64 sz_c = reduced.NumElements() / (sz_n * sz_y * sz_x);
+  outFlat.setZero();
+  for (unsigned int t = 0 ; t < nTransforms ; t++)
+    for (tensorflow::int64 k = 0 ; k < sz_n ; k++)
+      for (tensorflow::int64 y = 0 ; y < sz_y ; y++)
+        for (tensorflow::int64 x = 0 ; x < sz_x ; x++)
+        {
+          tensorflow::int64 ty = y;
+          tensorflow::int64 tx = x;
+          D4TransformPosition(t, sz_y, sz_x, ty, tx);
+          const tensorflow::int64 inPos = sz_c * (((t * sz_n + k) * sz_y + ty) * sz_x + tx);
+          const tensorflow::int64 outPos = sz_c * ((k * sz_y + y) * sz_x + x);
+          for (tensorflow::int64 c = 0 ; c < sz_c ; c++)
+            outFlat(outPos + c) += static_cast<float>(inFlat(inPos + c));
+        }
+  const float scale = 1.0f / nTransforms;
+  for (tensorflow::int64 i = 0 ; i < reduced.NumElements() ; i++)
+    outFlat(i) *= scale;
+}
+
+//
+// Type-agnostic version of the 'ReduceD4TransformedTensor' function
+// The returned tensor is always of type float.
+//
+tensorflow::Tensor ReduceD4TransformedTensor(const tensorflow::Tensor & tensor, unsigned int nTransforms)
+{
+  const int nDims = tensor.dims();
+  if (nDims == 0 || nDims == 3 || nDims > 4)
+    itkGenericExceptionMacro("Unable to reduce the D4 transforms of a tensor of shape " <<
+        PrintTensorShape(tensor.shape()) << ". Supported shapes are {n}, {n, c} and {n, sz_y, sz_x, sz_c}");
+  if (tensor.dim_size(0) % nTransforms != 0)
+    itkGenericExceptionMacro("The 1st dimension of the tensor of shape " << PrintTensorShape(tensor.shape()) <<
+        " is not a multiple of the number of transforms (" << nTransforms << ")");
+  if (nDims == 4 && nTransforms > 4 && tensor.dim_size(1) != tensor.dim_size(2))
+    itkGenericExceptionMacro("D4 transforms with transpositions can only be reduced for square outputs"
+        " but tensor shape is " << PrintTensorShape(tensor.shape()));
+
+  tensorflow::TensorShape shape(tensor.shape());
+  shape.set_dim(0, tensor.dim_size(0) / nTransforms);
+  tensorflow::Tensor reduced(tensorflow::DT_FLOAT, shape);
+
+  tensorflow::DataType dt = tensor.dtype();
+  if (dt == tensorflow::DT_FLOAT)
+    ReduceD4TransformedTensor<float>        (tensor, reduced, nTransforms);
+  else if (dt == tensorflow::DT_DOUBLE)
+    ReduceD4TransformedTensor<double>       (tensor, reduced, nTransforms);
+  else if (dt == tensorflow::DT_INT64)
+    ReduceD4TransformedTensor<long long int>(tensor, reduced, nTransforms);
+  else if (dt == tensorflow::DT_INT32)
+    ReduceD4TransformedTensor<int>          (tensor, reduced, nTransforms);
+  else
+    itkGenericExceptionMacro("TF DataType "<< dt << " not currently implemented !");
+
+  return reduced;
+}
+
 } // end namespace tf
 } // end namespace otb
@@ -26,6 +26,7 @@
 
 // STD
 #include <string>
+#include <vector>
 
 namespace otb {
 namespace tf {
@@ -36,6 +37,9 @@ std::string PrintTensorShape(const tensorflow::TensorShape & shp);
 // Generate a string with tensor infos
 std::string PrintTensorInfos(const tensorflow::Tensor & tensor);
 
+// Get the value of a tensor with one element, as a double (false if it has not one numeric element)
+bool GetScalarValue(const tensorflow::Tensor & tensor, double & value);
+
 // Create a tensor with the good datatype
 template<class TImage>
 tensorflow::Tensor CreateTensor(tensorflow::TensorShape & shape);
@@ -56,6 +60,14 @@ void RecopyImageRegionToTensor(const typename TImage::Pointer inputPtr,  const t
 template<class TImage>
 void RecopyImageRegionToTensorWithCast(const typename TImage::Pointer inputPtr,  const typename TImage::RegionType & region, tensorflow::Tensor & tensor, unsigned int elemIdx);
 
+// Recopy an VectorImage region into a 4D-shaped tensorflow::Tensor, through a D4 transform and per-band gains and offsets
+template<class TImage, class TValueType>
+void RecopyImageRegionToTensorWithTransform(const typename TImage::Pointer inputPtr, const typename TImage::RegionType & region, tensorflow::Tensor & tensor, unsigned int elemIdx,
+    unsigned int transform, const std::vector<float> & gains, const std::vector<float> & offsets);
+template<class TImage>
+void RecopyImageRegionToTensorWithTransform(const typename TImage::Pointer inputPtr, const typename TImage::RegionType & region, tensorflow::Tensor & tensor, unsigned int elemIdx,
+    unsigned int transform, const std::vector<float> & gains, const std::vector<float> & offsets);
+
 // Sample a centered patch
 template<class TImage>
 void SampleCenteredPatch(const typename TImage::Pointer inputPtr, const typename TImage::IndexType & centerIndex, const typename TImage::SizeType & patchSize, tensorflow::Tensor & tensor, unsigned int elemIdx);
@@ -76,6 +88,15 @@ void CopyTensorToImageRegion(const tensorflow::Tensor & tensor, const typename T
 // Convert an expression into a dict
 std::pair<std::string, tensorflow::Tensor> ExpressionToTensor(std::string expression);
 
+// Map a position (y, x) of a grid of size (sy, sx) through the t-th transform of the dihedral group D4
+void D4TransformPosition(unsigned int t, tensorflow::int64 sy, tensorflow::int64 sx, tensorflow::int64 & y, tensorflow::int64 & x);
+
+// Stack the D4-transformed copies of a 4D-shaped tensor along its 1st dimension
+tensorflow::Tensor AugmentTensorWithD4Transforms(const tensorflow::Tensor & tensor, unsigned int nTransforms);
+
+// Inverse-transform and average the D4-transformed copies stacked along the 1st dimension of a tensor
+tensorflow::Tensor ReduceD4TransformedTensor(const tensorflow::Tensor & tensor, unsigned int nTransforms);
+
 } // end namespace tf
 } // end namespace otb
 
@@ -52,7 +52,6 @@ void LoadModel(const std::string path, tensorflow::SavedModelBundle & bundle)
 {
 
   tensorflow::RunOptions runoptions;
-  runoptions.set_trace_level(tensorflow::RunOptions_TraceLevel_FULL_TRACE);
   auto status = tensorflow::LoadSavedModel(tensorflow::SessionOptions(), runoptions,
       path, {tensorflow::kSavedModelTagServe}, &bundle);
   if (!status.ok())
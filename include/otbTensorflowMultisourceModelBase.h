@@ -18,6 +18,7 @@
 // Tensorflow
 #include "tensorflow/core/public/session.h"
 #include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/framework/step_stats.pb.h"
 
 // Tensorflow helpers
 #include "otbTensorflowGraphOperations.h"
@@ -25,6 +26,9 @@
 #include "otbTensorflowCopyUtils.h"
 #include "otbTensorflowCommon.h"
 
+// Profiling
+#include "otbTensorflowProfiler.h"
+
 namespace otb
 {
 
@@ -61,6 +65,15 @@ namespace otb
  * placeholder, e.g. "drop_rate=0.5 learning_rate=0.002 toto=true".
  * See otb::tf::ExpressionToTensor() to know more about syntax.
  *
+ * An optional profiler (otb::TensorflowProfiler) can be set with SetProfiler().
+ * Then, each session run is recorded, with the shapes and the sizes of the
+ * input and output tensors.
+ * In addition, when a tracing period N is set with SetTracingPeriod(), every
+ * Nth session run is traced (RunOptions FULL_TRACE), and the step stats of
+ * each node are recorded in the profiler, in the category returned by
+ * GetOpProfilingCategory(), with the op type as event name. The op costs can
+ * then be ranked with the GetCostTable() method of the profiler.
+ *
  * \ingroup OTBTensorflow
  */
 template <class TInputImage, class TOutputImage=TInputImage>
@@ -101,8 +114,12 @@ public:
   typedef std::vector<tensorflow::TensorShapeProto>  TensorShapeProtoList;
   typedef std::vector<tensorflow::Tensor>            TensorListType;
 
+  /** Typedefs for profiling */
+  typedef TensorflowProfiler                         ProfilerType;
+  typedef ProfilerType::ArgumentsType                ProfilerArgumentsType;
+
   /** Set and Get the Tensorflow session and graph */
-  void SetGraph(tensorflow::GraphDef graph)      { m_Graph = graph;     }
+  void SetGraph(tensorflow::GraphDef graph)      { m_Graph = graph; m_NodesOpTypes.clear(); }
   tensorflow::GraphDef GetGraph()                { return m_Graph ;     }
   void SetSession(tensorflow::Session * session) { m_Session = session; }
   tensorflow::Session * GetSession()             { return m_Session;    }
@@ -135,6 +152,17 @@ public:
   itkSetMacro(TargetNodesNames, StringList);
   itkGetMacro(TargetNodesNames, StringList);
 
+  /** Profiler (optional) */
+  itkSetObjectMacro(Profiler, ProfilerType);
+  itkGetObjectMacro(Profiler, ProfilerType);
+
+  /** Trace every Nth session run (0: no tracing). Requires a profiler. */
+  itkSetMacro(TracingPeriod, unsigned int);
+  itkGetMacro(TracingPeriod, unsigned int);
+
+  /** Category of the profiler events of the traced ops */
+  static std::string GetOpProfilingCategory() { return "TensorFlow op"; }
+
   /** Read only methods */
   itkGetMacro(InputTensorsDataTypes, DataTypeListType);
   itkGetMacro(OutputTensorsDataTypes, DataTypeListType);
@@ -151,6 +179,12 @@ protected:
 
   virtual void RunSession(DictType & inputs, TensorListType & outputs);
 
+  virtual void AddStepStatsToProfiler(const tensorflow::StepStats & stepStats,
+      const typename ProfilerType::TimePointType & runStartTime);
+
+  virtual void AddTensorsToProfilerArguments(const std::string & prefix, const TensorListType & tensors,
+      ProfilerArgumentsType & args);
+
 private:
   TensorflowMultisourceModelBase(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
@@ -167,6 +201,12 @@ private:
   DictType                   m_UserPlaceholders;        // User placeholders
   StringList                 m_TargetNodesNames;        // User nodes target
 
+  // Profiling
+  ProfilerType::Pointer      m_Profiler;                // Profiler (optional)
+  unsigned int               m_TracingPeriod;           // Trace every Nth session run
+  unsigned long              m_NumberOfRuns;            // Number of session runs
+  std::map<std::string, std::string> m_NodesOpTypes;    // Op type of the graph nodes
+
   // Internal, read-only
   DataTypeListType           m_InputTensorsDataTypes;   // Input tensors datatype
   DataTypeListType           m_OutputTensorsDataTypes;  // Output tensors datatype
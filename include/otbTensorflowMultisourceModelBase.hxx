@@ -21,6 +21,8 @@ TensorflowMultisourceModelBase<TInputImage, TOutputImage>
 ::TensorflowMultisourceModelBase()
  {
   m_Session = nullptr;
+  m_TracingPeriod = 0;
+  m_NumberOfRuns = 0;
  }
 
 template <class TInputImage, class TOutputImage>
@@ -83,7 +85,23 @@ TensorflowMultisourceModelBase<TInputImage, TOutputImage>
   // The session will initialize the outputs
 
   // Run the session, evaluating our output tensors from the graph
-  auto status = this->GetSession()->Run(inputs, m_OutputTensors, m_TargetNodesNames, &outputs);
+  // Every Nth run is traced when the tracing is enabled
+  const bool trace = m_Profiler && m_TracingPeriod > 0 && (m_NumberOfRuns % m_TracingPeriod) == 0;
+  m_NumberOfRuns++;
+  tensorflow::RunOptions runOptions;
+  tensorflow::RunMetadata runMetadata;
+  if (trace)
+    {
+    runOptions.set_trace_level(tensorflow::RunOptions_TraceLevel_FULL_TRACE);
+    }
+
+  ProfilerType::TimePointType startTime;
+  if (m_Profiler)
+    {
+    startTime = m_Profiler->Now();
+    }
+  auto status = this->GetSession()->Run(runOptions, inputs, m_OutputTensors, m_TargetNodesNames, &outputs,
+      trace ? &runMetadata : nullptr);
   if (!status.ok()) {
 
     // Create a debug report
@@ -96,6 +114,105 @@ TensorflowMultisourceModelBase<TInputImage, TOutputImage>
 
   }
 
+  // Record the session run, with the tensors shapes and sizes
+  if (m_Profiler)
+    {
+    const ProfilerType::TimePointType endTime = m_Profiler->Now();
+    TensorListType inputTensors;
+    for (auto& input: inputs)
+      {
+      inputTensors.push_back(input.second);
+      }
+    ProfilerArgumentsType args;
+    AddTensorsToProfilerArguments("input", inputTensors, args);
+    AddTensorsToProfilerArguments("output", outputs, args);
+    args["traced"] = trace ? "true" : "false";
+    m_Profiler->AddEvent("run", this->GetNameOfClass(), startTime, endTime, args);
+    if (trace)
+      {
+      AddStepStatsToProfiler(runMetadata.step_stats(), startTime);
+      }
+    }
+
+ }
+
+//
+// Record the step stats of a traced session run in the profiler: one event
+// per node, named after the op type of the node, on the lane of the device.
+// The events are shifted so that the first node starts with the session run.
+//
+template <class TInputImage, class TOutputImage>
+void
+TensorflowMultisourceModelBase<TInputImage, TOutputImage>
+::AddStepStatsToProfiler(const tensorflow::StepStats & stepStats,
+    const typename ProfilerType::TimePointType & runStartTime)
+ {
+  // Op types of the graph nodes
+  if (m_NodesOpTypes.size() == 0)
+    {
+    for (auto& node: m_Graph.node())
+      {
+      m_NodesOpTypes[node.name()] = node.op();
+      }
+    }
+
+  // First start time of the nodes
+  tensorflow::int64 firstStart = -1;
+  for (auto& devStats: stepStats.dev_stats())
+    {
+    for (auto& nodeStats: devStats.node_stats())
+      {
+      if (firstStart < 0 || nodeStats.all_start_micros() < firstStart)
+        {
+        firstStart = nodeStats.all_start_micros();
+        }
+      }
+    }
+
+  const double runStart = m_Profiler->ToMicroseconds(runStartTime);
+  for (auto& devStats: stepStats.dev_stats())
+    {
+    for (auto& nodeStats: devStats.node_stats())
+      {
+      // Node name can have a suffix (e.g. "conv1/Conv2D:Conv2D")
+      const std::string nodeName = nodeStats.node_name().substr(0, nodeStats.node_name().find(':'));
+      std::string opType = nodeName;
+      if (m_NodesOpTypes.count(nodeName) > 0)
+        {
+        opType = m_NodesOpTypes[nodeName];
+        }
+
+      ProfilerArgumentsType args;
+      args["node"] = nodeStats.node_name();
+      args["device"] = devStats.device();
+      m_Profiler->AddEvent(opType, GetOpProfilingCategory(),
+          runStart + nodeStats.all_start_micros() - firstStart, nodeStats.all_end_rel_micros(),
+          devStats.device(), args);
+      }
+    }
+ }
+
+//
+// Add the shapes of the tensors, and their total size in bytes, to the
+// arguments of a profiler event
+//
+template <class TInputImage, class TOutputImage>
+void
+TensorflowMultisourceModelBase<TInputImage, TOutputImage>
+::AddTensorsToProfilerArguments(const std::string & prefix, const TensorListType & tensors,
+    ProfilerArgumentsType & args)
+ {
+  std::stringstream shapes;
+  tensorflow::uint64 bytes = 0;
+  for (unsigned int i = 0 ; i < tensors.size() ; i++)
+    {
+    if (i > 0)
+      shapes << " ";
+    shapes << tf::PrintTensorShape(tensors[i].shape());
+    bytes += tensors[i].TotalBytes();
+    }
+  args[prefix + "_shapes"] = shapes.str();
+  args[prefix + "_bytes"] = std::to_string(bytes);
  }
 
 template <class TInputImage, class TOutputImage>
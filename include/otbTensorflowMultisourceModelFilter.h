@@ -73,6 +73,18 @@ namespace otb
  * If the number of values in the output tensors (produced by the model) don't
  * fit with the output image region, an exception will be thrown.
  *
+ * Test-time augmentation (TTA) can be enabled with SetTestTimeAugmentationTransforms().
+ * The value is the number of transforms of the dihedral group D4 that are applied:
+ * 1 (no TTA), 4 (flips) or 8 (flips and transpositions i.e. 90 degrees rotations).
+ * The transformed copies of each input tensor are stacked in the batch dimension
+ * and processed in one single session run. The output tensors are then
+ * inverse-transformed and averaged, hence TTA makes sense for outputs like
+ * scores or regression values, not for labels. In patch-based mode, 8 transforms
+ * require square receptive fields. In fully-convolutional mode, the input regions
+ * of the tiles can be non-square (e.g. at the image borders) and transposing them
+ * would change the shape of the outputs: the 4 flips are then used for the whole
+ * image, with a warning, so that all the tiles are processed the same way.
+ *
  *
  * TODO: the filter must be able to output multiple images eventually at different
  * resolutions/sizes/origins.
@@ -127,6 +139,10 @@ public:
   typedef typename Superclass::TensorListType      TensorListType;
   typedef std::vector<float>                       ScaleListType;
 
+  /** Typedefs for profiling */
+  typedef typename Superclass::ProfilerType          ProfilerType;
+  typedef typename Superclass::ProfilerArgumentsType ProfilerArgumentsType;
+
   itkSetMacro(OutputGridSize, SizeType);
   itkGetMacro(OutputGridSize, SizeType);
   itkSetMacro(ForceOutputGridSize, bool);
@@ -135,6 +151,8 @@ public:
   itkGetMacro(FullyConvolutional, bool);
   itkSetMacro(OutputSpacingScale, float);
   itkGetMacro(OutputSpacingScale, float);
+  itkSetMacro(TestTimeAugmentationTransforms, unsigned int);
+  itkGetMacro(TestTimeAugmentationTransforms, unsigned int);
 
 protected:
   TensorflowMultisourceModelFilter();
@@ -150,6 +168,8 @@ protected:
 
   virtual void GenerateInputRequestedRegion(void);
 
+  virtual void UpdateOutputData(itk::DataObject *output);
+
   virtual void GenerateData();
 
 private:
@@ -160,12 +180,15 @@ private:
   bool                       m_ForceOutputGridSize;  // Force output grid size
   bool                       m_FullyConvolutional;   // Convolution mode
   float                      m_OutputSpacingScale;   // scaling of the output spacings
+  unsigned int               m_TestTimeAugmentationTransforms; // Number of D4 transforms for TTA
 
   // Internal
+  unsigned int               m_NumberOfTransforms; // Number of D4 transforms used for the whole image
   SpacingType                m_OutputSpacing;     // Output image spacing
   PointType                  m_OutputOrigin;      // Output image origin
   SizeType                   m_OutputSize;        // Output image size
   PixelType                  m_NullPixel;         // Pixel filled with zeros
+  typename ProfilerType::TimePointType m_UpdateStartTime; // Start of the update (profiling)
 
 }; // end class
 
@@ -29,6 +29,8 @@ TensorflowMultisourceModelFilter<TInputImage, TOutputImage>
   m_OutputSize.Fill(0);
 
   m_OutputSpacingScale = 1.0f;
+  m_TestTimeAugmentationTransforms = 1;
+  m_NumberOfTransforms = 1;
 
   Superclass::SetCoordinateTolerance(itk::NumericTraits<double>::max() );
   Superclass::SetDirectionTolerance(itk::NumericTraits<double>::max() );
@@ -195,6 +197,33 @@ TensorflowMultisourceModelFilter<TInputImage, TOutputImage>
 
   Superclass::GenerateOutputInformation();
 
+  // Check the test-time augmentation parameters
+  if (m_TestTimeAugmentationTransforms != 1 && m_TestTimeAugmentationTransforms != 4 &&
+      m_TestTimeAugmentationTransforms != 8)
+    {
+    itkExceptionMacro("The number of test-time augmentation transforms must be 1, 4 or 8 (value is "
+        << m_TestTimeAugmentationTransforms << ")");
+    }
+  m_NumberOfTransforms = m_TestTimeAugmentationTransforms;
+  if (m_NumberOfTransforms == 8 && !m_FullyConvolutional)
+    {
+    for (unsigned int i = 0 ; i < this->GetNumberOfInputs() ; i++)
+      {
+      const SizeType inputPatchSize = this->GetInputReceptiveFields().at(i);
+      if (inputPatchSize[0] != inputPatchSize[1])
+        itkExceptionMacro("Test-time augmentation with transpositions requires square receptive fields "
+            "but receptive field of input " << i << " is " << inputPatchSize);
+      }
+    }
+  else if (m_NumberOfTransforms == 8)
+    {
+    // The transform set is chosen once for the whole image: mixing tiles
+    // augmented with 8 and 4 transforms would produce seams
+    itkWarningMacro("In fully-convolutional mode, the input regions of the tiles are not always square: "
+        "test-time augmentation uses only the 4 flips");
+    m_NumberOfTransforms = 4;
+    }
+
   //////////////////////////////////////////////////////////////////////////////////////////
   //                            Compute the output image extent
   //////////////////////////////////////////////////////////////////////////////////////////
@@ -362,6 +391,22 @@ TensorflowMultisourceModelFilter<TInputImage, TOutputImage>
 
  }
 
+/*
+ * Keep the time at which the update starts, to record the duration of the
+ * upstream update in GenerateData()
+ */
+template <class TInputImage, class TOutputImage>
+void
+TensorflowMultisourceModelFilter<TInputImage, TOutputImage>
+::UpdateOutputData(itk::DataObject *output)
+ {
+  if (this->GetProfiler())
+    {
+    m_UpdateStartTime = this->GetProfiler()->Now();
+    }
+  Superclass::UpdateOutputData(output);
+ }
+
 /**
  * Compute the output image
  */
@@ -374,12 +419,28 @@ TensorflowMultisourceModelFilter<TInputImage, TOutputImage>
   typename TOutputImage::Pointer outputPtr = this->GetOutput();
   const RegionType outputReqRegion = outputPtr->GetRequestedRegion();
 
+  // Profiling: the upstream update is done
+  ProfilerType * profiler = this->GetProfiler();
+  typename ProfilerType::TimePointType stageStartTime;
+  ProfilerArgumentsType tileArgs;
+  if (profiler)
+    {
+    stageStartTime = profiler->Now();
+    std::stringstream ss;
+    ss << outputReqRegion.GetIndex() << " " << outputReqRegion.GetSize();
+    tileArgs["region"] = ss.str();
+    profiler->AddEvent("upstream", this->GetNameOfClass(), m_UpdateStartTime, stageStartTime, tileArgs);
+    }
+
   // Get the aligned output requested region
   RegionType outputAlignedReqRegion(outputReqRegion);
   EnlargeToAlignedRegion(outputAlignedReqRegion);
 
   const unsigned int nInputs = this->GetNumberOfInputs();
 
+  // Number of D4 transforms used for test-time augmentation
+  const unsigned int nTransforms = m_NumberOfTransforms;
+
   // Create input tensors list
   DictType inputs;
 
@@ -410,6 +471,12 @@ TensorflowMultisourceModelFilter<TInputImage, TOutputImage>
       // Recopy the whole input
       tf::RecopyImageRegionToTensorWithCast<TInputImage>(inputPtr, reqRegion, inputTensor, 0);
 
+      // Stack the transformed copies for TTA
+      if (nTransforms > 1)
+        {
+        inputTensor = tf::AugmentTensorWithD4Transforms(inputTensor, nTransforms);
+        }
+
       // Input is the tensor representing the subset of image
       DictElementType input = { this->GetInputPlaceholders()[i], inputTensor };
       inputs.push_back(input);
@@ -443,6 +510,12 @@ TensorflowMultisourceModelFilter<TInputImage, TOutputImage>
         elemIndex++;
         }
 
+      // Stack the transformed copies for TTA
+      if (nTransforms > 1)
+        {
+        inputTensor = tf::AugmentTensorWithD4Transforms(inputTensor, nTransforms);
+        }
+
       // Input is the tensor of patches (aka the batch)
       DictElementType input = { this->GetInputPlaceholders()[i], inputTensor };
       inputs.push_back(input);
@@ -451,10 +524,37 @@ TensorflowMultisourceModelFilter<TInputImage, TOutputImage>
 
     } // next input tensor
 
+  // Profiling: the tensors are populated
+  if (profiler)
+    {
+    TensorListType inputTensors;
+    for (auto& input: inputs)
+      {
+      inputTensors.push_back(input.second);
+      }
+    ProfilerArgumentsType args(tileArgs);
+    this->AddTensorsToProfilerArguments("input", inputTensors, args);
+    profiler->AddEvent("populate", this->GetNameOfClass(), stageStartTime, profiler->Now(), args);
+    }
+
   // Run session
   TensorListType outputs;
   this->RunSession(inputs, outputs);
 
+  if (profiler)
+    {
+    stageStartTime = profiler->Now();
+    }
+
+  // Inverse-transform and average the outputs of the TTA copies
+  if (nTransforms > 1)
+    {
+    for (auto& output: outputs)
+      {
+      output = tf::ReduceD4TransformedTensor(output, nTransforms);
+      }
+    }
+
   // Fill the output buffer with zero value
   outputPtr->SetBufferedRegion(outputReqRegion);
   outputPtr->Allocate();
@@ -481,6 +581,15 @@ TensorflowMultisourceModelFilter<TInputImage, TOutputImage>
       }
     }
 
+  // Profiling: the outputs are written back
+  if (profiler)
+    {
+    ProfilerArgumentsType args(tileArgs);
+    this->AddTensorsToProfilerArguments("output", outputs, args);
+    profiler->AddEvent("writeback", this->GetNameOfClass(), stageStartTime, profiler->Now(), args);
+    profiler->AddProcessedPixels(outputReqRegion.GetNumberOfPixels());
+    }
+
  }
 
 
@@ -19,6 +19,23 @@
 // Base
 #include "otbTensorflowMultisourceModelBase.h"
 
+// Prefetching
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <memory>
+#include <thread>
+
+// Blocks cache
+#include <list>
+#include <map>
+#include "itkImageAlgorithm.h"
+
+// Epoch cache
+#include "otbTensorflowPatchesFile.h"
+
 namespace otb
 {
 
@@ -34,20 +51,72 @@ namespace otb
  *
  * This filter verify that every patches images are consistent.
  *
- * The batch size can be set using the SetBatchSize() method.
+ * The batch size can be set using the SetBatchSize() method. When BatchRAM
+ * (in MB) is not 0, the batch size is instead computed when the output
+ * information is generated, as the largest one whose batch tensors fit in
+ * BatchRAM: the input tensors of all the batch buffers, and the output
+ * tensors (from the output expression fields, and the last dimension of the
+ * output tensors shapes when it is known). The intermediate tensors of the
+ * model are not counted, so the budget should leave room for them.
  * The streaming can be activated to allow the processing of huge datasets.
  * However, it should be noted that the process is significantly slower due to
  * multiple read of input patches. When streaming is deactivated, the whole
  * patches images are read and kept in memory, guaranteeing fast patches access.
  *
- * The GenerateData() implements a loop over batches, that call the ProcessBatch()
- * method for each one.
+ * The GenerateData() implements a loop over batches. For each one, the input
+ * tensors are populated with the PopulateInputTensors() method, then the
+ * ProcessBatch() method is called.
  * The ProcessBatch() function is a pure virtual method that must be implemented in
  * child classes.
  *
+ * The samples are read in the order set with SetSampleOrder() (an empty list
+ * means the natural order of the patches images). The order can hold any
+ * number of samples, possibly repeated: an epoch processes all the samples of
+ * the order.
+ *
  * The PopulateInputTensors() method converts input patches images into placeholders
- * that will be fed to the model. It is a common method to learning filters, and
- * is intended to be used in child classes, as a kind of helper.
+ * that will be fed to the model. It is a common method to learning filters.
+ *
+ * When the streaming is enabled and a block size is set with
+ * SetStreamingBlockSize(), the patches images are read by blocks of
+ * StreamingBlockSize contiguous samples, instead of one sample at a time.
+ * The blocks are kept in a LRU cache bounded by StreamingCacheRAM (in MB), so
+ * that the samples of a block that is read are served from memory. The caches
+ * and the batch buffers are kept when the output information is generated
+ * again (e.g. at each epoch), and emptied only when the inputs have changed:
+ * other images, largest possible regions, numbers of components or patch
+ * sizes (see GetInputsChanged()), or another block size.
+ *
+ * In streaming mode, the blocks can also be kept across epochs in an epoch
+ * cache bounded by EpochCacheRAM (in MB, 0: disabled), in a compact form:
+ * each block is stored with the smallest data type that holds its values
+ * exactly (e.g. uint8 for 8 bits images), and compressed with
+ * EpochCacheCompression (see tf::PatchesFileCompression). The blocks are
+ * stored as they are read during the first epoch, until the cache is full,
+ * then the next epochs decode them instead of reading them again through the
+ * pipeline: only the blocks that do not fit are read again. Without block
+ * size, the samples are cached one by one. GetEpochCacheHits() gives the
+ * number of blocks decoded from the epoch cache during the last epoch.
+ *
+ * The batch tensors are allocated once, in a ring of buffers per input (one
+ * buffer, or PrefetchDepth + 2 buffers with prefetching), and reused across
+ * batches and epochs. The last partial batch uses a slice of the buffer.
+ *
+ * The patches are copied in the batch tensors by multiple threads (the number
+ * of threads of the filter), over the inputs and the samples, with the
+ * CopyPatchToTensor() method that child classes can override (e.g. to
+ * transform the patches). The threads belong to a pool owned by the filter,
+ * created once and reused by all the batches.
+ *
+ * When the prefetch depth (SetPrefetchDepth()) is greater than 0, the input
+ * tensors are populated in a background thread, up to PrefetchDepth batches
+ * ahead of the batch being processed.
+ *
+ * GetBatchPatchesValues() gives the values of the patches of the samples of a
+ * batch, in an image which is not an input (e.g. the references of the
+ * validation filters), following the samples order.
+ *
+ * When a profiler is set, each batch and each tensors population are recorded.
  *
  * \ingroup OTBTensorflow
  */
@@ -80,18 +149,85 @@ public:
   typedef typename Superclass::SizeListType      SizeListType;
   typedef typename Superclass::TensorListType    TensorListType;
 
+  /* Typedefs for profiling */
+  typedef typename Superclass::ProfilerType          ProfilerType;
+  typedef typename Superclass::ProfilerArgumentsType ProfilerArgumentsType;
+
   /* Typedefs for index */
   typedef typename ImageType::IndexValueType     IndexValueType;
   typedef std::vector<IndexValueType>            IndexListType;
 
+  /* Typedefs for the blocks cache */
+  typedef std::pair<unsigned int, IndexValueType> BlockKeyType; // (input, block)
+  typedef std::list<BlockKeyType>                 BlockLRUListType;
+  typedef std::pair<ImagePointerType, typename BlockLRUListType::iterator> CachedBlockType;
+  typedef std::map<BlockKeyType, CachedBlockType> BlockCacheType;
+
+  /* Typedefs for the epoch cache */
+  struct EpochCacheEntryType
+  {
+    unsigned int dataType;     // Data type of the values (tf::PatchesFileDataType)
+    unsigned int compression;  // Compression of the values (tf::PatchesFileCompression)
+    std::size_t  size;         // Size of the values (bytes), before compression
+    std::string  data;         // Values
+  };
+  typedef std::map<BlockKeyType, EpochCacheEntryType> EpochCacheType;
+
+  /* Typedefs for the description of the inputs */
+  struct InputDescriptionType
+  {
+    const ImageType * image;        // Input image
+    RegionType        region;       // Largest possible region
+    unsigned int      nComponents;  // Number of components
+    SizeType          patchSize;    // Patch size
+
+    bool operator==(const InputDescriptionType & other) const
+    {
+      return image == other.image && region == other.region && nComponents == other.nComponents &&
+          patchSize == other.patchSize;
+    }
+  };
+  typedef std::vector<InputDescriptionType>       InputDescriptionListType;
+
   // Batch size
   itkSetMacro(BatchSize, IndexValueType);
   itkGetMacro(BatchSize, IndexValueType);
 
+  // Maximum size of the batch tensors, in MB (0: use BatchSize)
+  itkSetMacro(BatchRAM, unsigned int);
+  itkGetMacro(BatchRAM, unsigned int);
+
   // Use streaming
   itkSetMacro(UseStreaming, bool);
   itkGetMacro(UseStreaming, bool);
 
+  // Number of samples of the blocks read in streaming mode (0: read samples one by one)
+  itkSetMacro(StreamingBlockSize, IndexValueType);
+  itkGetMacro(StreamingBlockSize, IndexValueType);
+
+  // Maximum size of the blocks cache, in MB
+  itkSetMacro(StreamingCacheRAM, unsigned int);
+  itkGetMacro(StreamingCacheRAM, unsigned int);
+
+  // Maximum size of the epoch cache, in MB (0: disabled)
+  itkSetMacro(EpochCacheRAM, unsigned int);
+  itkGetMacro(EpochCacheRAM, unsigned int);
+
+  // Compression of the blocks of the epoch cache (tf::PatchesFileCompression)
+  itkSetMacro(EpochCacheCompression, unsigned int);
+  itkGetMacro(EpochCacheCompression, unsigned int);
+
+  // Size of the epoch cache (bytes), and number of its blocks
+  unsigned long GetEpochCacheBytes() const           { return m_EpochCacheBytes; }
+  unsigned long GetEpochCacheNumberOfBlocks() const  { return m_EpochCache.size(); }
+
+  // Number of blocks decoded from the epoch cache during the last epoch
+  unsigned long GetEpochCacheHits() const            { return m_EpochCacheHits; }
+
+  // Number of batches populated ahead of the processed batch (0: no prefetching)
+  itkSetMacro(PrefetchDepth, unsigned int);
+  itkGetMacro(PrefetchDepth, unsigned int);
+
   // Get number of samples
   itkGetMacro(NumberOfSamples, IndexValueType);
 
@@ -106,21 +242,89 @@ protected:
   virtual void GenerateData();
 
   virtual void PopulateInputTensors(DictType & inputs, const IndexValueType & sampleStart,
-      const IndexValueType & batchSize, const IndexListType & order);
+      const IndexValueType & batchSize, const IndexListType & order, unsigned int bufferIndex);
+
+  virtual void CopyPatchToTensor(const ImagePointerType & image, const RegionType & region, tensorflow::Tensor & tensor,
+      unsigned int inputIndex, IndexValueType elem, IndexValueType sample);
+
+  virtual void AllocateBatchBuffers(unsigned int nBuffers);
+  virtual unsigned long GetBatchSampleBytes();
+  virtual void ComputeBatchSizeFromRAM();
+  virtual tensorflow::Tensor GetBatchTensor(unsigned int bufferIndex, unsigned int inputIndex,
+      const IndexValueType & batchSize);
 
   virtual void ProcessBatch(DictType & inputs, const IndexValueType & sampleStart,
       const IndexValueType & batchSize) = 0;
 
+  virtual void ProcessBatchWithProfiling(DictType & inputs, IndexValueType batch);
+
+  virtual IndexValueType GetNumberOfEpochSamples();
+  virtual IndexValueType GetNumberOfBatches();
+  virtual IndexValueType GetBatchSampleStart(IndexValueType batch);
+  virtual IndexValueType GetBatchNumberOfSamples(IndexValueType batch);
+
+  virtual const typename ImageType::InternalPixelType * GetBatchPatchesValues(ImagePointerType image,
+      const SizeType & patchSize, const IndexValueType & sampleStart, const IndexValueType & batchSize,
+      std::vector<typename ImageType::InternalPixelType> & buffer);
+
+  virtual IndexValueType GetCacheBlockSize() const;
+  virtual ImagePointerType GetCachedBlock(unsigned int inputIndex, IndexValueType block);
+  virtual bool ReadBlockFromEpochCache(const BlockKeyType & key, ImagePointerType blockImage);
+  virtual void AddBlockToEpochCache(const BlockKeyType & key, ImagePointerType blockImage);
+  virtual void ClearBlockCache();
+
+  /** True if the inputs have changed when the output information was last generated */
+  bool GetInputsChanged() const { return m_InputsChanged; }
+
+  /** Pool of the threads that copy the patches, with GetNumberOfThreads() threads (workers and caller) */
+  virtual tf::ThreadPool * GetThreadPool();
+
+  /** Time spent to get the inputs of the batch being processed (populated, or waited for when prefetched), in seconds */
+  double GetBatchAssemblyTime() const { return m_BatchAssemblyTime; }
+
+  /** Order of the samples (empty: natural order) */
+  void SetSampleOrder(const IndexListType & order) { m_SampleOrder = order; }
+  const IndexListType & GetSampleOrder() const     { return m_SampleOrder;  }
+
 private:
   TensorflowMultisourceModelLearningBase(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
   unsigned int          m_BatchSize;       // Batch size
+  unsigned int          m_BatchRAM;        // Maximum size of the batch tensors (MB)
   bool                  m_UseStreaming;    // Use streaming on/off
+  unsigned int          m_PrefetchDepth;   // Number of batches populated ahead
+  IndexValueType        m_StreamingBlockSize; // Number of samples of the blocks read in streaming mode
+  unsigned int          m_StreamingCacheRAM;  // Maximum size of the blocks cache (MB)
+  IndexListType         m_SampleOrder;     // Order of the samples
+  double                m_BatchAssemblyTime;  // Time to get the inputs of the processed batch (s)
 
   // Read only
   IndexValueType        m_NumberOfSamples; // Number of samples
 
+  // Inputs of the last generation of the output information
+  InputDescriptionListType m_InputsDescription; // Description of the inputs
+  bool                  m_InputsChanged;   // The inputs have changed
+
+  // Batch buffers
+  std::vector<TensorListType> m_BatchBuffers; // Batch tensors of each buffer, for each input
+
+  // Threads copying the patches
+  std::unique_ptr<tf::ThreadPool> m_ThreadPool;
+
+  // Blocks cache
+  BlockCacheType        m_BlockCache;      // Cached blocks
+  BlockLRUListType      m_BlockLRU;        // Cached blocks, most recently used first
+  unsigned long         m_BlockCacheBytes; // Size of the cached blocks
+  IndexValueType        m_CachedBlockSize; // Number of samples of the cached blocks
+
+  // Epoch cache
+  unsigned int          m_EpochCacheRAM;   // Maximum size of the epoch cache (MB)
+  unsigned int          m_EpochCacheCompression; // Compression of the blocks of the epoch cache
+  EpochCacheType        m_EpochCache;      // Compact blocks, kept across epochs
+  unsigned long         m_EpochCacheBytes; // Size of the epoch cache
+  unsigned long         m_EpochCacheHits;  // Blocks decoded from the epoch cache during the last epoch
+
 }; // end class
 
 
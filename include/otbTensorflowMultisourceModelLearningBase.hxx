@@ -18,8 +18,11 @@ namespace otb
 
 template <class TInputImage>
 TensorflowMultisourceModelLearningBase<TInputImage>
-::TensorflowMultisourceModelLearningBase(): m_BatchSize(100),
-m_UseStreaming(false), m_NumberOfSamples(0)
+::TensorflowMultisourceModelLearningBase(): m_BatchSize(100), m_BatchRAM(0),
+m_UseStreaming(false), m_PrefetchDepth(0), m_StreamingBlockSize(0),
+m_StreamingCacheRAM(256), m_BatchAssemblyTime(0), m_NumberOfSamples(0), m_InputsChanged(true), m_BlockCacheBytes(0),
+m_CachedBlockSize(0), m_EpochCacheRAM(0), m_EpochCacheCompression(tf::PATCHES_FILE_NONE), m_EpochCacheBytes(0),
+m_EpochCacheHits(0)
  {
  }
 
@@ -39,6 +42,7 @@ TensorflowMultisourceModelLearningBase<TInputImage>
   outputPtr->SetLargestPossibleRegion( nullRegion );
 
   // Count the number of samples
+  InputDescriptionListType inputsDescription;
   m_NumberOfSamples = 0;
   for (unsigned int i = 0 ; i < this->GetNumberOfInputs() ; i++)
     {
@@ -86,7 +90,82 @@ TensorflowMultisourceModelLearningBase<TInputImage>
           << " but input " << i
           << " has a batch size of " << currNumberOfSamples );
       }
+
+    InputDescriptionType description;
+    description.image = inputPtr.GetPointer();
+    description.region = reqRegion;
+    description.nComponents = inputPtr->GetNumberOfComponentsPerPixel();
+    description.patchSize = inputPatchSize;
+    inputsDescription.push_back(description);
     } // next input
+
+  // The output information is generated again at each epoch, because reading
+  // the inputs modifies them: the caches and the batch buffers are kept unless
+  // the inputs have really changed
+  m_InputsChanged = (inputsDescription != m_InputsDescription);
+  if (m_InputsChanged || m_CachedBlockSize != GetCacheBlockSize())
+    {
+    ClearBlockCache();
+    m_BatchBuffers.clear();
+    m_InputsDescription = inputsDescription;
+    m_CachedBlockSize = GetCacheBlockSize();
+    }
+
+  if (m_BatchRAM > 0)
+    {
+    ComputeBatchSizeFromRAM();
+    }
+ }
+
+/*
+ * Size of the tensors of one sample of a batch (bytes): the input tensors of
+ * each batch buffer, and the output tensors
+ */
+template <class TInputImage>
+unsigned long
+TensorflowMultisourceModelLearningBase<TInputImage>
+::GetBatchSampleBytes()
+ {
+  const unsigned long nBuffers = m_PrefetchDepth == 0 ? 1 : m_PrefetchDepth + 2;
+  unsigned long bytes = 0;
+  for (unsigned int i = 0 ; i < this->GetNumberOfInputs() ; i++)
+    {
+    const SizeType inputPatchSize = this->GetInputReceptiveFields().at(i);
+    bytes += nBuffers * inputPatchSize[0] * inputPatchSize[1] * this->GetInput(i)->GetNumberOfComponentsPerPixel() *
+        tensorflow::DataTypeSize(this->GetInputTensorsDataTypes().at(i));
+    }
+  for (unsigned int i = 0 ; i < this->GetOutputTensors().size() ; i++)
+    {
+    // Number of components, when known
+    unsigned long nComponents = 1;
+    const tensorflow::TensorShapeProto & shape = this->GetOutputTensorsShapes().at(i);
+    if (shape.dim_size() > 1 && shape.dim(shape.dim_size() - 1).size() > 0)
+      nComponents = shape.dim(shape.dim_size() - 1).size();
+    unsigned long nPixels = 1;
+    if (i < this->GetOutputExpressionFields().size())
+      nPixels = this->GetOutputExpressionFields()[i][0] * this->GetOutputExpressionFields()[i][1];
+    bytes += nPixels * nComponents * std::max(tensorflow::DataTypeSize(this->GetOutputTensorsDataTypes().at(i)), 1);
+    }
+  return std::max(bytes, 1ul);
+ }
+
+/*
+ * Set the batch size to the largest one whose tensors fit in BatchRAM,
+ * without exceeding the number of samples
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelLearningBase<TInputImage>
+::ComputeBatchSizeFromRAM()
+ {
+  const unsigned long budget = static_cast<unsigned long>(m_BatchRAM) * 1024 * 1024;
+  const unsigned long sampleBytes = GetBatchSampleBytes();
+  unsigned long batchSize = std::max(budget / sampleBytes, 1ul);
+  if (m_NumberOfSamples > 0)
+    batchSize = std::min(batchSize, static_cast<unsigned long>(m_NumberOfSamples));
+  m_BatchSize = batchSize;
+  itkDebugMacro("Batch size " << m_BatchSize << " (" << sampleBytes << " bytes per sample, "
+      << m_BatchRAM << " MB)");
  }
 
 template <class TInputImage>
@@ -114,8 +193,62 @@ TensorflowMultisourceModelLearningBase<TInputImage>
     } // next image
  }
 
+/*
+ * Number of samples processed in one epoch: the size of the samples order,
+ * or the number of samples when no order is set
+ */
+template <class TInputImage>
+typename TensorflowMultisourceModelLearningBase<TInputImage>::IndexValueType
+TensorflowMultisourceModelLearningBase<TInputImage>
+::GetNumberOfEpochSamples()
+ {
+  if (m_SampleOrder.size() > 0)
+    {
+    return m_SampleOrder.size();
+    }
+  return m_NumberOfSamples;
+ }
+
+/*
+ * Number of batches. The last one can be partial.
+ */
+template <class TInputImage>
+typename TensorflowMultisourceModelLearningBase<TInputImage>::IndexValueType
+TensorflowMultisourceModelLearningBase<TInputImage>
+::GetNumberOfBatches()
+ {
+  return (GetNumberOfEpochSamples() + m_BatchSize - 1) / m_BatchSize;
+ }
+
+/*
+ * Position of the first sample of a batch
+ */
+template <class TInputImage>
+typename TensorflowMultisourceModelLearningBase<TInputImage>::IndexValueType
+TensorflowMultisourceModelLearningBase<TInputImage>
+::GetBatchSampleStart(IndexValueType batch)
+ {
+  return batch * m_BatchSize;
+ }
+
+/*
+ * Number of samples of a batch
+ */
+template <class TInputImage>
+typename TensorflowMultisourceModelLearningBase<TInputImage>::IndexValueType
+TensorflowMultisourceModelLearningBase<TInputImage>
+::GetBatchNumberOfSamples(IndexValueType batch)
+ {
+  const IndexValueType sampleStart = GetBatchSampleStart(batch);
+  return std::min(static_cast<IndexValueType>(m_BatchSize), GetNumberOfEpochSamples() - sampleStart);
+ }
+
 /**
- *
+ * Loop over the batches.
+ * Without prefetching, each batch is populated then processed.
+ * With prefetching, a background thread populates the batches and pushes
+ * them in a queue of PrefetchDepth batches, from which the batches are
+ * processed.
  */
 template <class TInputImage>
 void
@@ -123,44 +256,461 @@ TensorflowMultisourceModelLearningBase<TInputImage>
 ::GenerateData()
  {
 
+  // The pool is created before the prefetching thread uses it
+  GetThreadPool();
+  m_EpochCacheHits = 0;
+
   // Batches loop
-  const IndexValueType nBatches = std::ceil(m_NumberOfSamples / m_BatchSize);
-  const IndexValueType rest = m_NumberOfSamples % m_BatchSize;
+  const IndexValueType nBatches = GetNumberOfBatches();
 
   itk::ProgressReporter progress(this, 0, nBatches);
 
-  for (IndexValueType batch = 0 ; batch < nBatches ; batch++)
+  if (m_PrefetchDepth == 0)
+    {
+    AllocateBatchBuffers(1);
+    for (IndexValueType batch = 0 ; batch < nBatches ; batch++)
+      {
+      // Batch start and size
+      const IndexValueType sampleStart = GetBatchSampleStart(batch);
+      const IndexValueType batchSize = GetBatchNumberOfSamples(batch);
+
+      // Feed dict
+      const std::chrono::steady_clock::time_point assemblyStart = std::chrono::steady_clock::now();
+      DictType inputs;
+      this->PopulateInputTensors(inputs, sampleStart, batchSize, m_SampleOrder, 0);
+      m_BatchAssemblyTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - assemblyStart).count();
+
+      // Process the batch
+      ProcessBatchWithProfiling(inputs, batch);
+
+      progress.CompletedPixel();
+      } // Next batch
+    return;
+    }
+
+  // The buffer of a batch is reused PrefetchDepth + 2 batches later: by then,
+  // the batch has been processed (at most PrefetchDepth batches are queued, and
+  // one batch is being populated)
+  const unsigned int nBuffers = m_PrefetchDepth + 2;
+  AllocateBatchBuffers(nBuffers);
+
+  // Queue of populated batches, shared with the prefetching thread
+  std::deque<DictType>    queue;
+  std::mutex              mutex;
+  std::condition_variable queueNotFull;
+  std::condition_variable queueNotEmpty;
+  std::exception_ptr      prefetchError;
+  bool                    abort = false;
+
+  // Prefetching thread
+  std::thread prefetchThread([&]()
+    {
+    try
+      {
+      for (IndexValueType batch = 0 ; batch < nBatches ; batch++)
+        {
+        DictType inputs;
+        this->PopulateInputTensors(inputs, GetBatchSampleStart(batch), GetBatchNumberOfSamples(batch), m_SampleOrder,
+            batch % nBuffers);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        queueNotFull.wait(lock, [&]{ return abort || queue.size() < m_PrefetchDepth; });
+        if (abort)
+          {
+          return;
+          }
+        queue.push_back(inputs);
+        queueNotEmpty.notify_one();
+        }
+      }
+    catch (...)
+      {
+      std::lock_guard<std::mutex> lock(mutex);
+      prefetchError = std::current_exception();
+      queueNotEmpty.notify_one();
+      }
+    });
+
+  try
+    {
+    for (IndexValueType batch = 0 ; batch < nBatches ; batch++)
+      {
+      // Wait for the batch
+      const std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+      DictType inputs;
+      {
+      std::unique_lock<std::mutex> lock(mutex);
+      queueNotEmpty.wait(lock, [&]{ return !queue.empty() || prefetchError; });
+      if (queue.empty())
+        {
+        std::rethrow_exception(prefetchError);
+        }
+      inputs = queue.front();
+      queue.pop_front();
+      queueNotFull.notify_one();
+      }
+      m_BatchAssemblyTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+
+      // Process the batch
+      ProcessBatchWithProfiling(inputs, batch);
+
+      progress.CompletedPixel();
+      } // Next batch
+    }
+  catch (...)
+    {
+    // Stop the prefetching thread before leaving
+    {
+    std::lock_guard<std::mutex> lock(mutex);
+    abort = true;
+    }
+    queueNotFull.notify_all();
+    prefetchThread.join();
+    throw;
+    }
+
+  prefetchThread.join();
+
+ }
+
+/*
+ * Process one batch, and record it in the profiler
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelLearningBase<TInputImage>
+::ProcessBatchWithProfiling(DictType & inputs, IndexValueType batch)
+ {
+  const IndexValueType sampleStart = GetBatchSampleStart(batch);
+  const IndexValueType batchSize = GetBatchNumberOfSamples(batch);
+
+  ProfilerType * profiler = this->GetProfiler();
+  typename ProfilerType::TimePointType startTime;
+  if (profiler)
     {
+    startTime = profiler->Now();
+    }
+  this->ProcessBatch(inputs, sampleStart, batchSize);
+  if (profiler)
+    {
+    ProfilerArgumentsType args;
+    args["batch"] = std::to_string(batch);
+    args["samples"] = std::to_string(batchSize);
+    profiler->AddEvent("batch", this->GetNameOfClass(), startTime, profiler->Now(), args);
+    profiler->AddProcessedSamples(batchSize);
+    }
+ }
 
-    // Feed dict
-    DictType inputs;
+/*
+ * Get a block of samples of one input from the cache. If the block is not
+ * cached, it is decoded from the epoch cache, or read and copied in a new
+ * image (and added to the epoch cache if it fits), then the least recently used
+ * blocks are removed until the cache fits in StreamingCacheRAM. The last block
+ * read is always kept.
+ */
+template <class TInputImage>
+typename TensorflowMultisourceModelLearningBase<TInputImage>::ImagePointerType
+TensorflowMultisourceModelLearningBase<TInputImage>
+::GetCachedBlock(unsigned int inputIndex, IndexValueType block)
+ {
+  const BlockKeyType key(inputIndex, block);
+  auto it = m_BlockCache.find(key);
+  if (it != m_BlockCache.end())
+    {
+    // Move the block at the front of the LRU list
+    m_BlockLRU.splice(m_BlockLRU.begin(), m_BlockLRU, it->second.second);
+    return it->second.first;
+    }
 
-    // Batch start and size
-    const IndexValueType sampleStart = batch * m_BatchSize;
-    IndexValueType batchSize = m_BatchSize;
-    if (rest != 0 && batch == nBatches - 1)
+  // Region of the block
+  ImagePointerType inputPtr = const_cast<ImageType*>(this->GetInput(inputIndex));
+  const SizeType inputPatchSize = this->GetInputReceptiveFields().at(inputIndex);
+  const IndexValueType blockSize = GetCacheBlockSize();
+  const IndexValueType firstSample = block * blockSize;
+  const IndexValueType nSamples = std::min(blockSize, m_NumberOfSamples - firstSample);
+  RegionType blockRegion;
+  blockRegion.SetIndex(0, 0);
+  blockRegion.SetIndex(1, firstSample * inputPatchSize[1]);
+  blockRegion.SetSize(0, inputPatchSize[0]);
+  blockRegion.SetSize(1, nSamples * inputPatchSize[1]);
+
+  // Decode the block from the epoch cache, or read the block and keep a copy
+  ImagePointerType blockImage = ImageType::New();
+  blockImage->SetNumberOfComponentsPerPixel(inputPtr->GetNumberOfComponentsPerPixel());
+  blockImage->SetRegions(blockRegion);
+  blockImage->Allocate();
+  if (!ReadBlockFromEpochCache(key, blockImage))
     {
-      batchSize = rest;
+    tf::PropagateRequestedRegion<TInputImage>(inputPtr, blockRegion);
+    itk::ImageAlgorithm::Copy(inputPtr.GetPointer(), blockImage.GetPointer(), blockRegion, blockRegion);
+    AddBlockToEpochCache(key, blockImage);
     }
 
-    // Process the batch
-    this->ProcessBatch(inputs, sampleStart, batchSize);
+  // Add the block in the cache
+  m_BlockLRU.push_front(key);
+  m_BlockCache[key] = CachedBlockType(blockImage, m_BlockLRU.begin());
+  m_BlockCacheBytes += blockRegion.GetNumberOfPixels() * blockImage->GetNumberOfComponentsPerPixel()
+      * sizeof(typename ImageType::InternalPixelType);
 
-    progress.CompletedPixel();
-    } // Next batch
+  // Remove the least recently used blocks
+  const unsigned long maxBytes = static_cast<unsigned long>(m_StreamingCacheRAM) * 1024 * 1024;
+  while (m_BlockCacheBytes > maxBytes && m_BlockLRU.size() > 1)
+    {
+    const BlockKeyType oldKey = m_BlockLRU.back();
+    const ImagePointerType oldImage = m_BlockCache[oldKey].first;
+    m_BlockCacheBytes -= oldImage->GetBufferedRegion().GetNumberOfPixels() * oldImage->GetNumberOfComponentsPerPixel()
+        * sizeof(typename ImageType::InternalPixelType);
+    m_BlockCache.erase(oldKey);
+    m_BlockLRU.pop_back();
+    }
 
+  return blockImage;
+ }
+
+/*
+ * Values of the patches of the samples of a batch, in an image of patches
+ * concatenated in the y dimension (all bands, row-major order).
+ * Without samples order, the patches are contiguous: a pointer in the buffer
+ * of the image is returned. Otherwise, the patches are gathered in the given
+ * buffer, sample by sample.
+ */
+template <class TInputImage>
+const typename TensorflowMultisourceModelLearningBase<TInputImage>::ImageType::InternalPixelType *
+TensorflowMultisourceModelLearningBase<TInputImage>
+::GetBatchPatchesValues(ImagePointerType image, const SizeType & patchSize, const IndexValueType & sampleStart,
+    const IndexValueType & batchSize, std::vector<typename ImageType::InternalPixelType> & buffer)
+ {
+  const unsigned int nComponents = image->GetNumberOfComponentsPerPixel();
+  IndexType start;
+  start.Fill(0);
+  RegionType region(start, patchSize);
+
+  if (m_SampleOrder.empty())
+    {
+    // The width of the image is the patch size, hence the pixels of the region are contiguous
+    region.SetIndex(1, patchSize[1] * sampleStart);
+    region.SetSize(1, patchSize[1] * batchSize);
+    tf::PropagateRequestedRegion<TInputImage>(image, region);
+    return image->GetBufferPointer() + image->ComputeOffset(region.GetIndex()) * nComponents;
+    }
+
+  const unsigned long patchValues = region.GetNumberOfPixels() * nComponents;
+  buffer.resize(batchSize * patchValues);
+  for (IndexValueType elem = 0 ; elem < batchSize ; elem++)
+    {
+    region.SetIndex(1, patchSize[1] * m_SampleOrder[sampleStart + elem]);
+    tf::PropagateRequestedRegion<TInputImage>(image, region);
+    const typename ImageType::InternalPixelType * values = image->GetBufferPointer() +
+        image->ComputeOffset(region.GetIndex()) * nComponents;
+    std::copy(values, values + patchValues, buffer.begin() + elem * patchValues);
+    }
+  return buffer.data();
+ }
+
+/*
+ * Number of samples of the cached blocks: the streaming block size, or one
+ * sample when the samples are read one by one
+ */
+template <class TInputImage>
+typename TensorflowMultisourceModelLearningBase<TInputImage>::IndexValueType
+TensorflowMultisourceModelLearningBase<TInputImage>
+::GetCacheBlockSize() const
+ {
+  return std::max(m_StreamingBlockSize, static_cast<IndexValueType>(1));
+ }
+
+/*
+ * Decode a block from the epoch cache in the (allocated) block image.
+ * Returns false if the block is not in the epoch cache.
+ */
+template <class TInputImage>
+bool
+TensorflowMultisourceModelLearningBase<TInputImage>
+::ReadBlockFromEpochCache(const BlockKeyType & key, ImagePointerType blockImage)
+ {
+  auto it = m_EpochCache.find(key);
+  if (it == m_EpochCache.end())
+    {
+    return false;
+    }
+
+  m_EpochCacheHits++;
+  const EpochCacheEntryType & entry = it->second;
+  const unsigned long long nValues = blockImage->GetBufferedRegion().GetNumberOfPixels() *
+      blockImage->GetNumberOfComponentsPerPixel();
+  if (entry.compression == tf::PATCHES_FILE_NONE)
+    {
+    tf::DecodePatchesFileValues(entry.data.data(), entry.dataType, blockImage->GetBufferPointer(), nValues);
+    }
+  else
+    {
+    std::vector<char> values(entry.size);
+    tf::DecompressPatchesFileChunk(entry.compression, entry.data.data(), entry.data.size(),
+        values.data(), values.size());
+    tf::DecodePatchesFileValues(values.data(), entry.dataType, blockImage->GetBufferPointer(), nValues);
+    }
+  return true;
+ }
+
+/*
+ * Store a block in the epoch cache, with the smallest data type that holds
+ * its values, if it fits in EpochCacheRAM
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelLearningBase<TInputImage>
+::AddBlockToEpochCache(const BlockKeyType & key, ImagePointerType blockImage)
+ {
+  const unsigned long maxBytes = static_cast<unsigned long>(m_EpochCacheRAM) * 1024 * 1024;
+  if (m_EpochCacheBytes >= maxBytes)
+    {
+    return;
+    }
+
+  const typename ImageType::InternalPixelType * values = blockImage->GetBufferPointer();
+  const unsigned long long nValues = blockImage->GetBufferedRegion().GetNumberOfPixels() *
+      blockImage->GetNumberOfComponentsPerPixel();
+  EpochCacheEntryType entry;
+  entry.dataType = tf::GetCompactPatchesFileDataType(values, nValues);
+  entry.data = tf::EncodePatchesFileValues(values, nValues, entry.dataType);
+  entry.size = entry.data.size();
+  entry.compression = m_EpochCacheCompression;
+  if (entry.compression != tf::PATCHES_FILE_NONE)
+    {
+    entry.data = tf::CompressPatchesFileChunk(m_EpochCacheCompression, entry.data.data(), entry.data.size());
+    }
+
+  // Blocks that do not fit are read again at each epoch
+  if (m_EpochCacheBytes + entry.data.size() > maxBytes)
+    {
+    return;
+    }
+  m_EpochCacheBytes += entry.data.size();
+  m_EpochCache[key] = std::move(entry);
+ }
+
+/*
+ * Remove all the blocks of the cache, and of the epoch cache
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelLearningBase<TInputImage>
+::ClearBlockCache()
+ {
+  m_BlockCache.clear();
+  m_BlockLRU.clear();
+  m_BlockCacheBytes = 0;
+  m_EpochCache.clear();
+  m_EpochCacheBytes = 0;
+ }
+
+/*
+ * Allocate the batch tensors of nBuffers buffers, for each input.
+ * Existing buffers are kept.
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelLearningBase<TInputImage>
+::AllocateBatchBuffers(unsigned int nBuffers)
+ {
+  // Buffers are allocated for the current batch size
+  if (m_BatchBuffers.size() > 0 && m_BatchBuffers[0].size() > 0 &&
+      m_BatchBuffers[0][0].dim_size(0) != static_cast<tensorflow::int64>(m_BatchSize))
+    {
+    m_BatchBuffers.clear();
+    }
+
+  while (m_BatchBuffers.size() < nBuffers)
+    {
+    TensorListType tensors;
+    for (unsigned int i = 0 ; i < this->GetNumberOfInputs() ; i++)
+      {
+      // Shape of the batch for input #i
+      const SizeType inputPatchSize = this->GetInputReceptiveFields().at(i);
+      const tensorflow::int64 sz_n = m_BatchSize;
+      const tensorflow::int64 sz_y = inputPatchSize[1];
+      const tensorflow::int64 sz_x = inputPatchSize[0];
+      const tensorflow::int64 sz_c = this->GetInput(i)->GetNumberOfComponentsPerPixel();
+      const tensorflow::TensorShape inputTensorShape({sz_n, sz_y, sz_x, sz_c});
+      tensors.push_back(tensorflow::Tensor(this->GetInputTensorsDataTypes()[i], inputTensorShape));
+      }
+    m_BatchBuffers.push_back(tensors);
+    }
+ }
+
+/*
+ * Copy one patch in the batch tensor of the input #inputIndex, at position elem.
+ * Called by multiple threads, for distinct (inputIndex, elem).
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelLearningBase<TInputImage>
+::CopyPatchToTensor(const ImagePointerType & image, const RegionType & region, tensorflow::Tensor & tensor,
+    unsigned int inputIndex, IndexValueType elem, IndexValueType sample)
+ {
+  (void) inputIndex;
+  (void) sample;
+  tf::RecopyImageRegionToTensorWithCast<TInputImage>(image, region, tensor, elem);
+ }
+
+/*
+ * Get the batch tensor of one input, from a buffer.
+ * A partial batch is a slice of the buffer.
+ */
+template <class TInputImage>
+tensorflow::Tensor
+TensorflowMultisourceModelLearningBase<TInputImage>
+::GetBatchTensor(unsigned int bufferIndex, unsigned int inputIndex, const IndexValueType & batchSize)
+ {
+  const tensorflow::Tensor & tensor = m_BatchBuffers.at(bufferIndex).at(inputIndex);
+  if (batchSize < tensor.dim_size(0))
+    {
+    return tensor.Slice(0, batchSize);
+    }
+  return tensor;
+ }
+
+/*
+ * Pool of the threads that copy the patches. It is created again when the
+ * number of threads of the filter has changed.
+ */
+template <class TInputImage>
+tf::ThreadPool *
+TensorflowMultisourceModelLearningBase<TInputImage>
+::GetThreadPool()
+ {
+  const unsigned int nWorkers = std::max(static_cast<unsigned int>(this->GetNumberOfThreads()), 1u) - 1;
+  if (!m_ThreadPool || m_ThreadPool->GetNumberOfWorkers() != nWorkers)
+    {
+    m_ThreadPool.reset(new tf::ThreadPool(nWorkers));
+    }
+  return m_ThreadPool.get();
  }
 
 template <class TInputImage>
 void
 TensorflowMultisourceModelLearningBase<TInputImage>
 ::PopulateInputTensors(DictType & inputs, const IndexValueType & sampleStart,
-    const IndexValueType & batchSize, const IndexListType & order)
+    const IndexValueType & batchSize, const IndexListType & order, unsigned int bufferIndex)
  {
   const bool reorder = order.size();
 
-  // Populate input tensors
-  for (unsigned int i = 0 ; i < this->GetNumberOfInputs() ; i++)
+  ProfilerType * profiler = this->GetProfiler();
+  typename ProfilerType::TimePointType startTime;
+  if (profiler)
+    {
+    startTime = profiler->Now();
+    }
+
+  // Get the batch tensors, and list the images and regions of the patches.
+  // Images and pipelines are not thread safe: blocks are read (or patches are
+  // read and copied, without blocks) in this thread.
+  const unsigned int nInputs = this->GetNumberOfInputs();
+  TensorListType tensors;
+  std::vector<std::vector<ImagePointerType> > patchImages(nInputs);
+  std::vector<std::vector<RegionType> > patchRegions(nInputs);
+  IndexListType samples(batchSize);
+  for (unsigned int i = 0 ; i < nInputs ; i++)
     {
     // Input image pointer
     ImagePointerType inputPtr = const_cast<ImageType*>(this->GetInput(i));
@@ -168,41 +718,76 @@ TensorflowMultisourceModelLearningBase<TInputImage>
     // Patch size of tensor #i
     const SizeType inputPatchSize = this->GetInputReceptiveFields().at(i);
 
-    // Create the tensor for the batch
-    const tensorflow::int64 sz_n = batchSize;
+    // Tensor of the batch, from the buffers
     const tensorflow::int64 sz_y = inputPatchSize[1];
-    const tensorflow::int64 sz_x = inputPatchSize[0];
-    const tensorflow::int64 sz_c = inputPtr->GetNumberOfComponentsPerPixel();
-    const tensorflow::TensorShape inputTensorShape({sz_n, sz_y, sz_x, sz_c});
-    tensorflow::Tensor inputTensor(this->GetInputTensorsDataTypes()[i], inputTensorShape);
+    tensorflow::Tensor inputTensor = GetBatchTensor(bufferIndex, i, batchSize);
+    tensors.push_back(inputTensor);
 
-    // Populate the tensor
+    // Patches of the batch
     for (IndexValueType elem = 0 ; elem < batchSize ; elem++)
       {
       const tensorflow::uint64 samplePos = sampleStart + elem;
+      samples[elem] = reorder ? order[samplePos] : samplePos;
       IndexType start;
       start[0] = 0;
-      if (reorder)
-      {
-        start[1] = order[samplePos] * sz_y;
-      }
-      else
+      start[1] = samples[elem] * sz_y;
+      RegionType patchRegion(start, inputPatchSize);
+      ImagePointerType patchImage = inputPtr;
+      if (m_UseStreaming && (m_StreamingBlockSize > 0 || m_EpochCacheRAM > 0))
       {
-        start[1] = samplePos * sz_y;;
+        // Read the patch from the cached block that contains it
+        patchImage = GetCachedBlock(i, start[1] / sz_y / GetCacheBlockSize());
       }
-      RegionType patchRegion(start, inputPatchSize);
-      if (m_UseStreaming)
+      else if (m_UseStreaming)
       {
         // If streaming is enabled, we need to explicitly propagate requested region
         tf::PropagateRequestedRegion<TInputImage>(inputPtr, patchRegion);
+        CopyPatchToTensor(inputPtr, patchRegion, inputTensor, i, elem, samples[elem]);
+        patchImage = nullptr;
       }
-      tf::RecopyImageRegionToTensorWithCast<TInputImage>(inputPtr, patchRegion, inputTensor, elem );
+      patchImages[i].push_back(patchImage);
+      patchRegions[i].push_back(patchRegion);
       }
+    } // next input tensor
 
-    // Input #i : the tensor of patches (aka the batch)
-    DictElementType input = { this->GetInputPlaceholders()[i], inputTensor };
+  // Copy the patches in the tensors, in parallel over the inputs and the
+  // samples. Each thread writes distinct samples of the batch tensors.
+  tf::ParallelFor(nInputs * batchSize, this->GetNumberOfThreads(),
+      [&](unsigned long begin, unsigned long end)
+    {
+    for (unsigned long k = begin ; k < end ; k++)
+      {
+      const unsigned int i = k / batchSize;
+      const IndexValueType elem = k % batchSize;
+      if (patchImages[i][elem])
+        {
+        CopyPatchToTensor(patchImages[i][elem], patchRegions[i][elem], tensors[i], i, elem, samples[elem]);
+        }
+      }
+    }, m_ThreadPool.get());
+
+  // Input #i : the tensor of patches (aka the batch)
+  for (unsigned int i = 0 ; i < nInputs ; i++)
+    {
+    DictElementType input = { this->GetInputPlaceholders()[i], tensors[i] };
     inputs.push_back(input);
-    } // next input tensor
+    }
+
+  // Profiling: the tensors are populated (including the reading of the
+  // patches when the streaming is enabled)
+  if (profiler)
+    {
+    TensorListType inputTensors;
+    for (auto& input: inputs)
+      {
+      inputTensors.push_back(input.second);
+      }
+    ProfilerArgumentsType args;
+    args["samples"] = std::to_string(batchSize);
+    args["streaming"] = m_UseStreaming ? "true" : "false";
+    this->AddTensorsToProfilerArguments("input", inputTensors, args);
+    profiler->AddEvent("populate", this->GetNameOfClass(), startTime, profiler->Now(), args);
+    }
  }
 
 
@@ -0,0 +1,144 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowMultisourceModelRegressionValidate_h
+#define otbTensorflowMultisourceModelRegressionValidate_h
+
+#include "itkProcessObject.h"
+#include "itkNumericTraits.h"
+#include "itkSimpleDataObjectDecorator.h"
+
+// Base
+#include "otbTensorflowMultisourceModelValidateBase.h"
+
+// Metrics
+#include "otbTensorflowRegressionMetrics.h"
+
+namespace otb
+{
+
+/**
+ * \class TensorflowMultisourceModelRegressionValidate
+ * \brief This filter validates a TensorFlow regression model over multiple input images.
+ *
+ * This filter computes the regression metrics (RMSE, MAE, bias and R2) of
+ * each channel of each output tensor. The references, their checks and the
+ * subset of the samples are handled by
+ * TensorflowMultisourceModelValidateBase. The channel c of an output tensor
+ * is compared to the band c of its reference, which must have at least as
+ * many bands as the tensor has channels.
+ *
+ * The metrics are accumulated batch by batch, directly from the output
+ * tensors and the buffers of the references blocks, with streaming
+ * accumulators (see otbTensorflowRegressionMetrics.h) filled by multiple
+ * threads. When UseNoDataValue is true, the values whose reference is
+ * NoDataValue are ignored.
+ *
+ * \ingroup OTBTensorflow
+ */
+template <class TInputImage>
+class ITK_EXPORT TensorflowMultisourceModelRegressionValidate :
+public TensorflowMultisourceModelValidateBase<TInputImage>
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef TensorflowMultisourceModelRegressionValidate        Self;
+  typedef TensorflowMultisourceModelValidateBase<TInputImage> Superclass;
+  typedef itk::SmartPointer<Self>                             Pointer;
+  typedef itk::SmartPointer<const Self>                       ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(TensorflowMultisourceModelRegressionValidate, TensorflowMultisourceModelValidateBase);
+
+  /** Images typedefs */
+  typedef typename Superclass::ImageType         ImageType;
+  typedef typename Superclass::ImagePointerType  ImagePointerType;
+  typedef typename Superclass::RegionType        RegionType;
+  typedef typename Superclass::SizeType          SizeType;
+  typedef typename Superclass::IndexType         IndexType;
+  typedef typename Superclass::ImageListType     ImageListType;
+  typedef typename Superclass::ReferenceValueType ReferenceValueType;
+
+  /* Typedefs for parameters */
+  typedef typename Superclass::DictType          DictType;
+  typedef typename Superclass::StringList        StringList;
+  typedef typename Superclass::SizeListType      SizeListType;
+  typedef typename Superclass::TensorListType    TensorListType;
+  typedef typename Superclass::IndexValueType    IndexValueType;
+  typedef typename Superclass::IndexListType     IndexListType;
+
+  /* Typedefs for validation */
+  typedef tf::RegressionMetrics                    MetricsType;
+  typedef std::vector<MetricsType>                 MetricsListType;
+  typedef std::vector<tf::RegressionAccumulator>   AccumulatorListType;
+
+  /** No-data value of the references */
+  itkSetMacro(NoDataValue, double);
+  itkGetMacro(NoDataValue, double);
+  itkSetMacro(UseNoDataValue, bool);
+  itkGetMacro(UseNoDataValue, bool);
+  itkBooleanMacro(UseNoDataValue);
+
+  /** Get the metrics of each channel of a target */
+  const MetricsListType GetMetrics(unsigned int target);
+
+protected:
+  TensorflowMultisourceModelRegressionValidate();
+  virtual ~TensorflowMultisourceModelRegressionValidate() {};
+
+  void GenerateData();
+  void AccumulateBatch(unsigned int target, const tensorflow::Tensor & output, tensorflow::int64 nChannels,
+      const ReferenceValueType * refValues, unsigned int refComponents, unsigned long nPixels);
+
+private:
+  TensorflowMultisourceModelRegressionValidate(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  // Accumulate the pairs of an output tensor, whatever the type of its values
+  struct AccumulateFunctor
+  {
+    AccumulatorListType &      accumulators;
+    const ReferenceValueType * refValues;
+    unsigned int               refComponents;
+    tensorflow::int64          nChannels;
+    unsigned long              nPixels;
+    bool                       useNoData;
+    double                     noData;
+    unsigned int               nThreads;
+
+    template<class TPredicted>
+    void operator()(const TPredicted * predictions) const
+    {
+      tf::AccumulateRegressionMetrics(accumulators, refValues, refComponents, predictions, nChannels, nPixels,
+          useNoData, noData, nThreads);
+    }
+  };
+
+  double                           m_NoDataValue;    // No-data value of the references
+  bool                             m_UseNoDataValue; // Ignore the no-data values on/off
+
+  // Read only
+  std::vector<MetricsListType>     m_Metrics;        // Metrics of each channel, for each target
+
+  // Internal
+  std::vector<AccumulatorListType> m_Accumulators;   // Accumulators of each channel, for each target
+
+}; // end class
+
+
+} // end namespace otb
+
+#include "otbTensorflowMultisourceModelRegressionValidate.hxx"
+
+#endif
@@ -0,0 +1,97 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowMultisourceModelRegressionValidate_txx
+#define otbTensorflowMultisourceModelRegressionValidate_txx
+
+#include "otbTensorflowMultisourceModelRegressionValidate.h"
+
+namespace otb
+{
+
+template <class TInputImage>
+TensorflowMultisourceModelRegressionValidate<TInputImage>
+::TensorflowMultisourceModelRegressionValidate(): m_NoDataValue(0), m_UseNoDataValue(false)
+ {
+ }
+
+
+/**
+ * Perform the validation
+ * The session is ran over the entire set of batches, and the metrics are
+ * accumulated batch after batch.
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelRegressionValidate<TInputImage>
+::GenerateData()
+ {
+
+  // New accumulators
+  m_Metrics.clear();
+  m_Accumulators.assign(this->GetNumberOfInputReferences(), AccumulatorListType());
+
+  // Run all the batches
+  Superclass::GenerateData();
+
+  // Compute the metrics
+  for (auto const& accumulators: m_Accumulators)
+    {
+    MetricsListType metrics;
+    for (auto const& accumulator: accumulators)
+      metrics.push_back(accumulator.GetMetrics());
+    m_Metrics.push_back(metrics);
+    }
+
+ }
+
+
+/*
+ * Update the metrics of a target with an output tensor of a batch
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelRegressionValidate<TInputImage>
+::AccumulateBatch(unsigned int target, const tensorflow::Tensor & output, tensorflow::int64 nChannels,
+    const ReferenceValueType * refValues, unsigned int refComponents, unsigned long nPixels)
+ {
+  if (static_cast<tensorflow::int64>(refComponents) < nChannels)
+    {
+    itkExceptionMacro("The output tensor #" << target << " has " << nChannels << " channels but its reference has only "
+        << refComponents << " bands");
+    }
+
+  const AccumulateFunctor functor = {m_Accumulators[target], refValues, refComponents, nChannels, nPixels,
+      m_UseNoDataValue, m_NoDataValue, this->GetNumberOfThreads()};
+  this->ApplyToOutputValues(target, output, functor);
+ }
+
+/*
+ * Get the metrics of a target
+ * If the target is not available, an exception is thrown.
+ */
+template <class TInputImage>
+const typename TensorflowMultisourceModelRegressionValidate<TInputImage>::MetricsListType
+TensorflowMultisourceModelRegressionValidate<TInputImage>
+::GetMetrics(unsigned int target)
+ {
+  if (target >= m_Metrics.size())
+    {
+    itkExceptionMacro("Unable to get the metrics #" << target << ". " <<
+        "There is only " << m_Metrics.size() << " available.");
+    }
+
+  return m_Metrics[target];
+ }
+
+} // end namespace otb
+
+
+#endif
@@ -22,6 +22,14 @@
 #include <random>
 #include <algorithm>
 #include <iterator>
+#include <map>
+#include <numeric>
+
+// Telemetry
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
 
 namespace otb
 {
@@ -30,6 +38,74 @@ namespace otb
  * \class TensorflowMultisourceModelTrain
  * \brief This filter train a TensorFlow model over multiple input images.
  *
+ * At each epoch, the samples are shuffled. Two strategies are available:
+ * - SHUFFLE_FULL: the samples are fully permuted,
+ * - SHUFFLE_BLOCKS: the order of chunks of ShuffleChunkSize contiguous samples
+ *   is shuffled, then the samples of the chunks go through a shuffle buffer
+ *   of ShuffleBufferSize samples, from which they are drawn randomly. Reading
+ *   stays close to sequential, which suits the streaming mode. When
+ *   ShuffleChunkSize is 0, the streaming block size is used.
+ *
+ * The samples of an epoch are scheduled with one of the sampling modes:
+ * - SAMPLING_UNIFORM: all the samples are shuffled (see above),
+ * - SAMPLING_BALANCED: the class of each sample is read once from the input
+ *   fed to the LabelsPlaceholder (first band, at the center of the patch).
+ *   For each drawn sample, a class is drawn with the probabilities given by
+ *   ClassWeights (uniform over the classes when empty), then a sample of this
+ *   class is taken from a shuffled list of its samples, which is shuffled again
+ *   once all of them have been used,
+ * - SAMPLING_WEIGHTED: the samples are drawn with replacement, with
+ *   probabilities proportional to SampleWeights (one weight per sample),
+ * - SAMPLING_HARD: hard-example mining. The output tensor SampleLossesTensor
+ *   (one value per sample of the batch, e.g. the per-sample loss) is recorded
+ *   for each trained sample. At each epoch, the HardExamplesFraction of the
+ *   samples with the highest recorded losses (the samples without loss first)
+ *   form the pool of hard examples: a share HardExamplesRatio of the epoch is
+ *   drawn from this pool, and the rest from all the samples. The first epoch
+ *   goes through all the samples, shuffled.
+ * The classes and the losses of the samples are kept across epochs, and reset
+ * only when the inputs change (see GetInputsChanged()).
+ * When EpochSize is not 0, each epoch has EpochSize samples instead of the
+ * number of samples (with the uniform sampling, the permutations are
+ * truncated or concatenated). Rare classes can then be seen as often as the
+ * others without duplicating their patches, and epochs can be shorter.
+ *
+ * The samples can come from several datasets, concatenated in the inputs
+ * (e.g. with TensorflowPatchesConcatenation): DatasetSizes gives the number of
+ * samples of each dataset, in the order of the samples. With the uniform
+ * sampling and more than one dataset, the samples of an epoch are drawn from
+ * the datasets with the proportions of DatasetRatios (proportional to the
+ * dataset sizes when empty), and interleaved so that each batch holds the
+ * datasets in these proportions. The samples of each dataset are taken from
+ * shuffled permutations of its samples (the ShuffleMode is not used).
+ *
+ * The random generator of each epoch is seeded from Seed and the epoch number,
+ * hence the samples order is reproducible for a given seed.
+ *
+ * The patches can be augmented on the fly, while they are copied in the batch
+ * tensors:
+ * - a transform of the dihedral group D4 is drawn among the first
+ *   AugmentationTransforms ones (1: no transform, 2: flip along x, 4: flips,
+ *   8: flips and transpositions, which require square patches), and applied
+ *   to the patches of every input of the sample, so that the sources and the
+ *   labels stay consistent,
+ * - the bands of the inputs fed to the placeholders of JitteredPlaceholders
+ *   are changed to gain * value + offset, with gain drawn in
+ *   [1 - GainJitter, 1 + GainJitter] and offset in [-OffsetJitter, OffsetJitter]
+ *   for each band.
+ * The random values of a sample depend only on Seed, the epoch and the sample,
+ * hence the augmentation is reproducible too.
+ *
+ * After each batch, the telemetry of the batch is updated: the values of the
+ * output tensors with one element (e.g. the loss) and their exponential
+ * moving averages over about TelemetryWindow batches, the number of samples
+ * per second, and the time split between the assembly of the batch (the
+ * population of the tensors, or the wait for the prefetched batch) and the
+ * session run. When TelemetryFileName is set, the telemetry of each batch is
+ * appended to this file, in JSON lines if its extension is ".json", or in CSV
+ * otherwise. Then an itk::IterationEvent is invoked, e.g. to log the
+ * telemetry (GetLastBatchTelemetry()) or to save checkpoints every N batches.
+ *
  * \ingroup OTBTensorflow
  */
 template <class TInputImage>
@@ -55,21 +131,159 @@ public:
   typedef typename Superclass::TensorListType    TensorListType;
   typedef typename Superclass::IndexValueType    IndexValueType;
   typedef typename Superclass::IndexListType     IndexListType;
+  typedef typename Superclass::StringList        StringList;
+  typedef typename Superclass::ImagePointerType  ImagePointerType;
+  typedef typename Superclass::RegionType        RegionType;
+  typedef typename Superclass::SizeType          SizeType;
+
+  /** Shuffle strategies */
+  typedef enum { SHUFFLE_FULL, SHUFFLE_BLOCKS } ShuffleModeType;
+
+  itkSetMacro(ShuffleMode, ShuffleModeType);
+  itkGetMacro(ShuffleMode, ShuffleModeType);
+  itkSetMacro(ShuffleChunkSize, IndexValueType);
+  itkGetMacro(ShuffleChunkSize, IndexValueType);
+  itkSetMacro(ShuffleBufferSize, IndexValueType);
+  itkGetMacro(ShuffleBufferSize, IndexValueType);
+
+  /** Sampling modes */
+  typedef enum { SAMPLING_UNIFORM, SAMPLING_BALANCED, SAMPLING_WEIGHTED, SAMPLING_HARD } SamplingModeType;
+  typedef std::map<int, float>                   ClassWeightsType;
+  typedef std::vector<float>                     SampleWeightsType;
+  typedef std::vector<float>                     SampleLossesType;
+  typedef std::map<int, IndexListType>           ClassIndicesType;
+  typedef std::vector<IndexValueType>            DatasetSizesType;
+  typedef std::vector<float>                     DatasetRatiosType;
+
+  itkSetMacro(SamplingMode, SamplingModeType);
+  itkGetMacro(SamplingMode, SamplingModeType);
+  itkSetMacro(EpochSize, IndexValueType);
+  itkGetMacro(EpochSize, IndexValueType);
+  void SetLabelsPlaceholder(const std::string & name);
+  itkGetMacro(LabelsPlaceholder, std::string);
+  void SetClassWeights(const ClassWeightsType & weights)   { m_ClassWeights = weights; this->Modified(); }
+  const ClassWeightsType & GetClassWeights() const         { return m_ClassWeights; }
+  void SetSampleWeights(const SampleWeightsType & weights) { m_SampleWeights = weights; this->Modified(); }
+  const SampleWeightsType & GetSampleWeights() const       { return m_SampleWeights; }
+
+  /** Hard-example mining */
+  itkSetMacro(SampleLossesTensor, std::string);
+  itkGetMacro(SampleLossesTensor, std::string);
+  itkSetMacro(HardExamplesFraction, float);
+  itkGetMacro(HardExamplesFraction, float);
+  itkSetMacro(HardExamplesRatio, float);
+  itkGetMacro(HardExamplesRatio, float);
+
+  /** Last recorded loss of each sample (NaN if not yet trained, with SAMPLING_HARD) */
+  const SampleLossesType & GetSampleLosses() const         { return m_SampleLosses; }
+
+  /** Datasets of the samples */
+  void SetDatasetSizes(const DatasetSizesType & sizes)     { m_DatasetSizes = sizes; this->Modified(); }
+  const DatasetSizesType & GetDatasetSizes() const         { return m_DatasetSizes; }
+  void SetDatasetRatios(const DatasetRatiosType & ratios)  { m_DatasetRatios = ratios; this->Modified(); }
+  const DatasetRatiosType & GetDatasetRatios() const       { return m_DatasetRatios; }
+
+  /** Samples of each class (available after the first epoch with SAMPLING_BALANCED) */
+  const ClassIndicesType & GetClassIndices() const         { return m_ClassIndices; }
+
+  /** Seed of the random generator */
+  itkSetMacro(Seed, unsigned int);
+  itkGetMacro(Seed, unsigned int);
+
+  /** Augmentation */
+  itkSetMacro(AugmentationTransforms, unsigned int);
+  itkGetMacro(AugmentationTransforms, unsigned int);
+  itkSetMacro(GainJitter, float);
+  itkGetMacro(GainJitter, float);
+  itkSetMacro(OffsetJitter, float);
+  itkGetMacro(OffsetJitter, float);
+  void SetJitteredPlaceholders(const StringList & placeholders) { m_JitteredPlaceholders = placeholders; this->Modified(); }
+  const StringList & GetJitteredPlaceholders() const            { return m_JitteredPlaceholders; }
+
+  /** Telemetry of a batch */
+  struct BatchTelemetryType
+  {
+    unsigned int        epoch;            // Epoch (from 1)
+    IndexValueType      batch;            // Batch of the epoch (from 0)
+    IndexValueType      samples;          // Number of samples
+    double              assemblyTime;     // Time to get the inputs (s)
+    double              runTime;          // Time of the session run (s)
+    double              samplesPerSecond; // Throughput
+    std::vector<double> values;           // Values of the output tensors (NaN if not one element)
+    std::vector<double> averages;         // Moving averages of the values
+  };
+
+  /** Telemetry file (CSV, or JSON lines if the extension is .json) */
+  void SetTelemetryFileName(const std::string & fileName);
+  itkGetMacro(TelemetryFileName, std::string);
+
+  /** Number of batches of the moving averages */
+  itkSetMacro(TelemetryWindow, unsigned int);
+  itkGetMacro(TelemetryWindow, unsigned int);
+
+  /** Telemetry of the last processed batch */
+  const BatchTelemetryType & GetLastBatchTelemetry() const { return m_LastBatchTelemetry; }
 
 
 protected:
   TensorflowMultisourceModelTrain();
   virtual ~TensorflowMultisourceModelTrain() {};
 
+  virtual void GenerateOutputInformation(void);
   virtual void GenerateData();
+  virtual void ShuffleSamples(std::mt19937 & generator);
+  virtual void ShuffleBlocks(std::mt19937 & generator);
+  virtual void ReadClassIndices();
+  virtual void DrawClassBalancedSamples(std::mt19937 & generator, IndexValueType epochSize);
+  virtual void DrawWeightedSamples(std::mt19937 & generator, IndexValueType epochSize);
+  virtual void DrawHardSamples(std::mt19937 & generator, IndexValueType epochSize);
+  virtual void DrawDatasetsSamples(std::mt19937 & generator, IndexValueType epochSize);
+  virtual void DrawFromPermutations(std::mt19937 & generator, IndexListType & samples, IndexValueType count,
+      IndexListType & drawn);
+  virtual void RecordSampleLosses(const TensorListType & outputs, const IndexValueType & sampleStart,
+      const IndexValueType & batchSize);
+  virtual void CopyPatchToTensor(const ImagePointerType & image, const RegionType & region, tensorflow::Tensor & tensor,
+      unsigned int inputIndex, IndexValueType elem, IndexValueType sample);
   virtual void ProcessBatch(DictType & inputs, const IndexValueType & sampleStart,
       const IndexValueType & batchSize);
+  virtual void UpdateBatchTelemetry(const TensorListType & outputs, const IndexValueType & sampleStart,
+      const IndexValueType & batchSize, double runTime);
+  virtual void WriteBatchTelemetry();
 
 private:
   TensorflowMultisourceModelTrain(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
   IndexListType     m_RandomIndices;           // Reordered indices
+  ShuffleModeType   m_ShuffleMode;             // Shuffle strategy
+  IndexValueType    m_ShuffleChunkSize;        // Number of samples of the shuffled chunks
+  IndexValueType    m_ShuffleBufferSize;       // Number of samples of the shuffle buffer
+  SamplingModeType  m_SamplingMode;            // Sampling mode
+  IndexValueType    m_EpochSize;               // Number of samples of one epoch (0: number of samples)
+  std::string       m_LabelsPlaceholder;       // Placeholder of the labels (balanced sampling)
+  ClassWeightsType  m_ClassWeights;            // Target class distribution (balanced sampling)
+  SampleWeightsType m_SampleWeights;           // Weights of the samples (weighted sampling)
+  ClassIndicesType  m_ClassIndices;            // Samples of each class
+  std::string       m_SampleLossesTensor;      // Output tensor of the per-sample losses (hard-example mining)
+  float             m_HardExamplesFraction;    // Fraction of the samples in the pool of hard examples
+  float             m_HardExamplesRatio;       // Share of the epoch drawn from the hard examples
+  SampleLossesType  m_SampleLosses;            // Last loss of each sample
+  DatasetSizesType  m_DatasetSizes;            // Number of samples of each dataset
+  DatasetRatiosType m_DatasetRatios;           // Sampling ratio of each dataset
+  unsigned int      m_Seed;                    // Seed of the random generator
+  unsigned int      m_Epoch;                   // Number of epochs done
+  unsigned int      m_AugmentationTransforms;  // Number of D4 transforms drawn from (1: no transform)
+  float             m_GainJitter;              // Maximum deviation of the gains from 1
+  float             m_OffsetJitter;            // Maximum absolute value of the offsets
+  StringList        m_JitteredPlaceholders;    // Placeholders of the jittered inputs
+  std::vector<bool> m_JitteredInputs;          // Jitter on/off, for each input
+
+  // Telemetry
+  std::string        m_TelemetryFileName;      // Telemetry file
+  unsigned int       m_TelemetryWindow;        // Number of batches of the moving averages
+  BatchTelemetryType m_LastBatchTelemetry;     // Telemetry of the last batch
+  unsigned long      m_NumberOfAveragedValues; // Number of batches in the moving averages
+  std::ofstream      m_TelemetryStream;        // Telemetry file, opened at the first batch
 
 }; // end class
 
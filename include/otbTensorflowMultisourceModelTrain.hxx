@@ -18,8 +18,29 @@ namespace otb
 
 template <class TInputImage>
 TensorflowMultisourceModelTrain<TInputImage>
-::TensorflowMultisourceModelTrain()
+::TensorflowMultisourceModelTrain(): m_ShuffleMode(SHUFFLE_FULL),
+m_ShuffleChunkSize(0), m_ShuffleBufferSize(10000), m_SamplingMode(SAMPLING_UNIFORM), m_EpochSize(0),
+m_HardExamplesFraction(0.2), m_HardExamplesRatio(0.5), m_Epoch(0),
+m_AugmentationTransforms(1), m_GainJitter(0), m_OffsetJitter(0), m_TelemetryWindow(100), m_NumberOfAveragedValues(0)
  {
+  std::random_device rd;
+  m_Seed = rd();
+ }
+
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::GenerateOutputInformation()
+ {
+  Superclass::GenerateOutputInformation();
+
+  // The output information is generated again at each epoch: the labels and
+  // the losses of the samples are kept, unless the inputs have changed
+  if (this->GetInputsChanged())
+    {
+    m_ClassIndices.clear();
+    m_SampleLosses.clear();
+    }
  }
 
 template <class TInputImage>
@@ -28,18 +49,340 @@ TensorflowMultisourceModelTrain<TInputImage>
 ::GenerateData()
  {
 
-  // Initial sequence 1...N
-  m_RandomIndices.resize(this->GetNumberOfSamples());
-  std::iota (std::begin(m_RandomIndices), std::end(m_RandomIndices), 0);
+  // Check the augmentation
+  if (m_AugmentationTransforms != 1 && m_AugmentationTransforms != 2 &&
+      m_AugmentationTransforms != 4 && m_AugmentationTransforms != 8)
+    {
+    itkExceptionMacro("The number of D4 transforms must be 1, 2, 4 or 8 (got " << m_AugmentationTransforms << ")");
+    }
+  m_JitteredInputs.assign(this->GetNumberOfInputs(), false);
+  for (unsigned int i = 0 ; i < this->GetNumberOfInputs() ; i++)
+    {
+    const SizeType patchSize = this->GetInputReceptiveFields().at(i);
+    if (m_AugmentationTransforms > 4 && patchSize[0] != patchSize[1])
+      {
+      itkExceptionMacro("D4 transforms with transpositions require square patches, but the patch size of "
+          "the input #" << i << " is " << patchSize);
+      }
+    const std::string placeholder = this->GetInputPlaceholders()[i];
+    m_JitteredInputs[i] = (m_GainJitter > 0 || m_OffsetJitter > 0) &&
+        std::find(m_JitteredPlaceholders.begin(), m_JitteredPlaceholders.end(), placeholder) != m_JitteredPlaceholders.end();
+    }
 
-  // Shuffle the sequence
-  std::random_device rd;
-  std::mt19937 g(rd());
-  std::shuffle(m_RandomIndices.begin(), m_RandomIndices.end(), g);
+  // Random generator of the epoch
+  std::seed_seq seq{m_Seed, m_Epoch};
+  std::mt19937 g(seq);
+  const bool firstEpoch = (m_Epoch == 0);
+  m_Epoch++;
+
+  // Schedule the samples
+  const IndexValueType epochSize = m_EpochSize > 0 ? m_EpochSize : this->GetNumberOfSamples();
+  if (m_SamplingMode == SAMPLING_BALANCED)
+    {
+    DrawClassBalancedSamples(g, epochSize);
+    }
+  else if (m_SamplingMode == SAMPLING_WEIGHTED)
+    {
+    DrawWeightedSamples(g, epochSize);
+    }
+  else if (m_SamplingMode == SAMPLING_HARD && !firstEpoch)
+    {
+    DrawHardSamples(g, epochSize);
+    }
+  else if (m_SamplingMode == SAMPLING_UNIFORM && m_DatasetSizes.size() > 1)
+    {
+    DrawDatasetsSamples(g, epochSize);
+    }
+  else
+    {
+    ShuffleSamples(g);
+    if (epochSize != static_cast<IndexValueType>(m_RandomIndices.size()))
+      {
+      // Concatenate permutations, then truncate
+      IndexListType indices;
+      while (static_cast<IndexValueType>(indices.size()) < epochSize)
+        {
+        indices.insert(indices.end(), m_RandomIndices.begin(), m_RandomIndices.end());
+        ShuffleSamples(g);
+        }
+      indices.resize(epochSize);
+      m_RandomIndices.swap(indices);
+      }
+    }
+
+  // Samples are read in this order
+  this->SetSampleOrder(m_RandomIndices);
 
   // Call the generic method
   Superclass::GenerateData();
 
+  if (m_TelemetryStream.is_open())
+    {
+    m_TelemetryStream.flush();
+    }
+
+ }
+
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::SetLabelsPlaceholder(const std::string & name)
+ {
+  if (m_LabelsPlaceholder != name)
+    {
+    // The classes of the samples are read again from the new labels
+    m_LabelsPlaceholder = name;
+    m_ClassIndices.clear();
+    this->Modified();
+    }
+ }
+
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::SetTelemetryFileName(const std::string & fileName)
+ {
+  if (m_TelemetryFileName != fileName)
+    {
+    // The new file is opened at the next batch
+    if (m_TelemetryStream.is_open())
+      {
+      m_TelemetryStream.close();
+      }
+    m_TelemetryFileName = fileName;
+    this->Modified();
+    }
+ }
+
+/*
+ * Permutation of all the samples, with the shuffle strategy
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::ShuffleSamples(std::mt19937 & generator)
+ {
+  if (m_ShuffleMode == SHUFFLE_BLOCKS)
+    {
+    ShuffleBlocks(generator);
+    }
+  else
+    {
+    // Initial sequence 1...N
+    m_RandomIndices.resize(this->GetNumberOfSamples());
+    std::iota (std::begin(m_RandomIndices), std::end(m_RandomIndices), 0);
+    std::shuffle(m_RandomIndices.begin(), m_RandomIndices.end(), generator);
+    }
+ }
+
+/*
+ * Read the class of each sample from the labels input (first band, at the
+ * center of the patch), and list the samples of each class
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::ReadClassIndices()
+ {
+  const StringList placeholders = this->GetInputPlaceholders();
+  const auto it = std::find(placeholders.begin(), placeholders.end(), m_LabelsPlaceholder);
+  if (it == placeholders.end())
+    {
+    itkExceptionMacro("The labels placeholder \"" << m_LabelsPlaceholder << "\" is not the placeholder of an input");
+    }
+  const unsigned int labelsIndex = std::distance(placeholders.begin(), it);
+
+  // Read the whole labels image
+  ImagePointerType labelsPtr = const_cast<TInputImage*>(this->GetInput(labelsIndex));
+  const SizeType patchSize = this->GetInputReceptiveFields().at(labelsIndex);
+  RegionType region = labelsPtr->GetLargestPossibleRegion();
+  tf::PropagateRequestedRegion<TInputImage>(labelsPtr, region);
+
+  m_ClassIndices.clear();
+  typename TInputImage::IndexType index;
+  index[0] = region.GetIndex(0) + patchSize[0] / 2;
+  for (IndexValueType sample = 0 ; sample < this->GetNumberOfSamples() ; sample++)
+    {
+    index[1] = region.GetIndex(1) + sample * patchSize[1] + patchSize[1] / 2;
+    const int label = static_cast<int>(labelsPtr->GetPixel(index)[0]);
+    m_ClassIndices[label].push_back(sample);
+    }
+ }
+
+/*
+ * Draw epochSize samples: a class is drawn with the target class distribution,
+ * then the next sample of this class is taken. The samples of each class are
+ * shuffled, and shuffled again when all of them have been used.
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::DrawClassBalancedSamples(std::mt19937 & generator, IndexValueType epochSize)
+ {
+  if (m_ClassIndices.empty())
+    {
+    ReadClassIndices();
+    }
+
+  // Target class distribution
+  std::vector<IndexListType> pools;
+  std::vector<float> weights;
+  for (auto& classIndices: m_ClassIndices)
+    {
+    float weight = 1.0;
+    if (m_ClassWeights.size() > 0)
+      {
+      const auto it = m_ClassWeights.find(classIndices.first);
+      weight = (it != m_ClassWeights.end()) ? it->second : 0.0;
+      }
+    if (weight > 0)
+      {
+      pools.push_back(classIndices.second);
+      weights.push_back(weight);
+      std::shuffle(pools.back().begin(), pools.back().end(), generator);
+      }
+    }
+  if (pools.empty())
+    {
+    itkExceptionMacro("No class of the labels has a positive weight");
+    }
+
+  // Draw the samples
+  std::discrete_distribution<std::size_t> classDistribution(weights.begin(), weights.end());
+  std::vector<std::size_t> positions(pools.size(), 0);
+  m_RandomIndices.clear();
+  m_RandomIndices.reserve(epochSize);
+  for (IndexValueType n = 0 ; n < epochSize ; n++)
+    {
+    const std::size_t c = classDistribution(generator);
+    if (positions[c] == pools[c].size())
+      {
+      std::shuffle(pools[c].begin(), pools[c].end(), generator);
+      positions[c] = 0;
+      }
+    m_RandomIndices.push_back(pools[c][positions[c]++]);
+    }
+ }
+
+/*
+ * Draw epochSize samples with replacement, with probabilities proportional to
+ * the samples weights
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::DrawWeightedSamples(std::mt19937 & generator, IndexValueType epochSize)
+ {
+  if (static_cast<IndexValueType>(m_SampleWeights.size()) != this->GetNumberOfSamples())
+    {
+    itkExceptionMacro("The number of samples weights (" << m_SampleWeights.size() << ") is not the "
+        "number of samples (" << this->GetNumberOfSamples() << ")");
+    }
+  if (std::accumulate(m_SampleWeights.begin(), m_SampleWeights.end(), 0.0) <= 0)
+    {
+    itkExceptionMacro("The sum of the samples weights must be positive");
+    }
+
+  std::discrete_distribution<IndexValueType> distribution(m_SampleWeights.begin(), m_SampleWeights.end());
+  m_RandomIndices.resize(epochSize);
+  for (auto& sample: m_RandomIndices)
+    {
+    sample = distribution(generator);
+    }
+ }
+
+/*
+ * Locality-aware shuffle: the chunks order is shuffled, then the samples of
+ * the chunks are drawn randomly from a shuffle buffer
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::ShuffleBlocks(std::mt19937 & generator)
+ {
+  const IndexValueType nSamples = this->GetNumberOfSamples();
+  IndexValueType chunkSize = m_ShuffleChunkSize;
+  if (chunkSize == 0)
+    {
+    chunkSize = std::max(this->GetStreamingBlockSize(), static_cast<IndexValueType>(1));
+    }
+  const IndexValueType bufferSize = std::max(m_ShuffleBufferSize, static_cast<IndexValueType>(1));
+
+  // Shuffle the chunks
+  IndexListType chunks((nSamples + chunkSize - 1) / chunkSize);
+  std::iota (std::begin(chunks), std::end(chunks), 0);
+  std::shuffle(chunks.begin(), chunks.end(), generator);
+
+  // Draw the samples through the shuffle buffer
+  m_RandomIndices.clear();
+  m_RandomIndices.reserve(nSamples);
+  IndexListType buffer;
+  buffer.reserve(bufferSize);
+  for (auto& chunk: chunks)
+    {
+    const IndexValueType chunkEnd = std::min((chunk + 1) * chunkSize, nSamples);
+    for (IndexValueType sample = chunk * chunkSize ; sample < chunkEnd ; sample++)
+      {
+      if (static_cast<IndexValueType>(buffer.size()) < bufferSize)
+        {
+        buffer.push_back(sample);
+        }
+      else
+        {
+        // Output a random sample of the buffer, and replace it
+        std::uniform_int_distribution<std::size_t> distribution(0, buffer.size() - 1);
+        const std::size_t pos = distribution(generator);
+        m_RandomIndices.push_back(buffer[pos]);
+        buffer[pos] = sample;
+        }
+      }
+    }
+
+  // Flush the buffer
+  std::shuffle(buffer.begin(), buffer.end(), generator);
+  m_RandomIndices.insert(m_RandomIndices.end(), buffer.begin(), buffer.end());
+ }
+
+/*
+ * Copy one patch in the batch tensor, through the D4 transform and the
+ * jitter drawn for the sample
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::CopyPatchToTensor(const ImagePointerType & image, const RegionType & region, tensorflow::Tensor & tensor,
+    unsigned int inputIndex, IndexValueType elem, IndexValueType sample)
+ {
+  const bool jitter = m_JitteredInputs.size() > inputIndex && m_JitteredInputs[inputIndex];
+  if (m_AugmentationTransforms <= 1 && !jitter)
+    {
+    Superclass::CopyPatchToTensor(image, region, tensor, inputIndex, elem, sample);
+    return;
+    }
+
+  // The transform only depends on the sample, so it is the same for all inputs
+  std::seed_seq seq{m_Seed, m_Epoch, static_cast<unsigned int>(sample)};
+  std::mt19937 generator(seq);
+  std::uniform_int_distribution<unsigned int> transformDistribution(0, m_AugmentationTransforms - 1);
+  const unsigned int transform = transformDistribution(generator);
+
+  // The jitter depends on the sample and on the input
+  std::vector<float> gains, offsets;
+  if (jitter)
+    {
+    std::seed_seq jitterSeq{m_Seed, m_Epoch, static_cast<unsigned int>(sample), inputIndex + 1};
+    std::mt19937 jitterGenerator(jitterSeq);
+    std::uniform_real_distribution<float> gainDistribution(1.0 - m_GainJitter, 1.0 + m_GainJitter);
+    std::uniform_real_distribution<float> offsetDistribution(-m_OffsetJitter, m_OffsetJitter);
+    const unsigned int nBands = image->GetNumberOfComponentsPerPixel();
+    for (unsigned int band = 0 ; band < nBands ; band++)
+      {
+      gains.push_back(gainDistribution(jitterGenerator));
+      offsets.push_back(offsetDistribution(jitterGenerator));
+      }
+    }
+
+  tf::RecopyImageRegionToTensorWithTransform<TInputImage>(image, region, tensor, elem, transform, gains, offsets);
  }
 
 template <class TInputImage>
@@ -48,21 +391,324 @@ TensorflowMultisourceModelTrain<TInputImage>
 ::ProcessBatch(DictType & inputs, const IndexValueType & sampleStart,
     const IndexValueType & batchSize)
  {
-  // Populate input tensors
-  this->PopulateInputTensors(inputs, sampleStart, batchSize, m_RandomIndices);
-
   // Run the TF session here
+  const std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now();
   TensorListType outputs;
   this->RunSession(inputs, outputs);
+  const double runTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+
+  // Hard-example mining
+  if (m_SamplingMode == SAMPLING_HARD)
+    {
+    RecordSampleLosses(outputs, sampleStart, batchSize);
+    }
+
+  // Telemetry
+  UpdateBatchTelemetry(outputs, sampleStart, batchSize, runTime);
+  WriteBatchTelemetry();
+
+  // Notify the observers (e.g. checkpointing every N batches)
+  this->InvokeEvent(itk::IterationEvent());
+
+ }
+
+
+/*
+ * Draw the samples of an epoch for the hard-example mining: the hardest
+ * samples (highest losses, samples without loss first) form a pool from which
+ * a share HardExamplesRatio of the epoch is drawn, the rest being drawn from
+ * all the samples. Each part goes through shuffled permutations of its samples,
+ * so that the samples of a part are drawn as evenly as possible.
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::DrawHardSamples(std::mt19937 & generator, IndexValueType epochSize)
+ {
+  if (m_HardExamplesFraction <= 0 || m_HardExamplesFraction > 1 || m_HardExamplesRatio < 0 || m_HardExamplesRatio > 1)
+    {
+    itkExceptionMacro("The fraction of hard examples must be in ]0, 1] and their share of the epoch in [0, 1]");
+    }
+  const IndexValueType nSamples = this->GetNumberOfSamples();
+  if (static_cast<IndexValueType>(m_SampleLosses.size()) != nSamples)
+    {
+    m_SampleLosses.assign(nSamples, std::numeric_limits<float>::quiet_NaN());
+    }
+
+  // Pool of the hard examples. The samples are shuffled first, so that the
+  // ties (e.g. the samples without loss) are broken randomly.
+  IndexListType samples(nSamples);
+  std::iota(samples.begin(), samples.end(), 0);
+  std::shuffle(samples.begin(), samples.end(), generator);
+  const IndexValueType nHard = std::max(static_cast<IndexValueType>(std::round(m_HardExamplesFraction * nSamples)),
+      static_cast<IndexValueType>(1));
+  auto harder = [this](IndexValueType a, IndexValueType b)
+    {
+    const float lossA = std::isnan(m_SampleLosses[a]) ? std::numeric_limits<float>::infinity() : m_SampleLosses[a];
+    const float lossB = std::isnan(m_SampleLosses[b]) ? std::numeric_limits<float>::infinity() : m_SampleLosses[b];
+    return lossA > lossB;
+    };
+  std::nth_element(samples.begin(), samples.begin() + (nHard - 1), samples.end(), harder);
+  IndexListType hardSamples(samples.begin(), samples.begin() + nHard);
+
+  const IndexValueType nHardDrawn = std::round(m_HardExamplesRatio * epochSize);
+  m_RandomIndices.clear();
+  DrawFromPermutations(generator, hardSamples, nHardDrawn, m_RandomIndices);
+  DrawFromPermutations(generator, samples, epochSize - nHardDrawn, m_RandomIndices);
+  std::shuffle(m_RandomIndices.begin(), m_RandomIndices.end(), generator);
+ }
+
+/*
+ * Draw the samples of an epoch from the datasets, with the proportions of
+ * DatasetRatios. The datasets of the positions are interleaved with a smooth
+ * weighted round robin: at each position, each dataset earns its ratio, and
+ * the dataset with the most credit is taken and pays for it. Any window of
+ * consecutive positions, hence any batch, holds the datasets in the
+ * proportions of the ratios (up to one sample per dataset).
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::DrawDatasetsSamples(std::mt19937 & generator, IndexValueType epochSize)
+ {
+  const unsigned int nDatasets = m_DatasetSizes.size();
+  const IndexValueType nSamples = std::accumulate(m_DatasetSizes.begin(), m_DatasetSizes.end(),
+      static_cast<IndexValueType>(0));
+  if (nSamples != this->GetNumberOfSamples())
+    {
+    itkExceptionMacro("The datasets have " << nSamples << " samples, but the inputs have "
+        << this->GetNumberOfSamples() << " samples");
+    }
 
-  // Display outputs tensors
-  for (auto& o: outputs)
-  {
-    tf::PrintTensorInfos(o);
-  }
+  // Ratios of the datasets (default: sizes of the datasets)
+  std::vector<double> ratios(m_DatasetSizes.begin(), m_DatasetSizes.end());
+  if (!m_DatasetRatios.empty())
+    {
+    if (m_DatasetRatios.size() != nDatasets)
+      {
+      itkExceptionMacro("The number of datasets ratios (" << m_DatasetRatios.size() << ") is not the number of "
+          "datasets (" << nDatasets << ")");
+      }
+    ratios.assign(m_DatasetRatios.begin(), m_DatasetRatios.end());
+    }
+  double totalRatio = 0;
+  for (unsigned int d = 0 ; d < nDatasets ; d++)
+    {
+    if (ratios[d] < 0 || (ratios[d] > 0 && m_DatasetSizes[d] == 0))
+      {
+      itkExceptionMacro("The ratio of the dataset #" << d << " is " << ratios[d] << " but it has "
+          << m_DatasetSizes[d] << " samples");
+      }
+    totalRatio += ratios[d];
+    }
+  if (totalRatio <= 0)
+    {
+    itkExceptionMacro("The sum of the datasets ratios must be positive");
+    }
 
+  // Dataset of each position
+  std::vector<unsigned int> positions(epochSize);
+  std::vector<IndexValueType> counts(nDatasets, 0);
+  std::vector<double> credits(nDatasets, 0);
+  for (IndexValueType k = 0 ; k < epochSize ; k++)
+    {
+    for (unsigned int d = 0 ; d < nDatasets ; d++)
+      credits[d] += ratios[d] / totalRatio;
+    const unsigned int dataset = std::max_element(credits.begin(), credits.end()) - credits.begin();
+    credits[dataset] -= 1.0;
+    positions[k] = dataset;
+    counts[dataset]++;
+    }
+
+  // Samples of each dataset
+  std::vector<IndexListType> drawn(nDatasets);
+  IndexValueType datasetStart = 0;
+  for (unsigned int d = 0 ; d < nDatasets ; d++)
+    {
+    IndexListType samples(m_DatasetSizes[d]);
+    std::iota(samples.begin(), samples.end(), datasetStart);
+    DrawFromPermutations(generator, samples, counts[d], drawn[d]);
+    datasetStart += m_DatasetSizes[d];
+    }
+
+  m_RandomIndices.resize(epochSize);
+  std::vector<IndexValueType> next(nDatasets, 0);
+  for (IndexValueType k = 0 ; k < epochSize ; k++)
+    {
+    m_RandomIndices[k] = drawn[positions[k]][next[positions[k]]++];
+    }
+ }
+
+/*
+ * Draw count samples from shuffled permutations of a list of samples: the
+ * list is shuffled again each time all its samples have been drawn
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::DrawFromPermutations(std::mt19937 & generator, IndexListType & samples, IndexValueType count,
+    IndexListType & drawn)
+ {
+  for (IndexValueType k = 0 ; k < count ; k++)
+    {
+    if (k % samples.size() == 0)
+      {
+      std::shuffle(samples.begin(), samples.end(), generator);
+      }
+    drawn.push_back(samples[k % samples.size()]);
+    }
+ }
+
+/*
+ * Record the losses of the samples of the batch, from the output tensor
+ * SampleLossesTensor (one value per sample)
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::RecordSampleLosses(const TensorListType & outputs, const IndexValueType & sampleStart,
+    const IndexValueType & batchSize)
+ {
+  const StringList names = this->GetOutputTensors();
+  const auto it = std::find(names.begin(), names.end(), m_SampleLossesTensor);
+  if (it == names.end() || static_cast<std::size_t>(it - names.begin()) >= outputs.size())
+    {
+    itkExceptionMacro("The tensor of the samples losses \"" << m_SampleLossesTensor << "\" is not an output tensor");
+    }
+  const tensorflow::Tensor & losses = outputs[it - names.begin()];
+  if (losses.NumElements() != static_cast<tensorflow::int64>(batchSize))
+    {
+    itkExceptionMacro("The tensor of the samples losses must have one value per sample of the batch (" << batchSize
+        << " samples), but its shape is " << tf::PrintTensorShape(losses.shape()));
+    }
+
+  const IndexValueType nSamples = this->GetNumberOfSamples();
+  if (static_cast<IndexValueType>(m_SampleLosses.size()) != nSamples)
+    {
+    m_SampleLosses.assign(nSamples, std::numeric_limits<float>::quiet_NaN());
+    }
+  const IndexListType & order = this->GetSampleOrder();
+  for (IndexValueType elem = 0 ; elem < batchSize ; elem++)
+    {
+    const IndexValueType sample = order.empty() ? sampleStart + elem : order[sampleStart + elem];
+    if (losses.dtype() == tensorflow::DT_FLOAT)
+      m_SampleLosses[sample] = losses.flat<float>()(elem);
+    else if (losses.dtype() == tensorflow::DT_DOUBLE)
+      m_SampleLosses[sample] = losses.flat<double>()(elem);
+    else
+      itkExceptionMacro("TF DataType " << losses.dtype() << " of the tensor of the samples losses is not supported");
+    }
+ }
+
+/*
+ * Update the telemetry with the outputs of the batch.
+ * The moving averages are exponential, with a smoothing factor of
+ * 2 / (TelemetryWindow + 1). Until TelemetryWindow batches have been seen, the
+ * averages are the means of the values.
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::UpdateBatchTelemetry(const TensorListType & outputs, const IndexValueType & sampleStart,
+    const IndexValueType & batchSize, double runTime)
+ {
+  BatchTelemetryType & telemetry = m_LastBatchTelemetry;
+  telemetry.epoch = m_Epoch;
+  telemetry.batch = sampleStart / this->GetBatchSize();
+  telemetry.samples = batchSize;
+  telemetry.assemblyTime = this->GetBatchAssemblyTime();
+  telemetry.runTime = runTime;
+  const double batchTime = telemetry.assemblyTime + telemetry.runTime;
+  telemetry.samplesPerSecond = batchTime > 0 ? batchSize / batchTime : 0;
+
+  if (telemetry.averages.size() != outputs.size())
+    {
+    telemetry.averages.assign(outputs.size(), std::numeric_limits<double>::quiet_NaN());
+    m_NumberOfAveragedValues = 0;
+    }
+  telemetry.values.assign(outputs.size(), std::numeric_limits<double>::quiet_NaN());
+  m_NumberOfAveragedValues++;
+  const double alpha = std::max(2.0 / (m_TelemetryWindow + 1.0), 1.0 / m_NumberOfAveragedValues);
+  for (unsigned int i = 0 ; i < outputs.size() ; i++)
+    {
+    double value;
+    if (!tf::GetScalarValue(outputs[i], value))
+      continue;
+    telemetry.values[i] = value;
+    double & average = telemetry.averages[i];
+    average = std::isnan(average) ? value : average + alpha * (value - average);
+    }
  }
 
+/*
+ * Append the telemetry of the last batch to the telemetry file
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelTrain<TInputImage>
+::WriteBatchTelemetry()
+ {
+  if (m_TelemetryFileName.empty())
+    {
+    return;
+    }
+
+  const BatchTelemetryType & telemetry = m_LastBatchTelemetry;
+  const StringList names = this->GetOutputTensors();
+  const std::string::size_type dot = m_TelemetryFileName.find_last_of('.');
+  const bool json = dot != std::string::npos && m_TelemetryFileName.substr(dot) == ".json";
+  if (!m_TelemetryStream.is_open())
+    {
+    m_TelemetryStream.open(m_TelemetryFileName.c_str());
+    if (!m_TelemetryStream.is_open())
+      {
+      itkExceptionMacro("Unable to open the telemetry file " << m_TelemetryFileName);
+      }
+    if (!json)
+      {
+      m_TelemetryStream << "epoch,batch,samples,assembly_time,run_time,samples_per_second";
+      for (auto& name: names)
+        m_TelemetryStream << "," << name << "," << name << "_average";
+      m_TelemetryStream << "\n";
+      }
+    }
+
+  m_TelemetryStream << std::setprecision(9);
+  if (json)
+    {
+    // NaN is written as null
+    auto writeValue = [this](double value)
+      {
+      if (std::isnan(value))
+        m_TelemetryStream << "null";
+      else
+        m_TelemetryStream << value;
+      };
+    m_TelemetryStream << "{\"epoch\": " << telemetry.epoch << ", \"batch\": " << telemetry.batch
+        << ", \"samples\": " << telemetry.samples << ", \"assembly_time\": " << telemetry.assemblyTime
+        << ", \"run_time\": " << telemetry.runTime << ", \"samples_per_second\": " << telemetry.samplesPerSecond;
+    for (unsigned int i = 0 ; i < telemetry.values.size() && i < names.size() ; i++)
+      {
+      m_TelemetryStream << ", \"" << names[i] << "\": ";
+      writeValue(telemetry.values[i]);
+      m_TelemetryStream << ", \"" << names[i] << "_average\": ";
+      writeValue(telemetry.averages[i]);
+      }
+    m_TelemetryStream << "}\n";
+    }
+  else
+    {
+    m_TelemetryStream << telemetry.epoch << "," << telemetry.batch << "," << telemetry.samples << ","
+        << telemetry.assemblyTime << "," << telemetry.runTime << "," << telemetry.samplesPerSecond;
+    for (unsigned int i = 0 ; i < telemetry.values.size() && i < names.size() ; i++)
+      m_TelemetryStream << "," << telemetry.values[i] << "," << telemetry.averages[i];
+    m_TelemetryStream << "\n";
+    }
+  if (!m_TelemetryStream.good())
+    {
+    itkExceptionMacro("Error while writing the telemetry file " << m_TelemetryFileName);
+    }
+ }
 
 } // end namespace otb
 
@@ -16,14 +16,14 @@
 #include "itkSimpleDataObjectDecorator.h"
 
 // Base
-#include "otbTensorflowMultisourceModelBase.h"
+#include "otbTensorflowMultisourceModelValidateBase.h"
 
 // Iterate over images
-#include "otbTensorflowCommon.h"
 #include "itkImageRegionConstIterator.h"
 
 // Matrix
 #include "itkVariableSizeMatrix.h"
+#include "otbTensorflowConfusionMatrix.h"
 
 namespace otb
 {
@@ -32,23 +32,30 @@ namespace otb
  * \class TensorflowMultisourceModelValidate
  * \brief This filter validates a TensorFlow model over multiple input images.
  *
- * This filter computes confusion matrices for each output tensor.
- * The references (i.e. ground truth for validation) must be set using the
- * SetReferences() method. References must be provided in the same order as
- * their related output tensors (i.e. names and patch sizes). If the number of
- * references is not the same as output tensors, an exception is thrown.
+ * This filter computes confusion matrices for each output tensor. The
+ * references, their checks and the subset of the samples are handled by
+ * TensorflowMultisourceModelValidateBase.
+ *
+ * The output tensors of each batch are compared directly to the buffers of
+ * the references blocks (first channel of the tensor, first band of the
+ * reference). The (reference, prediction) pairs are counted in a dense
+ * confusion matrix per output, grown when new classes appear, by multiple
+ * threads (the number of threads of the filter) filling partial matrices
+ * which are then merged. In the confusion matrices returned by
+ * GetConfusionMatrix(), the classes are sorted in ascending order (see
+ * GetMapOfClasses()).
  *
  * \ingroup OTBTensorflow
  */
 template <class TInputImage>
 class ITK_EXPORT TensorflowMultisourceModelValidate :
-public TensorflowMultisourceModelLearningBase<TInputImage>
+public TensorflowMultisourceModelValidateBase<TInputImage>
 {
 public:
 
   /** Standard class typedefs. */
   typedef TensorflowMultisourceModelValidate                  Self;
-  typedef TensorflowMultisourceModelLearningBase<TInputImage> Superclass;
+  typedef TensorflowMultisourceModelValidateBase<TInputImage> Superclass;
   typedef itk::SmartPointer<Self>                             Pointer;
   typedef itk::SmartPointer<const Self>                       ConstPointer;
 
@@ -56,7 +63,7 @@ public:
   itkNewMacro(Self);
 
   /** Run-time type information (and related methods). */
-  itkTypeMacro(TensorflowMultisourceModelValidate, TensorflowMultisourceModelLearningBase);
+  itkTypeMacro(TensorflowMultisourceModelValidate, TensorflowMultisourceModelValidateBase);
 
   /** Images typedefs */
   typedef typename Superclass::ImageType         ImageType;
@@ -64,7 +71,8 @@ public:
   typedef typename Superclass::RegionType        RegionType;
   typedef typename Superclass::SizeType          SizeType;
   typedef typename Superclass::IndexType         IndexType;
-  typedef std::vector<ImagePointerType>          ImageListType;
+  typedef typename Superclass::ImageListType     ImageListType;
+  typedef typename Superclass::ReferenceValueType ReferenceValueType;
 
   /* Typedefs for parameters */
   typedef typename Superclass::DictType          DictType;
@@ -75,19 +83,14 @@ public:
   typedef typename Superclass::IndexListType     IndexListType;
 
   /* Typedefs for validation */
-  typedef unsigned long                            CountValueType;
-  typedef int                                      LabelValueType;
-  typedef std::map<LabelValueType, CountValueType> MapType;
-  typedef std::map<LabelValueType, MapType>        MatMapType;
+  typedef tf::DenseConfusionMatrix::CountValueType CountValueType;
+  typedef tf::DenseConfusionMatrix::LabelValueType LabelValueType;
   typedef std::map<LabelValueType, LabelValueType> MapOfClassesType;
   typedef std::vector<MapOfClassesType>            MapOfClassesListType;
   typedef itk::VariableSizeMatrix<CountValueType>  ConfMatType;
   typedef std::vector<ConfMatType>                 ConfMatListType;
   typedef itk::ImageRegionConstIterator<ImageType> IteratorType;
-
-  /** Set and Get the input references */
-  virtual void SetInputReferences(ImageListType input);
-  ImagePointerType GetInputReference(unsigned int index);
+  typedef std::vector<tf::DenseConfusionMatrix>    AccumulatorListType;
 
   /** Get the confusion matrix */
   const ConfMatType GetConfusionMatrix(unsigned int target);
@@ -99,23 +102,37 @@ protected:
   TensorflowMultisourceModelValidate();
   virtual ~TensorflowMultisourceModelValidate() {};
 
-  void GenerateOutputInformation(void);
   void GenerateData();
-  void ProcessBatch(DictType & inputs, const IndexValueType & sampleStart,
-      const IndexValueType & batchSize);
+  void AccumulateBatch(unsigned int target, const tensorflow::Tensor & output, tensorflow::int64 nChannels,
+      const ReferenceValueType * refValues, unsigned int refComponents, unsigned long nPixels);
 
 private:
   TensorflowMultisourceModelValidate(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
-  ImageListType              m_References;              // The references images
+  // Count the (reference, prediction) pairs of an output tensor, whatever the type of its values
+  struct AccumulateFunctor
+  {
+    tf::DenseConfusionMatrix & matrix;
+    const ReferenceValueType * refValues;
+    unsigned int               refComponents;
+    tensorflow::int64          nChannels;
+    unsigned long              nPixels;
+    unsigned int               nThreads;
+
+    template<class TPredicted>
+    void operator()(const TPredicted * predictions) const
+    {
+      tf::AccumulateConfusionMatrix(matrix, refValues, refComponents, predictions, nChannels, nPixels, nThreads);
+    }
+  };
 
   // Read only
   ConfMatListType            m_ConfusionMatrices;       // Confusion matrix
   MapOfClassesListType       m_MapsOfClasses;           // Maps of classes
 
   // Internal
-  std::vector<MatMapType>    m_ConfMatMaps;             // Accumulators
+  AccumulatorListType        m_Accumulators;            // Dense confusion matrices, accumulated over the batches
 
 }; // end class
 
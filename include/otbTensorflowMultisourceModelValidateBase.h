@@ -0,0 +1,130 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowMultisourceModelValidateBase_h
+#define otbTensorflowMultisourceModelValidateBase_h
+
+#include "itkProcessObject.h"
+#include "itkNumericTraits.h"
+#include "itkSimpleDataObjectDecorator.h"
+
+// Base
+#include "otbTensorflowMultisourceModelLearningBase.h"
+
+// Tensor utils
+#include "otbTensorflowCommon.h"
+
+namespace otb
+{
+
+/**
+ * \class TensorflowMultisourceModelValidateBase
+ * \brief This filter is the base class for the validation filters.
+ *
+ * The references (i.e. ground truth for validation) must be set using the
+ * SetInputReferences() method. References must be provided in the same order
+ * as their related output tensors (i.e. names and patch sizes). If the number
+ * of references is not the same as output tensors, an exception is thrown.
+ *
+ * For each batch, the session is run, the size of each output tensor is
+ * checked against the expression field of its reference, and the reference
+ * values of the samples of the batch are gathered. The output tensor and the
+ * reference values are then passed to AccumulateBatch(), a pure virtual
+ * method that the validation filters implement to update their metrics.
+ * ApplyToOutputValues() calls a functor with the values of an output tensor,
+ * typed after its TF DataType.
+ *
+ * A subset of the samples can be set with SetSampleSubset(): only these
+ * samples are then validated, and the reference values of each batch are
+ * gathered sample by sample.
+ *
+ * \ingroup OTBTensorflow
+ */
+template <class TInputImage>
+class ITK_EXPORT TensorflowMultisourceModelValidateBase :
+public TensorflowMultisourceModelLearningBase<TInputImage>
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef TensorflowMultisourceModelValidateBase              Self;
+  typedef TensorflowMultisourceModelLearningBase<TInputImage> Superclass;
+  typedef itk::SmartPointer<Self>                             Pointer;
+  typedef itk::SmartPointer<const Self>                       ConstPointer;
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(TensorflowMultisourceModelValidateBase, TensorflowMultisourceModelLearningBase);
+
+  /** Images typedefs */
+  typedef typename Superclass::ImageType         ImageType;
+  typedef typename Superclass::ImagePointerType  ImagePointerType;
+  typedef typename Superclass::RegionType        RegionType;
+  typedef typename Superclass::SizeType          SizeType;
+  typedef typename Superclass::IndexType         IndexType;
+  typedef std::vector<ImagePointerType>          ImageListType;
+  typedef typename ImageType::InternalPixelType  ReferenceValueType;
+
+  /* Typedefs for parameters */
+  typedef typename Superclass::DictType          DictType;
+  typedef typename Superclass::StringList        StringList;
+  typedef typename Superclass::SizeListType      SizeListType;
+  typedef typename Superclass::TensorListType    TensorListType;
+  typedef typename Superclass::IndexValueType    IndexValueType;
+  typedef typename Superclass::IndexListType     IndexListType;
+
+  /* Typedefs for profiling */
+  typedef typename Superclass::ProfilerType          ProfilerType;
+  typedef typename Superclass::ProfilerArgumentsType ProfilerArgumentsType;
+
+  /** Set and Get the input references */
+  virtual void SetInputReferences(ImageListType input);
+  ImagePointerType GetInputReference(unsigned int index);
+  unsigned int GetNumberOfInputReferences() const { return m_References.size(); }
+
+  /** Subset of the samples to validate (empty: all the samples) */
+  void SetSampleSubset(const IndexListType & subset) { m_SampleSubset = subset; this->Modified(); }
+  const IndexListType & GetSampleSubset() const      { return m_SampleSubset; }
+
+protected:
+  TensorflowMultisourceModelValidateBase();
+  virtual ~TensorflowMultisourceModelValidateBase() {};
+
+  virtual void GenerateOutputInformation(void);
+  virtual void GenerateData();
+  virtual void ProcessBatch(DictType & inputs, const IndexValueType & sampleStart,
+      const IndexValueType & batchSize);
+
+  /** Update the metrics of the target-th output with an output tensor of a
+   * batch. The tensor has nChannels values per pixel, and the references
+   * refComponents values per pixel, for nPixels pixels. */
+  virtual void AccumulateBatch(unsigned int target, const tensorflow::Tensor & output, tensorflow::int64 nChannels,
+      const ReferenceValueType * refValues, unsigned int refComponents, unsigned long nPixels) = 0;
+
+  /** Call functor(values) with the values of the target-th output tensor,
+   * typed after its DataType. An exception is thrown if the DataType is not
+   * supported. */
+  template<class TFunctor>
+  void ApplyToOutputValues(unsigned int target, const tensorflow::Tensor & output, const TFunctor & functor);
+
+private:
+  TensorflowMultisourceModelValidateBase(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  ImageListType              m_References;              // The references images
+  IndexListType              m_SampleSubset;            // Subset of the samples to validate
+
+}; // end class
+
+
+} // end namespace otb
+
+#include "otbTensorflowMultisourceModelValidateBase.hxx"
+
+#endif
@@ -0,0 +1,195 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowMultisourceModelValidateBase_txx
+#define otbTensorflowMultisourceModelValidateBase_txx
+
+#include "otbTensorflowMultisourceModelValidateBase.h"
+
+namespace otb
+{
+
+template <class TInputImage>
+TensorflowMultisourceModelValidateBase<TInputImage>
+::TensorflowMultisourceModelValidateBase()
+ {
+ }
+
+
+template <class TInputImage>
+void
+TensorflowMultisourceModelValidateBase<TInputImage>
+::GenerateOutputInformation()
+ {
+  Superclass::GenerateOutputInformation();
+
+  // Check that there is some reference
+  const unsigned int nbOfRefs = m_References.size();
+  if (nbOfRefs == 0)
+    {
+    itkExceptionMacro("No reference is set");
+    }
+
+  // Check the number of references
+  SizeListType outputPatchSizes = this->GetOutputExpressionFields();
+  if (nbOfRefs != outputPatchSizes.size())
+    {
+    itkExceptionMacro("There is " << nbOfRefs << " references but only " <<
+                      outputPatchSizes.size() << " output patch sizes");
+    }
+
+  // Check reference image infos
+  for (unsigned int i = 0 ; i < nbOfRefs ; i++)
+    {
+    const SizeType outputPatchSize = outputPatchSizes[i];
+    const RegionType refRegion = m_References[i]->GetLargestPossibleRegion();
+    if (refRegion.GetSize(0) != outputPatchSize[0])
+      {
+      itkExceptionMacro("Reference image " << i << " width is " << refRegion.GetSize(0) <<
+                        " but patch size (x) is " << outputPatchSize[0]);
+      }
+    if (refRegion.GetSize(1) != this->GetNumberOfSamples() * outputPatchSize[1])
+      {
+      itkExceptionMacro("Reference image " << i << " height is " << refRegion.GetSize(1) <<
+                        " but patch size (y) is " << outputPatchSize[1] <<
+                        " which is not consistent with the number of samples (" << this->GetNumberOfSamples() << ")");
+      }
+    }
+
+ }
+
+
+/*
+ * Set the references images
+ */
+template<class TInputImage>
+void
+TensorflowMultisourceModelValidateBase<TInputImage>
+::SetInputReferences(ImageListType input)
+ {
+  m_References = input;
+ }
+
+/*
+ * Retrieve the i-th reference image
+ * An exception is thrown if it doesn't exist.
+ */
+template<class TInputImage>
+typename TensorflowMultisourceModelValidateBase<TInputImage>::ImagePointerType
+TensorflowMultisourceModelValidateBase<TInputImage>
+::GetInputReference(unsigned int index)
+ {
+  if (m_References.size() <= index || !m_References[index])
+    {
+    itkExceptionMacro("There is no input reference #" << index);
+    }
+
+  return m_References[index];
+ }
+
+/**
+ * Run all the batches, on the subset of the samples if set
+ */
+template <class TInputImage>
+void
+TensorflowMultisourceModelValidateBase<TInputImage>
+::GenerateData()
+ {
+  this->SetSampleOrder(m_SampleSubset);
+  Superclass::GenerateData();
+ }
+
+
+template <class TInputImage>
+void
+TensorflowMultisourceModelValidateBase<TInputImage>
+::ProcessBatch(DictType & inputs, const IndexValueType & sampleStart,
+    const IndexValueType & batchSize)
+ {
+  // Run the TF session here
+  TensorListType outputs;
+  this->RunSession(inputs, outputs);
+
+  // Perform the validation
+  if (outputs.size() != m_References.size())
+    {
+    itkExceptionMacro("There is " << outputs.size() << " outputs returned after session run, " <<
+                      "but " << m_References.size() << " reference(s) set");
+    }
+  ProfilerType * profiler = this->GetProfiler();
+  typename ProfilerType::TimePointType startTime;
+  if (profiler)
+    {
+    startTime = profiler->Now();
+    }
+  SizeListType outputEFSizes = this->GetOutputExpressionFields();
+  std::vector<ReferenceValueType> refBuffer;
+  for (unsigned int refIdx = 0 ; refIdx < outputs.size() ; refIdx++)
+    {
+    // Check the size of the output tensor
+    const SizeType outputFOESize = outputEFSizes[refIdx];
+    const tensorflow::Tensor & output = outputs[refIdx];
+    const unsigned long nPixels = outputFOESize[0] * outputFOESize[1] * batchSize;
+    const tensorflow::int64 nChannels = tf::GetNumberOfChannelsForOutputTensor(output);
+    if (output.NumElements() != static_cast<tensorflow::int64>(nPixels * nChannels))
+      {
+      itkExceptionMacro("Number of elements in the output tensor #" << refIdx << " is " << output.NumElements() <<
+          " but the reference region has " << nPixels << " pixels (tensor shape: " <<
+          tf::PrintTensorShape(output.shape()) << ")");
+      }
+
+    // Retrieve the reference values of the samples of the batch
+    ImagePointerType reference = m_References[refIdx];
+    const unsigned int refComponents = reference->GetNumberOfComponentsPerPixel();
+    const ReferenceValueType * refValues = this->GetBatchPatchesValues(reference, outputFOESize,
+        sampleStart, batchSize, refBuffer);
+
+    // Update the metrics
+    this->AccumulateBatch(refIdx, output, nChannels, refValues, refComponents, nPixels);
+    }
+
+  // Profiling: the outputs are compared to the references
+  if (profiler)
+    {
+    ProfilerArgumentsType args;
+    this->AddTensorsToProfilerArguments("output", outputs, args);
+    profiler->AddEvent("writeback", this->GetNameOfClass(), startTime, profiler->Now(), args);
+    }
+
+ }
+
+/*
+ * Dispatch the values of an output tensor to a functor, after their type
+ */
+template <class TInputImage>
+template <class TFunctor>
+void
+TensorflowMultisourceModelValidateBase<TInputImage>
+::ApplyToOutputValues(unsigned int target, const tensorflow::Tensor & output, const TFunctor & functor)
+ {
+  const tensorflow::DataType dt = output.dtype();
+  if (dt == tensorflow::DT_FLOAT)
+    functor(output.flat<float>().data());
+  else if (dt == tensorflow::DT_DOUBLE)
+    functor(output.flat<double>().data());
+  else if (dt == tensorflow::DT_INT64)
+    functor(output.flat<tensorflow::int64>().data());
+  else if (dt == tensorflow::DT_INT32)
+    functor(output.flat<int>().data());
+  else if (dt == tensorflow::DT_UINT8)
+    functor(output.flat<unsigned char>().data());
+  else
+    itkExceptionMacro("TF DataType " << dt << " of the output tensor #" << target << " is not supported for validation");
+ }
+
+} // end namespace otb
+
+
+#endif
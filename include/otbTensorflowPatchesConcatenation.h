@@ -0,0 +1,90 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowPatchesConcatenation_h
+#define otbTensorflowPatchesConcatenation_h
+
+#include "itkImageSource.h"
+
+// STD
+#include <vector>
+
+namespace otb
+{
+
+/**
+ * \class TensorflowPatchesConcatenation
+ * \brief This source concatenates images of patches in the y dimension, without copying them.
+ *
+ * The images of patches (e.g. one per dataset, read from patches files) must
+ * have the same width and number of components. The output image has their
+ * rows one after the other, in the order of AddImage(): its samples are the
+ * samples of the first image, then the samples of the second one, etc.
+ *
+ * The images are not inputs of the pipeline: only the images that intersect
+ * the requested region of the output are updated, over the rows of the
+ * region, when the output is generated. A sample is then read from one image
+ * only, like with a single image of patches.
+ *
+ * \ingroup OTBTensorflow
+ */
+template <class TImage>
+class ITK_EXPORT TensorflowPatchesConcatenation :
+public itk::ImageSource<TImage>
+{
+
+public:
+
+  /** Standard class typedefs. */
+  typedef TensorflowPatchesConcatenation             Self;
+  typedef itk::ImageSource<TImage>                   Superclass;
+  typedef itk::SmartPointer<Self>                    Pointer;
+  typedef itk::SmartPointer<const Self>              ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(TensorflowPatchesConcatenation, itk::ImageSource);
+
+  /** Images typedefs */
+  typedef TImage                                     ImageType;
+  typedef typename ImageType::Pointer                ImagePointerType;
+  typedef typename ImageType::RegionType             RegionType;
+  typedef std::vector<ImagePointerType>              ImageListType;
+
+  /** Add an image at the end of the concatenation */
+  void AddImage(ImagePointerType image) { m_Images.push_back(image); this->Modified(); }
+
+  /** Images of the concatenation */
+  const ImageListType & GetImages() const { return m_Images; }
+
+protected:
+  TensorflowPatchesConcatenation() {};
+  virtual ~TensorflowPatchesConcatenation() {};
+
+  virtual void GenerateOutputInformation(void);
+
+  virtual void GenerateData();
+
+private:
+  TensorflowPatchesConcatenation(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  ImageListType         m_Images;          // Concatenated images
+
+}; // end class
+
+
+} // end namespace otb
+
+#include "otbTensorflowPatchesConcatenation.hxx"
+
+#endif
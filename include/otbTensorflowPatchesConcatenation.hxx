@@ -0,0 +1,103 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowPatchesConcatenation_txx
+#define otbTensorflowPatchesConcatenation_txx
+
+#include "otbTensorflowPatchesConcatenation.h"
+#include "itkImageAlgorithm.h"
+#include "otbTensorflowCommon.h"
+
+#include <algorithm>
+
+namespace otb
+{
+
+/**
+ * Check that the images can be concatenated, and set the output image
+ * information
+ */
+template <class TImage>
+void
+TensorflowPatchesConcatenation<TImage>
+::GenerateOutputInformation()
+ {
+  if (m_Images.empty())
+    {
+    itkExceptionMacro("No image to concatenate");
+    }
+
+  RegionType region;
+  unsigned int nComponents = 0;
+  for (unsigned int i = 0 ; i < m_Images.size() ; i++)
+    {
+    m_Images[i]->UpdateOutputInformation();
+    const RegionType imageRegion = m_Images[i]->GetLargestPossibleRegion();
+    if (i == 0)
+      {
+      region.SetSize(0, imageRegion.GetSize(0));
+      nComponents = m_Images[i]->GetNumberOfComponentsPerPixel();
+      }
+    else if (imageRegion.GetSize(0) != region.GetSize(0) || m_Images[i]->GetNumberOfComponentsPerPixel() != nComponents)
+      {
+      itkExceptionMacro("The image #" << i << " has a width of " << imageRegion.GetSize(0) << " and "
+          << m_Images[i]->GetNumberOfComponentsPerPixel() << " components, but the image #0 has a width of "
+          << region.GetSize(0) << " and " << nComponents << " components");
+      }
+    region.SetSize(1, region.GetSize(1) + imageRegion.GetSize(1));
+    }
+
+  ImageType * outputPtr = this->GetOutput();
+  outputPtr->SetLargestPossibleRegion(region);
+  outputPtr->SetNumberOfComponentsPerPixel(nComponents);
+ }
+
+/**
+ * Copy the rows of the requested region from the images that intersect it
+ */
+template <class TImage>
+void
+TensorflowPatchesConcatenation<TImage>
+::GenerateData()
+ {
+  this->AllocateOutputs();
+
+  ImageType * outputPtr = this->GetOutput();
+  const RegionType outRegion = outputPtr->GetBufferedRegion();
+  const long firstRow = outRegion.GetIndex(1);
+  const long endRow = firstRow + outRegion.GetSize(1);
+
+  long imageFirstRow = 0;
+  for (auto& image: m_Images)
+    {
+    const long imageEndRow = imageFirstRow + image->GetLargestPossibleRegion().GetSize(1);
+    const long rowStart = std::max(firstRow, imageFirstRow);
+    const long rowEnd = std::min(endRow, imageEndRow);
+    if (rowStart < rowEnd)
+      {
+      // Rows of the image, and of the output
+      RegionType imageRegion = outRegion;
+      imageRegion.SetIndex(1, rowStart - imageFirstRow);
+      imageRegion.SetSize(1, rowEnd - rowStart);
+      RegionType region = outRegion;
+      region.SetIndex(1, rowStart);
+      region.SetSize(1, rowEnd - rowStart);
+
+      tf::PropagateRequestedRegion<TImage>(image, imageRegion);
+      itk::ImageAlgorithm::Copy(image.GetPointer(), outputPtr, imageRegion, region);
+      }
+    imageFirstRow = imageEndRow;
+    }
+ }
+
+} // end namespace otb
+
+
+#endif
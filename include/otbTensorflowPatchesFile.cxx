@@ -0,0 +1,535 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbTensorflowPatchesFile.h"
+
+#include "itkMacro.h"
+#include "itkImageRegionIterator.h"
+#include "otbTensorflowCommon.h"
+
+// Compression
+#ifdef OTB_TF_USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef OTB_TF_USE_ZSTD
+#include <zstd.h>
+#endif
+
+// STD
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace otb {
+namespace tf {
+
+namespace
+{
+
+//
+// Convert a value to the type of the values of the file.
+// Values are rounded and clamped when the type is an integer type.
+//
+template<class TValue, class TInput>
+TValue ConvertToPatchesFileValue(TInput value)
+{
+  if (!std::is_integral<TValue>::value)
+    return static_cast<TValue>(value);
+  const double rounded = std::round(static_cast<double>(value));
+  if (!(rounded > std::numeric_limits<TValue>::lowest()))
+    return std::numeric_limits<TValue>::lowest();
+  if (rounded > std::numeric_limits<TValue>::max())
+    return std::numeric_limits<TValue>::max();
+  return static_cast<TValue>(rounded);
+}
+
+//
+// Convert values to an array of values of type TFileValue
+//
+template<class TFileValue, class TValue>
+std::string EncodeValues(const TValue * values, unsigned long long count)
+{
+  std::string data(count * sizeof(TFileValue), 0);
+  TFileValue * fileValues = reinterpret_cast<TFileValue*>(&data[0]);
+  for (unsigned long long i = 0 ; i < count ; i++)
+    fileValues[i] = ConvertToPatchesFileValue<TFileValue>(values[i]);
+  return data;
+}
+
+//
+// Convert an array of values of type TFileValue to values
+//
+template<class TFileValue, class TValue>
+void DecodeValues(const char * data, TValue * values, unsigned long long count)
+{
+  const TFileValue * fileValues = reinterpret_cast<const TFileValue*>(data);
+  for (unsigned long long i = 0 ; i < count ; i++)
+    values[i] = static_cast<TValue>(fileValues[i]);
+}
+
+} // end anonymous namespace
+
+//
+// Magic, version and size of the header
+//
+const std::string PATCHES_FILE_MAGIC = "OTBTFPAT";
+const unsigned int PATCHES_FILE_VERSION = 1;
+const unsigned int PATCHES_FILE_HEADER_SIZE = 64;
+
+//
+// Get the data type of the values from their C++ type
+//
+template<class TValue>
+unsigned int GetPatchesFileDataType()
+{
+  if (std::is_same<TValue, float>::value)
+    return PATCHES_FILE_FLOAT32;
+  if (std::is_same<TValue, double>::value)
+    return PATCHES_FILE_FLOAT64;
+  if (std::is_same<TValue, unsigned char>::value)
+    return PATCHES_FILE_UINT8;
+  if (std::is_same<TValue, short>::value)
+    return PATCHES_FILE_INT16;
+  if (std::is_same<TValue, unsigned short>::value)
+    return PATCHES_FILE_UINT16;
+  if (std::is_same<TValue, int>::value)
+    return PATCHES_FILE_INT32;
+  if (std::is_same<TValue, unsigned int>::value)
+    return PATCHES_FILE_UINT32;
+  itkGenericExceptionMacro("Unsupported data type for the patches file");
+}
+
+//
+// Get the size (bytes) of one value of the given data type
+//
+unsigned int GetPatchesFileDataTypeSize(unsigned int dataType)
+{
+  switch (dataType)
+  {
+  case PATCHES_FILE_FLOAT32: return 4;
+  case PATCHES_FILE_FLOAT64: return 8;
+  case PATCHES_FILE_UINT8:   return 1;
+  case PATCHES_FILE_INT16:   return 2;
+  case PATCHES_FILE_UINT16:  return 2;
+  case PATCHES_FILE_INT32:   return 4;
+  case PATCHES_FILE_UINT32:  return 4;
+  }
+  itkGenericExceptionMacro("Unknown data type " << dataType << " in the patches file");
+}
+
+//
+// Get the name of the given data type
+//
+std::string GetPatchesFileDataTypeName(unsigned int dataType)
+{
+  switch (dataType)
+  {
+  case PATCHES_FILE_FLOAT32: return "float32";
+  case PATCHES_FILE_FLOAT64: return "float64";
+  case PATCHES_FILE_UINT8:   return "uint8";
+  case PATCHES_FILE_INT16:   return "int16";
+  case PATCHES_FILE_UINT16:  return "uint16";
+  case PATCHES_FILE_INT32:   return "int32";
+  case PATCHES_FILE_UINT32:  return "uint32";
+  }
+  return "unknown";
+}
+
+//
+// Get the size (bytes) of one sample
+//
+unsigned long long GetPatchesFileSampleSize(const PatchesFileHeader & header)
+{
+  return (unsigned long long) header.sizeX * header.sizeY * header.numberOfComponents *
+      GetPatchesFileDataTypeSize(header.dataType);
+}
+
+//
+// Get the name of the given compression
+//
+std::string GetPatchesFileCompressionName(unsigned int compression)
+{
+  switch (compression)
+  {
+  case PATCHES_FILE_NONE: return "none";
+  case PATCHES_FILE_LZ4:  return "lz4";
+  case PATCHES_FILE_ZSTD: return "zstd";
+  }
+  return "unknown";
+}
+
+//
+// Get the number of chunks of a compressed file
+//
+unsigned long long GetPatchesFileNumberOfChunks(const PatchesFileHeader & header)
+{
+  if (header.compression == PATCHES_FILE_NONE || header.chunkSamples == 0)
+    return 0;
+  return (header.numberOfSamples + header.chunkSamples - 1) / header.chunkSamples;
+}
+
+//
+// Compress one chunk of samples
+//
+std::string CompressPatchesFileChunk(unsigned int compression, const char * data, std::size_t size)
+{
+  std::string compressed;
+  switch (compression)
+  {
+#ifdef OTB_TF_USE_LZ4
+  case PATCHES_FILE_LZ4:
+  {
+    compressed.resize(LZ4_compressBound(size));
+    const int compressedSize = LZ4_compress_default(data, &compressed[0], size, compressed.size());
+    if (compressedSize <= 0)
+    {
+      itkGenericExceptionMacro("LZ4 compression failed");
+    }
+    compressed.resize(compressedSize);
+    return compressed;
+  }
+#endif
+#ifdef OTB_TF_USE_ZSTD
+  case PATCHES_FILE_ZSTD:
+  {
+    compressed.resize(ZSTD_compressBound(size));
+    const std::size_t compressedSize = ZSTD_compress(&compressed[0], compressed.size(), data, size, 3);
+    if (ZSTD_isError(compressedSize))
+    {
+      itkGenericExceptionMacro("zstd compression failed: " << ZSTD_getErrorName(compressedSize));
+    }
+    compressed.resize(compressedSize);
+    return compressed;
+  }
+#endif
+  }
+  itkGenericExceptionMacro("The compression " << GetPatchesFileCompressionName(compression) << " is not available. "
+      "The module must be built with OTB_TF_USE_LZ4 or OTB_TF_USE_ZSTD.");
+}
+
+//
+// Decompress one chunk of samples in a buffer of the size of the uncompressed chunk
+//
+void DecompressPatchesFileChunk(unsigned int compression, const char * data, std::size_t size,
+    char * buffer, std::size_t bufferSize)
+{
+  switch (compression)
+  {
+#ifdef OTB_TF_USE_LZ4
+  case PATCHES_FILE_LZ4:
+  {
+    const int decompressedSize = LZ4_decompress_safe(data, buffer, size, bufferSize);
+    if (decompressedSize < 0 || (std::size_t) decompressedSize != bufferSize)
+    {
+      itkGenericExceptionMacro("LZ4 decompression failed: the chunk is corrupted");
+    }
+    return;
+  }
+#endif
+#ifdef OTB_TF_USE_ZSTD
+  case PATCHES_FILE_ZSTD:
+  {
+    const std::size_t decompressedSize = ZSTD_decompress(buffer, bufferSize, data, size);
+    if (ZSTD_isError(decompressedSize) || decompressedSize != bufferSize)
+    {
+      itkGenericExceptionMacro("zstd decompression failed: the chunk is corrupted");
+    }
+    return;
+  }
+#endif
+  }
+  itkGenericExceptionMacro("The compression " << GetPatchesFileCompressionName(compression) << " is not available. "
+      "The module must be built with OTB_TF_USE_LZ4 or OTB_TF_USE_ZSTD.");
+}
+
+//
+// Get the smallest data type that holds the given values exactly.
+// Values that are all integers are stored in uint8, int16 or uint16 when they
+// fit in their range.
+//
+template<class TValue>
+unsigned int GetCompactPatchesFileDataType(const TValue * values, unsigned long long count)
+{
+  const unsigned int nativeDataType = GetPatchesFileDataType<TValue>();
+  if (count == 0)
+    return nativeDataType;
+
+  double minimum = values[0];
+  double maximum = values[0];
+  for (unsigned long long i = 0 ; i < count ; i++)
+  {
+    const double value = values[i];
+    if (value != std::floor(value))
+      return nativeDataType;
+    minimum = std::min(minimum, value);
+    maximum = std::max(maximum, value);
+  }
+
+  if (minimum >= 0 && maximum <= std::numeric_limits<unsigned char>::max())
+    return PATCHES_FILE_UINT8;
+  if (minimum >= std::numeric_limits<short>::lowest() && maximum <= std::numeric_limits<short>::max())
+    return PATCHES_FILE_INT16;
+  if (minimum >= 0 && maximum <= std::numeric_limits<unsigned short>::max())
+    return PATCHES_FILE_UINT16;
+  return nativeDataType;
+}
+
+//
+// Convert values to an array of values of the given data type
+//
+template<class TValue>
+std::string EncodePatchesFileValues(const TValue * values, unsigned long long count, unsigned int dataType)
+{
+  switch (dataType)
+  {
+  case PATCHES_FILE_FLOAT32: return EncodeValues<float>(values, count);
+  case PATCHES_FILE_FLOAT64: return EncodeValues<double>(values, count);
+  case PATCHES_FILE_UINT8:   return EncodeValues<unsigned char>(values, count);
+  case PATCHES_FILE_INT16:   return EncodeValues<short>(values, count);
+  case PATCHES_FILE_UINT16:  return EncodeValues<unsigned short>(values, count);
+  case PATCHES_FILE_INT32:   return EncodeValues<int>(values, count);
+  case PATCHES_FILE_UINT32:  return EncodeValues<unsigned int>(values, count);
+  }
+  itkGenericExceptionMacro("Unknown data type " << dataType);
+}
+
+//
+// Convert an array of values of the given data type to values
+//
+template<class TValue>
+void DecodePatchesFileValues(const char * data, unsigned int dataType, TValue * values, unsigned long long count)
+{
+  switch (dataType)
+  {
+  case PATCHES_FILE_FLOAT32: DecodeValues<float>(data, values, count);          break;
+  case PATCHES_FILE_FLOAT64: DecodeValues<double>(data, values, count);         break;
+  case PATCHES_FILE_UINT8:   DecodeValues<unsigned char>(data, values, count);  break;
+  case PATCHES_FILE_INT16:   DecodeValues<short>(data, values, count);          break;
+  case PATCHES_FILE_UINT16:  DecodeValues<unsigned short>(data, values, count); break;
+  case PATCHES_FILE_INT32:   DecodeValues<int>(data, values, count);            break;
+  case PATCHES_FILE_UINT32:  DecodeValues<unsigned int>(data, values, count);   break;
+  default:
+    itkGenericExceptionMacro("Unknown data type " << dataType);
+  }
+}
+
+//
+// Write the header.
+// Fields are copied at their offset in a buffer of PATCHES_FILE_HEADER_SIZE
+// bytes, so that the layout does not depend on the padding of the struct.
+// Values are written with the byte order of the host, which is assumed to be
+// little-endian.
+//
+void WritePatchesFileHeader(std::ostream & os, const PatchesFileHeader & header)
+{
+  char buffer[PATCHES_FILE_HEADER_SIZE];
+  std::memset(buffer, 0, PATCHES_FILE_HEADER_SIZE);
+  std::memcpy(buffer,      PATCHES_FILE_MAGIC.c_str(),   8);
+  std::memcpy(buffer + 8,  &header.version,              4);
+  std::memcpy(buffer + 12, &header.dataType,             4);
+  std::memcpy(buffer + 16, &header.numberOfSamples,      8);
+  std::memcpy(buffer + 24, &header.sizeY,                4);
+  std::memcpy(buffer + 28, &header.sizeX,                4);
+  std::memcpy(buffer + 32, &header.numberOfComponents,   4);
+  std::memcpy(buffer + 36, &header.compression,          4);
+  std::memcpy(buffer + 40, &header.dataOffset,           8);
+  std::memcpy(buffer + 48, &header.indexOffset,          8);
+  std::memcpy(buffer + 56, &header.chunkSamples,         4);
+  os.write(buffer, PATCHES_FILE_HEADER_SIZE);
+}
+
+//
+// Read and check the header of a patches file
+//
+PatchesFileHeader ReadPatchesFileHeader(const std::string & fileName)
+{
+  std::ifstream ifs(fileName.c_str(), std::ios::binary | std::ios::ate);
+  if (!ifs.is_open())
+  {
+    itkGenericExceptionMacro("Unable to open the patches file " << fileName);
+  }
+  const unsigned long long fileSize = ifs.tellg();
+  ifs.seekg(0);
+
+  char buffer[PATCHES_FILE_HEADER_SIZE];
+  ifs.read(buffer, PATCHES_FILE_HEADER_SIZE);
+  if (!ifs.good() || std::string(buffer, 8) != PATCHES_FILE_MAGIC)
+  {
+    itkGenericExceptionMacro("The file " << fileName << " is not a patches file");
+  }
+
+  PatchesFileHeader header;
+  std::memcpy(&header.version,            buffer + 8,  4);
+  std::memcpy(&header.dataType,           buffer + 12, 4);
+  std::memcpy(&header.numberOfSamples,    buffer + 16, 8);
+  std::memcpy(&header.sizeY,              buffer + 24, 4);
+  std::memcpy(&header.sizeX,              buffer + 28, 4);
+  std::memcpy(&header.numberOfComponents, buffer + 32, 4);
+  std::memcpy(&header.compression,        buffer + 36, 4);
+  std::memcpy(&header.dataOffset,         buffer + 40, 8);
+  std::memcpy(&header.indexOffset,        buffer + 48, 8);
+  std::memcpy(&header.chunkSamples,       buffer + 56, 4);
+
+  if (header.version != PATCHES_FILE_VERSION)
+  {
+    itkGenericExceptionMacro("Unsupported version " << header.version << " of the patches file " << fileName);
+  }
+
+  if (header.compression != PATCHES_FILE_NONE && header.chunkSamples == 0)
+  {
+    itkGenericExceptionMacro("The compressed patches file " << fileName << " has no chunks");
+  }
+
+  // Check that the file holds all the samples (or the chunks table), and the index
+  unsigned long long dataEnd = header.dataOffset + header.numberOfSamples * GetPatchesFileSampleSize(header);
+  if (header.compression != PATCHES_FILE_NONE)
+    dataEnd = header.dataOffset + GetPatchesFileNumberOfChunks(header) * 2 * sizeof(unsigned long long);
+  if (dataEnd > fileSize || (header.indexOffset > 0 &&
+      header.indexOffset + header.numberOfSamples * 2 * sizeof(double) > fileSize))
+  {
+    itkGenericExceptionMacro("The patches file " << fileName << " is truncated");
+  }
+
+  return header;
+}
+
+//
+// Write a patches file from an image of patches concatenated in the y dimension,
+// like the outputs of the TensorflowSampler. The image must be buffered.
+// The values are converted to TValue (rounded and clamped for integer types).
+// When positions are given (one per sample), they are written in the index.
+// When a compression is set, the chunks of chunkSamples samples are converted
+// and compressed in parallel, then written in order.
+//
+template<class TValue, class TImage>
+void WritePatchesFile(const std::string & fileName, const typename TImage::Pointer image,
+    const typename TImage::SizeType & patchSize,
+    const std::vector<typename TImage::PointType> & positions,
+    unsigned int compression, unsigned int chunkSamples)
+{
+  typedef typename TImage::InternalPixelType InternalPixelType;
+
+  const typename TImage::RegionType region = image->GetBufferedRegion();
+  if (region != image->GetLargestPossibleRegion() || region.GetSize(0) != patchSize[0] ||
+      region.GetSize(1) % patchSize[1] != 0)
+  {
+    itkGenericExceptionMacro("The image of patches must be buffered, and its size must be a multiple of the patch size");
+  }
+  if (compression != PATCHES_FILE_NONE && chunkSamples == 0)
+  {
+    itkGenericExceptionMacro("The number of samples per chunk must be at least 1");
+  }
+
+  PatchesFileHeader header;
+  header.version = PATCHES_FILE_VERSION;
+  header.dataType = GetPatchesFileDataType<TValue>();
+  header.numberOfSamples = region.GetSize(1) / patchSize[1];
+  header.sizeY = patchSize[1];
+  header.sizeX = patchSize[0];
+  header.numberOfComponents = image->GetNumberOfComponentsPerPixel();
+  header.compression = compression;
+  header.dataOffset = PATCHES_FILE_HEADER_SIZE;
+  header.indexOffset = 0;
+  header.chunkSamples = (compression != PATCHES_FILE_NONE ? chunkSamples : 0);
+  if (positions.size() > 0 && positions.size() != header.numberOfSamples)
+  {
+    itkGenericExceptionMacro("The number of positions (" << positions.size() << ") is not the "
+        "number of samples (" << header.numberOfSamples << ")");
+  }
+
+  std::ofstream ofs(fileName.c_str(), std::ios::binary);
+  if (!ofs.is_open())
+  {
+    itkGenericExceptionMacro("Unable to open the patches file " << fileName);
+  }
+  WritePatchesFileHeader(ofs, header);
+
+  const unsigned long long nValues = (unsigned long long) header.sizeX * header.sizeY * header.numberOfComponents;
+  const InternalPixelType * values = image->GetBufferPointer();
+  unsigned long long offset = header.dataOffset;
+  if (compression == PATCHES_FILE_NONE)
+  {
+    // Samples, written one by one
+    std::vector<TValue> sample(nValues);
+    for (unsigned long long i = 0 ; i < header.numberOfSamples ; i++)
+    {
+      const InternalPixelType * sampleValues = values + i * nValues;
+      for (unsigned long long j = 0 ; j < nValues ; j++)
+        sample[j] = ConvertToPatchesFileValue<TValue>(sampleValues[j]);
+      ofs.write(reinterpret_cast<const char*>(sample.data()), nValues * sizeof(TValue));
+    }
+    offset += header.numberOfSamples * nValues * sizeof(TValue);
+  }
+  else
+  {
+    // Chunks table, written once the chunks are compressed
+    const unsigned long long nChunks = GetPatchesFileNumberOfChunks(header);
+    std::vector<unsigned long long> table(2 * nChunks, 0);
+    ofs.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(unsigned long long));
+    offset += table.size() * sizeof(unsigned long long);
+
+    // Chunks, compressed by groups of nThreads
+    const unsigned int nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<std::string> compressedChunks(nThreads);
+    for (unsigned long long first = 0 ; first < nChunks ; first += nThreads)
+    {
+      const unsigned long long count = std::min((unsigned long long) nThreads, nChunks - first);
+      ParallelFor(count, nThreads, [&](unsigned long begin, unsigned long end)
+      {
+        std::vector<TValue> chunk;
+        for (unsigned long c = begin ; c < end ; c++)
+        {
+          const unsigned long long sampleStart = (first + c) * chunkSamples;
+          const unsigned long long sampleEnd = std::min(sampleStart + chunkSamples, header.numberOfSamples);
+          const InternalPixelType * chunkValues = values + sampleStart * nValues;
+          chunk.resize((sampleEnd - sampleStart) * nValues);
+          for (unsigned long long j = 0 ; j < chunk.size() ; j++)
+            chunk[j] = ConvertToPatchesFileValue<TValue>(chunkValues[j]);
+          compressedChunks[c] = CompressPatchesFileChunk(compression,
+              reinterpret_cast<const char*>(chunk.data()), chunk.size() * sizeof(TValue));
+        }
+      });
+      for (unsigned long long c = 0 ; c < count ; c++)
+      {
+        table[2 * (first + c)] = offset;
+        table[2 * (first + c) + 1] = compressedChunks[c].size();
+        ofs.write(compressedChunks[c].data(), compressedChunks[c].size());
+        offset += compressedChunks[c].size();
+      }
+    }
+
+    ofs.seekp(header.dataOffset);
+    ofs.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(unsigned long long));
+    ofs.seekp(offset);
+  }
+
+  // Index
+  if (positions.size() > 0)
+  {
+    header.indexOffset = offset;
+    for (auto& position: positions)
+    {
+      const double coordinates[2] = {position[0], position[1]};
+      ofs.write(reinterpret_cast<const char*>(coordinates), 2 * sizeof(double));
+    }
+    ofs.seekp(0);
+    WritePatchesFileHeader(ofs, header);
+  }
+
+  if (!ofs.good())
+  {
+    itkGenericExceptionMacro("Error while writing the patches file " << fileName);
+  }
+}
+
+} // end namespace tf
+} // end namespace otb
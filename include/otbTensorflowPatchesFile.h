@@ -0,0 +1,150 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowPatchesFile_h
+#define otbTensorflowPatchesFile_h
+
+// STD
+#include <string>
+#include <vector>
+#include <fstream>
+
+//
+// Binary patches file
+//
+// A patches file stores the N samples of one source, as a NHWC array of
+// values which can be mapped in memory:
+//
+//  -a header of 64 bytes (little-endian):
+//     char[8]  magic "OTBTFPAT"
+//     uint32   version
+//     uint32   data type of the values (PatchesFileDataType)
+//     uint64   number of samples (N)
+//     uint32   patch size y (H)
+//     uint32   patch size x (W)
+//     uint32   number of components (C)
+//     uint32   compression (PatchesFileCompression)
+//     uint64   offset of the samples (bytes)
+//     uint64   offset of the index (bytes, 0 if the file has no index)
+//     uint32   number of samples per chunk (compressed files)
+//     uint32   reserved
+//  -the samples, contiguous, each one being a HxWxC array of values
+//  -the index (optional): the coordinates (x, y) of the center of each
+//   sample, as two float64
+//
+// Since the samples are stored in row-major order, the samples section is
+// also the buffer of the image of patches concatenated in the y dimension
+// (W columns, N*H rows, C components).
+// Labels are stored in their own patches file, with 1x1x1 samples.
+//
+// In compressed files, the samples are grouped in chunks of a fixed number of
+// samples (the last chunk can be smaller), each chunk being compressed
+// independently. The samples section then starts with the chunks table (for
+// each chunk, its offset and its compressed size, as two uint64), followed by
+// the compressed chunks. A chunk can be decompressed without reading the
+// others, so samples can be accessed randomly.
+// LZ4 and zstd compressions are available when the module is built with
+// OTB_TF_USE_LZ4 and OTB_TF_USE_ZSTD.
+//
+namespace otb {
+namespace tf {
+
+// Data types of the values
+enum PatchesFileDataType
+{
+  PATCHES_FILE_FLOAT32 = 0,
+  PATCHES_FILE_FLOAT64 = 1,
+  PATCHES_FILE_UINT8   = 2,
+  PATCHES_FILE_INT16   = 3,
+  PATCHES_FILE_UINT16  = 4,
+  PATCHES_FILE_INT32   = 5,
+  PATCHES_FILE_UINT32  = 6
+};
+
+// Compressions of the samples
+enum PatchesFileCompression
+{
+  PATCHES_FILE_NONE = 0,
+  PATCHES_FILE_LZ4  = 1,
+  PATCHES_FILE_ZSTD = 2
+};
+
+// Header of a patches file
+struct PatchesFileHeader
+{
+  unsigned int       version;            // Version of the format
+  unsigned int       dataType;           // Data type of the values
+  unsigned long long numberOfSamples;    // Number of samples
+  unsigned int       sizeY;              // Patch size y
+  unsigned int       sizeX;              // Patch size x
+  unsigned int       numberOfComponents; // Number of components
+  unsigned int       compression;        // Compression of the samples
+  unsigned long long dataOffset;         // Offset of the samples, or of the chunks table (bytes)
+  unsigned long long indexOffset;        // Offset of the index (bytes, 0 if no index)
+  unsigned int       chunkSamples;       // Number of samples per chunk (compressed files)
+};
+
+// Magic, version and size of the header
+extern const std::string PATCHES_FILE_MAGIC;
+extern const unsigned int PATCHES_FILE_VERSION;
+extern const unsigned int PATCHES_FILE_HEADER_SIZE;
+
+// Get the data type of the values from their C++ type
+template<class TValue>
+unsigned int GetPatchesFileDataType();
+
+// Get the size (bytes) of one value of the given data type
+unsigned int GetPatchesFileDataTypeSize(unsigned int dataType);
+
+// Get the name of the given data type
+std::string GetPatchesFileDataTypeName(unsigned int dataType);
+
+// Get the size (bytes) of one sample
+unsigned long long GetPatchesFileSampleSize(const PatchesFileHeader & header);
+
+// Get the name of the given compression
+std::string GetPatchesFileCompressionName(unsigned int compression);
+
+// Get the number of chunks of a compressed file
+unsigned long long GetPatchesFileNumberOfChunks(const PatchesFileHeader & header);
+
+// Compress / decompress one chunk of samples
+std::string CompressPatchesFileChunk(unsigned int compression, const char * data, std::size_t size);
+void DecompressPatchesFileChunk(unsigned int compression, const char * data, std::size_t size,
+    char * buffer, std::size_t bufferSize);
+
+// Get the smallest data type that holds the given values exactly (uint8, int16,
+// uint16, or the data type of TValue)
+template<class TValue>
+unsigned int GetCompactPatchesFileDataType(const TValue * values, unsigned long long count);
+
+// Convert values to an array of values of the given data type, and back
+template<class TValue>
+std::string EncodePatchesFileValues(const TValue * values, unsigned long long count, unsigned int dataType);
+template<class TValue>
+void DecodePatchesFileValues(const char * data, unsigned int dataType, TValue * values, unsigned long long count);
+
+// Write / read the header
+void WritePatchesFileHeader(std::ostream & os, const PatchesFileHeader & header);
+PatchesFileHeader ReadPatchesFileHeader(const std::string & fileName);
+
+// Write a patches file from an image of patches concatenated in the y dimension
+template<class TValue, class TImage>
+void WritePatchesFile(const std::string & fileName, const typename TImage::Pointer image,
+    const typename TImage::SizeType & patchSize,
+    const std::vector<typename TImage::PointType> & positions,
+    unsigned int compression = PATCHES_FILE_NONE, unsigned int chunkSamples = 256);
+
+} // end namespace tf
+} // end namespace otb
+
+#include "otbTensorflowPatchesFile.cxx"
+
+#endif
@@ -0,0 +1,122 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowPatchesFileReader_h
+#define otbTensorflowPatchesFileReader_h
+
+#include "itkImageSource.h"
+
+// Patches file
+#include "otbTensorflowPatchesFile.h"
+
+namespace otb
+{
+
+/**
+ * \class TensorflowPatchesFileReader
+ * \brief This source reads a binary patches file (see otbTensorflowPatchesFile.h).
+ *
+ * The output image is the image of patches concatenated in the y dimension,
+ * like the output of the PatchesExtraction application: its width is the
+ * patch size x, and its height is the patch size y times the number of samples.
+ * It can be used as an input of the learning filters instead of a tall image
+ * read with GDAL.
+ *
+ * The file is mapped in memory. Since the samples are stored in row-major
+ * order, the requested region of the output is copied from the mapping with
+ * one memcpy (or one per row when it does not span the whole width). Values
+ * are converted when the data type of the file is not the pixel type of the
+ * output image. Pages are loaded by the operating system when they are
+ * accessed, so the size of the file is not bounded by the RAM.
+ *
+ * When the file is compressed, the chunks that intersect the requested region
+ * are decompressed in parallel. Requested regions should then be aligned on
+ * the chunks (e.g. the blocks of the learning filters in streaming mode
+ * should have the size of the chunks), since a chunk is decompressed each
+ * time one of its samples is requested.
+ *
+ * \ingroup OTBTensorflow
+ */
+template <class TOutputImage>
+class ITK_EXPORT TensorflowPatchesFileReader :
+public itk::ImageSource<TOutputImage>
+{
+
+public:
+
+  /** Standard class typedefs. */
+  typedef TensorflowPatchesFileReader                Self;
+  typedef itk::ImageSource<TOutputImage>             Superclass;
+  typedef itk::SmartPointer<Self>                    Pointer;
+  typedef itk::SmartPointer<const Self>              ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(TensorflowPatchesFileReader, itk::ImageSource);
+
+  /** Images typedefs */
+  typedef TOutputImage                               ImageType;
+  typedef typename ImageType::InternalPixelType      InternalPixelType;
+  typedef typename ImageType::RegionType             RegionType;
+  typedef typename ImageType::SizeType               SizeType;
+  typedef typename ImageType::PointType              PointType;
+  typedef std::vector<PointType>                     PointListType;
+
+  /** File name */
+  void SetFileName(const std::string & fileName);
+  itkGetMacro(FileName, std::string);
+
+  /** Header of the file (available after UpdateOutputInformation()) */
+  const tf::PatchesFileHeader & GetHeader() const { return m_Header; }
+
+  /** Patch size (available after UpdateOutputInformation()) */
+  SizeType GetPatchSize() const;
+
+  /** Centers of the samples, read from the index of the file (empty if the file has no index) */
+  PointListType GetPositions();
+
+protected:
+  TensorflowPatchesFileReader();
+  virtual ~TensorflowPatchesFileReader();
+
+  virtual void GenerateOutputInformation(void);
+
+  virtual void GenerateData();
+  virtual void GenerateDataFromChunks(const RegionType & region, InternalPixelType * buffer);
+
+  virtual void MapFile();
+  virtual void UnmapFile();
+
+  template<class TValue>
+  void CopyValues(const char * data, InternalPixelType * buffer, unsigned long long count);
+  void CopyFileValues(const char * data, InternalPixelType * buffer, unsigned long long count);
+
+private:
+  TensorflowPatchesFileReader(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  std::string           m_FileName;        // Name of the patches file
+  tf::PatchesFileHeader m_Header;          // Header of the file
+
+  // Internal
+  const char *          m_MappedData;      // Mapping of the file (nullptr if not mapped)
+  unsigned long long    m_MappedSize;      // Size of the mapping (bytes)
+  std::vector<char>     m_FileContent;     // Content of the file, on platforms without mmap
+
+}; // end class
+
+
+} // end namespace otb
+
+#include "otbTensorflowPatchesFileReader.hxx"
+
+#endif
@@ -0,0 +1,339 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowPatchesFileReader_txx
+#define otbTensorflowPatchesFileReader_txx
+
+#include "otbTensorflowPatchesFileReader.h"
+#include "itkImageRegionIterator.h"
+#include "otbTensorflowCommon.h"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace otb
+{
+
+template <class TOutputImage>
+TensorflowPatchesFileReader<TOutputImage>
+::TensorflowPatchesFileReader()
+ {
+  m_MappedData = nullptr;
+  m_MappedSize = 0;
+  std::memset(&m_Header, 0, sizeof(m_Header));
+ }
+
+template <class TOutputImage>
+TensorflowPatchesFileReader<TOutputImage>
+::~TensorflowPatchesFileReader()
+ {
+  UnmapFile();
+ }
+
+template <class TOutputImage>
+void
+TensorflowPatchesFileReader<TOutputImage>
+::SetFileName(const std::string & fileName)
+ {
+  if (m_FileName != fileName)
+    {
+    UnmapFile();
+    m_FileName = fileName;
+    this->Modified();
+    }
+ }
+
+template <class TOutputImage>
+typename TensorflowPatchesFileReader<TOutputImage>::SizeType
+TensorflowPatchesFileReader<TOutputImage>
+::GetPatchSize() const
+ {
+  SizeType patchSize;
+  patchSize[0] = m_Header.sizeX;
+  patchSize[1] = m_Header.sizeY;
+  return patchSize;
+ }
+
+/**
+ * Map the file in memory (read only)
+ */
+template <class TOutputImage>
+void
+TensorflowPatchesFileReader<TOutputImage>
+::MapFile()
+ {
+  if (m_MappedData != nullptr)
+    return;
+
+#if defined(_WIN32)
+  // No mmap: the file is loaded in memory
+  std::ifstream ifs(m_FileName.c_str(), std::ios::binary | std::ios::ate);
+  if (!ifs.is_open())
+    {
+    itkExceptionMacro("Unable to open the patches file " << m_FileName);
+    }
+  m_FileContent.resize(ifs.tellg());
+  ifs.seekg(0);
+  ifs.read(m_FileContent.data(), m_FileContent.size());
+  if (!ifs.good())
+    {
+    itkExceptionMacro("Error while reading the patches file " << m_FileName);
+    }
+  m_MappedData = m_FileContent.data();
+  m_MappedSize = m_FileContent.size();
+#else
+  const int fd = open(m_FileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    {
+    itkExceptionMacro("Unable to open the patches file " << m_FileName);
+    }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0)
+    {
+    close(fd);
+    itkExceptionMacro("Unable to get the size of the patches file " << m_FileName);
+    }
+  void * data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    {
+    itkExceptionMacro("Unable to map the patches file " << m_FileName << " in memory");
+    }
+  m_MappedData = static_cast<const char*>(data);
+  m_MappedSize = fileStat.st_size;
+#endif
+ }
+
+/**
+ * Release the mapping of the file
+ */
+template <class TOutputImage>
+void
+TensorflowPatchesFileReader<TOutputImage>
+::UnmapFile()
+ {
+  if (m_MappedData == nullptr)
+    return;
+
+#if defined(_WIN32)
+  m_FileContent.clear();
+  m_FileContent.shrink_to_fit();
+#else
+  munmap(const_cast<char*>(m_MappedData), m_MappedSize);
+#endif
+  m_MappedData = nullptr;
+  m_MappedSize = 0;
+ }
+
+/**
+ * Read the header, map the file, and set the output image information
+ */
+template <class TOutputImage>
+void
+TensorflowPatchesFileReader<TOutputImage>
+::GenerateOutputInformation()
+ {
+  if (m_FileName.empty())
+    {
+    itkExceptionMacro("No patches file name is set");
+    }
+
+  // The file could have been rewritten since it has been mapped
+  UnmapFile();
+  m_Header = tf::ReadPatchesFileHeader(m_FileName);
+  MapFile();
+
+  // Image of patches concatenated in the y dimension
+  RegionType region;
+  region.SetSize(0, m_Header.sizeX);
+  region.SetSize(1, m_Header.sizeY * m_Header.numberOfSamples);
+
+  ImageType * outputPtr = this->GetOutput();
+  outputPtr->SetLargestPossibleRegion(region);
+  outputPtr->SetNumberOfComponentsPerPixel(m_Header.numberOfComponents);
+ }
+
+/**
+ * Copy count values of type TValue to the buffer
+ */
+template <class TOutputImage>
+template <class TValue>
+void
+TensorflowPatchesFileReader<TOutputImage>
+::CopyValues(const char * data, InternalPixelType * buffer, unsigned long long count)
+ {
+  const TValue * values = reinterpret_cast<const TValue*>(data);
+  if (std::is_same<TValue, InternalPixelType>::value)
+    {
+    std::memcpy(buffer, values, count * sizeof(TValue));
+    }
+  else
+    {
+    for (unsigned long long i = 0 ; i < count ; i++)
+      buffer[i] = static_cast<InternalPixelType>(values[i]);
+    }
+ }
+
+/**
+ * Copy count values of the data type of the file to the buffer
+ */
+template <class TOutputImage>
+void
+TensorflowPatchesFileReader<TOutputImage>
+::CopyFileValues(const char * data, InternalPixelType * buffer, unsigned long long count)
+ {
+  switch (m_Header.dataType)
+    {
+    case tf::PATCHES_FILE_FLOAT32: CopyValues<float>(data, buffer, count);          break;
+    case tf::PATCHES_FILE_FLOAT64: CopyValues<double>(data, buffer, count);         break;
+    case tf::PATCHES_FILE_UINT8:   CopyValues<unsigned char>(data, buffer, count);  break;
+    case tf::PATCHES_FILE_INT16:   CopyValues<short>(data, buffer, count);          break;
+    case tf::PATCHES_FILE_UINT16:  CopyValues<unsigned short>(data, buffer, count); break;
+    case tf::PATCHES_FILE_INT32:   CopyValues<int>(data, buffer, count);            break;
+    case tf::PATCHES_FILE_UINT32:  CopyValues<unsigned int>(data, buffer, count);   break;
+    default:
+      itkExceptionMacro("Unknown data type " << m_Header.dataType << " in the patches file " << m_FileName);
+    }
+ }
+
+/**
+ * Copy the requested region from the mapping of the file
+ */
+template <class TOutputImage>
+void
+TensorflowPatchesFileReader<TOutputImage>
+::GenerateData()
+ {
+  this->AllocateOutputs();
+  MapFile();
+
+  ImageType * outputPtr = this->GetOutput();
+  const RegionType region = outputPtr->GetBufferedRegion();
+  const unsigned long long nComponents = m_Header.numberOfComponents;
+  const unsigned long long valueSize = tf::GetPatchesFileDataTypeSize(m_Header.dataType);
+  const unsigned long long rowValues = region.GetSize(0) * nComponents;
+
+  // Rows are contiguous in the file when the region spans the whole width
+  unsigned long long nRows = region.GetSize(1);
+  unsigned long long nValues = rowValues;
+  if (region.GetSize(0) == m_Header.sizeX)
+    {
+    nValues *= nRows;
+    nRows = 1;
+    }
+
+  InternalPixelType * buffer = outputPtr->GetBufferPointer();
+  if (m_Header.compression != tf::PATCHES_FILE_NONE)
+    {
+    GenerateDataFromChunks(region, buffer);
+    return;
+    }
+
+  for (unsigned long long row = 0 ; row < nRows ; row++)
+    {
+    const unsigned long long y = region.GetIndex(1) + row;
+    const unsigned long long offset = m_Header.dataOffset +
+        ((y * m_Header.sizeX + region.GetIndex(0)) * nComponents) * valueSize;
+    CopyFileValues(m_MappedData + offset, buffer + row * rowValues, nValues);
+    }
+ }
+
+/**
+ * Copy the requested region from the compressed chunks of the file.
+ * The chunks that intersect the region are decompressed in parallel.
+ */
+template <class TOutputImage>
+void
+TensorflowPatchesFileReader<TOutputImage>
+::GenerateDataFromChunks(const RegionType & region, InternalPixelType * buffer)
+ {
+  const unsigned long long nComponents = m_Header.numberOfComponents;
+  const unsigned long long valueSize = tf::GetPatchesFileDataTypeSize(m_Header.dataType);
+  const unsigned long long rowValues = region.GetSize(0) * nComponents;
+  const unsigned long long sampleSize = tf::GetPatchesFileSampleSize(m_Header);
+  const unsigned long long chunkRows = (unsigned long long) m_Header.chunkSamples * m_Header.sizeY;
+  const unsigned long long firstRow = region.GetIndex(1);
+  const unsigned long long endRow = firstRow + region.GetSize(1);
+  const unsigned long long firstChunk = firstRow / chunkRows;
+  const unsigned long long nChunks = (endRow - 1) / chunkRows - firstChunk + 1;
+
+  tf::ParallelFor(nChunks, this->GetNumberOfThreads(), [&](unsigned long begin, unsigned long end)
+  {
+    std::vector<char> chunk;
+    for (unsigned long k = begin ; k < end ; k++)
+      {
+      // Chunk entry in the table
+      const unsigned long long c = firstChunk + k;
+      unsigned long long entry[2];
+      std::memcpy(entry, m_MappedData + m_Header.dataOffset + c * sizeof(entry), sizeof(entry));
+      if (entry[0] + entry[1] > m_MappedSize)
+        {
+        itkExceptionMacro("The chunk #" << c << " of the patches file " << m_FileName << " is truncated");
+        }
+
+      // Decompress
+      const unsigned long long chunkSamples = std::min((unsigned long long) m_Header.chunkSamples,
+          m_Header.numberOfSamples - c * m_Header.chunkSamples);
+      chunk.resize(chunkSamples * sampleSize);
+      tf::DecompressPatchesFileChunk(m_Header.compression, m_MappedData + entry[0], entry[1],
+          chunk.data(), chunk.size());
+
+      // Copy the rows of the chunk that are in the region
+      const unsigned long long chunkFirstRow = c * chunkRows;
+      const unsigned long long rowStart = std::max(firstRow, chunkFirstRow);
+      const unsigned long long rowEnd = std::min(endRow, chunkFirstRow + chunkSamples * m_Header.sizeY);
+      for (unsigned long long y = rowStart ; y < rowEnd ; y++)
+        {
+        const unsigned long long offset = (((y - chunkFirstRow) * m_Header.sizeX + region.GetIndex(0)) * nComponents) * valueSize;
+        CopyFileValues(chunk.data() + offset, buffer + (y - firstRow) * rowValues, rowValues);
+        }
+      }
+  });
+ }
+
+/**
+ * Centers of the samples, read from the index of the file
+ */
+template <class TOutputImage>
+typename TensorflowPatchesFileReader<TOutputImage>::PointListType
+TensorflowPatchesFileReader<TOutputImage>
+::GetPositions()
+ {
+  this->UpdateOutputInformation();
+
+  PointListType positions;
+  if (m_Header.indexOffset == 0)
+    return positions;
+
+  positions.resize(m_Header.numberOfSamples);
+  for (unsigned long long i = 0 ; i < m_Header.numberOfSamples ; i++)
+    {
+    double coordinates[2];
+    std::memcpy(coordinates, m_MappedData + m_Header.indexOffset + i * sizeof(coordinates), sizeof(coordinates));
+    positions[i][0] = coordinates[0];
+    positions[i][1] = coordinates[1];
+    }
+  return positions;
+ }
+
+} // end namespace otb
+
+
+#endif
@@ -0,0 +1,468 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbTensorflowProfiler.h"
+
+#include "itkMacro.h"
+
+// STD
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+
+namespace otb
+{
+
+namespace
+{
+
+//
+// Escape a string for JSON
+//
+std::string EscapeJSON(const std::string & str)
+{
+  std::stringstream ss;
+  for (auto& c: str)
+  {
+    switch (c)
+    {
+    case '"':  ss << "\\\""; break;
+    case '\\': ss << "\\\\"; break;
+    case '\n': ss << "\\n";  break;
+    case '\t': ss << "\\t";  break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20)
+        ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+      else
+        ss << c;
+    }
+  }
+  return ss.str();
+}
+
+//
+// Return the value at the given percentile (nearest rank) of sorted values
+//
+double GetPercentile(const std::vector<double> & sortedValues, double percentile)
+{
+  if (sortedValues.size() == 0)
+    return 0;
+  std::size_t rank = std::ceil(percentile / 100.0 * sortedValues.size());
+  rank = std::max(rank, (std::size_t) 1);
+  return sortedValues[std::min(rank, sortedValues.size()) - 1];
+}
+
+} // end anonymous namespace
+
+TensorflowProfiler
+::TensorflowProfiler() : m_TraceEmpty(true)
+ {
+  Reset();
+ }
+
+TensorflowProfiler
+::~TensorflowProfiler()
+ {
+  // Do not throw from the destructor: FinishChromeTrace() reports the errors
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (m_Trace.is_open())
+  {
+    m_Trace << "\n]}\n";
+    m_Trace.close();
+  }
+ }
+
+//
+// Microseconds elapsed between the time origin and the given time
+//
+double
+TensorflowProfiler
+::ToMicroseconds(const TimePointType & time) const
+ {
+  return std::chrono::duration<double, std::micro>(time - m_Origin).count();
+ }
+
+//
+// Record an event
+//
+void
+TensorflowProfiler
+::AddEvent(const std::string & name, const std::string & category,
+    const TimePointType & start, const TimePointType & end, const ArgumentsType & args)
+ {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+
+  // Lane of the current thread
+  const std::thread::id threadId = std::this_thread::get_id();
+  if (m_Threads.count(threadId) == 0)
+  {
+    const unsigned int newId = m_Threads.size();
+    m_Threads[threadId] = GetLane("Thread #" + std::to_string(newId));
+  }
+
+  EventType event;
+  event.name = name;
+  event.category = category;
+  event.start = ToMicroseconds(start);
+  event.duration = ToMicroseconds(end) - event.start;
+  event.lane = m_Threads[threadId];
+  event.args = args;
+  RecordEvent(event);
+ }
+
+//
+// Record an event on a named lane, with times in microseconds
+//
+void
+TensorflowProfiler
+::AddEvent(const std::string & name, const std::string & category,
+    double start, double duration, const std::string & lane, const ArgumentsType & args)
+ {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+
+  EventType event;
+  event.name = name;
+  event.category = category;
+  event.start = start;
+  event.duration = duration;
+  event.lane = GetLane(lane);
+  event.args = args;
+  RecordEvent(event);
+ }
+
+//
+// Update the statistics of the kind of the event, and write the event in the
+// trace file. The durations are sampled with a reservoir of MaxDurationSamples
+// values, so that each duration has the same probability to be kept.
+// The mutex must be locked.
+//
+void
+TensorflowProfiler
+::RecordEvent(const EventType & event)
+ {
+  StatisticsType & stats = m_Statistics[{event.category, event.name}];
+  if (stats.count == 0)
+  {
+    stats.total = 0;
+    stats.first = event.start;
+    stats.last = event.start + event.duration;
+  }
+  stats.count++;
+  stats.total += event.duration;
+  stats.first = std::min(stats.first, event.start);
+  stats.last = std::max(stats.last, event.start + event.duration);
+  if (stats.durations.size() < MaxDurationSamples)
+  {
+    stats.durations.push_back(event.duration);
+  }
+  else
+  {
+    const unsigned long index = std::uniform_int_distribution<unsigned long>(0, stats.count - 1)(m_Generator);
+    if (index < MaxDurationSamples)
+      stats.durations[index] = event.duration;
+  }
+
+  if (!m_Trace.is_open())
+    return;
+
+  // Complete event ("ph":"X") with timestamps in microseconds
+  if (!m_TraceEmpty)
+    m_Trace << ",";
+  m_TraceEmpty = false;
+  m_Trace << "\n{\"name\":\"" << EscapeJSON(event.name) << "\","
+      << "\"cat\":\"" << EscapeJSON(event.category) << "\","
+      << "\"ph\":\"X\","
+      << "\"ts\":" << event.start << ","
+      << "\"dur\":" << event.duration << ","
+      << "\"pid\":0,"
+      << "\"tid\":" << event.lane << ","
+      << "\"args\":{";
+  bool first = true;
+  for (auto& arg: event.args)
+  {
+    if (!first)
+      m_Trace << ",";
+    m_Trace << "\"" << EscapeJSON(arg.first) << "\":\"" << EscapeJSON(arg.second) << "\"";
+    first = false;
+  }
+  m_Trace << "}}";
+ }
+
+//
+// Write the name of a lane in the trace file (metadata event).
+// The mutex must be locked.
+//
+void
+TensorflowProfiler
+::WriteLane(unsigned int lane)
+ {
+  if (!m_Trace.is_open())
+    return;
+
+  if (!m_TraceEmpty)
+    m_Trace << ",";
+  m_TraceEmpty = false;
+  m_Trace << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << lane << ","
+      << "\"args\":{\"name\":\"" << EscapeJSON(m_Lanes[lane]) << "\"}}";
+ }
+
+//
+// Get the index of a lane from its name. The lane is created if needed.
+// The mutex must be locked.
+//
+unsigned int
+TensorflowProfiler
+::GetLane(const std::string & laneName)
+ {
+  for (unsigned int i = 0 ; i < m_Lanes.size() ; i++)
+  {
+    if (m_Lanes[i] == laneName)
+      return i;
+  }
+  m_Lanes.push_back(laneName);
+  WriteLane(m_Lanes.size() - 1);
+  return m_Lanes.size() - 1;
+ }
+
+//
+// Accumulate the number of pixels processed
+//
+void
+TensorflowProfiler
+::AddProcessedPixels(unsigned long count)
+ {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_ProcessedPixels += count;
+ }
+
+//
+// Accumulate the number of samples processed
+//
+void
+TensorflowProfiler
+::AddProcessedSamples(unsigned long count)
+ {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_ProcessedSamples += count;
+ }
+
+//
+// Number of recorded events
+//
+unsigned long
+TensorflowProfiler
+::GetNumberOfEvents() const
+ {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  unsigned long count = 0;
+  for (auto& entry: m_Statistics)
+    count += entry.second.count;
+  return count;
+ }
+
+//
+// Remove all statistics and counters.
+// The events already written in the trace file are kept.
+//
+void
+TensorflowProfiler
+::Reset()
+ {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  m_Origin = ClockType::now();
+  m_Statistics.clear();
+  m_Generator.seed();
+  m_Threads.clear();
+  m_Lanes.clear();
+  m_ProcessedPixels = 0;
+  m_ProcessedSamples = 0;
+ }
+
+//
+// Open the trace file. The events recorded from now on are written in the
+// file, in the Chrome trace-event JSON format, with the names of the lanes.
+//
+void
+TensorflowProfiler
+::StartChromeTrace(const std::string & fileName)
+ {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (m_Trace.is_open())
+  {
+    itkExceptionMacro("The trace file " << m_TraceFileName << " is already open");
+  }
+
+  m_Trace.open(fileName.c_str());
+  if (!m_Trace.is_open())
+  {
+    itkExceptionMacro("Unable to open the trace file " << fileName);
+  }
+  m_TraceFileName = fileName;
+  m_TraceEmpty = true;
+
+  m_Trace << std::fixed << std::setprecision(3);
+  m_Trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for (unsigned int i = 0 ; i < m_Lanes.size() ; i++)
+    WriteLane(i);
+ }
+
+//
+// Complete and close the trace file
+//
+void
+TensorflowProfiler
+::FinishChromeTrace()
+ {
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  if (!m_Trace.is_open())
+    return;
+
+  m_Trace << "\n]}\n";
+  m_Trace.close();
+  if (m_Trace.fail())
+  {
+    m_Trace.clear();
+    itkExceptionMacro("Error while writing the trace file " << m_TraceFileName);
+  }
+ }
+
+//
+// Latency statistics of the events, grouped by category and name, and throughput.
+// The throughput is computed over the time spanned by all events.
+// Events of the excluded categories are ignored.
+//
+std::string
+TensorflowProfiler
+::GetSummary(const CategorySetType & excludedCategories) const
+ {
+  unsigned long processedPixels, processedSamples;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    processedPixels = m_ProcessedPixels;
+    processedSamples = m_ProcessedSamples;
+  }
+  StatisticsMapType statistics;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (auto& entry: m_Statistics)
+    {
+      if (excludedCategories.count(entry.first.first) == 0)
+        statistics.insert(entry);
+    }
+  }
+
+  // Time span
+  double first = statistics.size() > 0 ? statistics.begin()->second.first : 0;
+  double last = first;
+  for (auto& entry: statistics)
+  {
+    first = std::min(first, entry.second.first);
+    last = std::max(last, entry.second.last);
+  }
+
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2);
+  ss << std::left << std::setw(48) << "Event" << std::right
+      << std::setw(10) << "Count"
+      << std::setw(14) << "Total (ms)"
+      << std::setw(12) << "Mean (ms)"
+      << std::setw(12) << "p50 (ms)"
+      << std::setw(12) << "p95 (ms)" << "\n";
+  for (auto& entry: statistics)
+  {
+    const StatisticsType & stats = entry.second;
+    std::vector<double> values = stats.durations;
+    std::sort(values.begin(), values.end());
+    ss << std::left << std::setw(48) << (entry.first.first + "/" + entry.first.second) << std::right
+        << std::setw(10) << stats.count
+        << std::setw(14) << stats.total / 1000.0
+        << std::setw(12) << stats.total / stats.count / 1000.0
+        << std::setw(12) << GetPercentile(values, 50) / 1000.0
+        << std::setw(12) << GetPercentile(values, 95) / 1000.0 << "\n";
+  }
+
+  // Throughput
+  const double seconds = (last - first) / 1000000.0;
+  ss << "Wall time: " << seconds << " s";
+  if (seconds > 0)
+  {
+    if (processedPixels > 0)
+      ss << ", throughput: " << processedPixels / seconds << " pixels/s";
+    if (processedSamples > 0)
+      ss << ", throughput: " << processedSamples / seconds << " samples/s";
+  }
+  ss << "\n";
+
+  return ss.str();
+ }
+
+//
+// Kinds of events of one category, ranked by total duration, with their share
+// of the total duration of the category
+//
+std::string
+TensorflowProfiler
+::GetCostTable(const std::string & category, unsigned int maxRows) const
+ {
+  // Accumulate the durations
+  std::map<std::string, std::pair<unsigned long, double> > costs;
+  double total = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    for (auto& entry: m_Statistics)
+    {
+      if (entry.first.first == category)
+      {
+        costs[entry.first.second] = {entry.second.count, entry.second.total};
+        total += entry.second.total;
+      }
+    }
+  }
+
+  // Rank
+  std::vector<std::pair<std::string, std::pair<unsigned long, double> > > ranked(costs.begin(), costs.end());
+  std::sort(ranked.begin(), ranked.end(), [](const std::pair<std::string, std::pair<unsigned long, double> > & a,
+      const std::pair<std::string, std::pair<unsigned long, double> > & b) { return a.second.second > b.second.second; });
+
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2);
+  ss << std::setw(6) << "Rank" << "  " << std::left << std::setw(40) << "Name" << std::right
+      << std::setw(10) << "Count"
+      << std::setw(14) << "Total (ms)"
+      << std::setw(12) << "Mean (ms)"
+      << std::setw(10) << "Share" << "\n";
+  for (unsigned int i = 0 ; i < ranked.size() && i < maxRows ; i++)
+  {
+    const unsigned long count = ranked[i].second.first;
+    const double duration = ranked[i].second.second;
+    ss << std::setw(6) << (i + 1) << "  " << std::left << std::setw(40) << ranked[i].first << std::right
+        << std::setw(10) << count
+        << std::setw(14) << duration / 1000.0
+        << std::setw(12) << duration / count / 1000.0
+        << std::setw(9) << (total > 0 ? 100.0 * duration / total : 0) << "%\n";
+  }
+  if (ranked.size() > maxRows)
+  {
+    ss << "(" << ranked.size() - maxRows << " more)\n";
+  }
+
+  return ss.str();
+ }
+
+void
+TensorflowProfiler
+::PrintSelf(std::ostream & os, itk::Indent indent) const
+ {
+  Superclass::PrintSelf(os, indent);
+  os << indent << "Number of events: " << GetNumberOfEvents() << std::endl;
+ }
+
+} // end namespace otb
@@ -0,0 +1,180 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowProfiler_h
+#define otbTensorflowProfiler_h
+
+#include "itkObject.h"
+#include "itkObjectFactory.h"
+
+// STD
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace otb
+{
+
+/**
+ * \class TensorflowProfiler
+ * \brief This class records timed events of the TensorFlow filters.
+ *
+ * Filters that are given a profiler (with their SetProfiler() method) record
+ * one event for each stage of the processing of a tile or a batch: upstream
+ * update, tensors population, session run, writeback. Each event has a name,
+ * a category, a start time, a duration, the thread that has recorded it, and
+ * a list of arguments (e.g. the bytes moved, or the tensors shapes).
+ *
+ * The number of pixels or samples processed can be accumulated with
+ * AddProcessedPixels() and AddProcessedSamples() to compute the throughput.
+ *
+ * Events are not kept in memory: after StartChromeTrace(), they are written
+ * to a file in the Chrome trace-event JSON format as they are recorded, and
+ * the file is completed with FinishChromeTrace(). It can be opened in
+ * chrome://tracing or Perfetto. Only the statistics of each kind of event
+ * (same category and name) are kept: GetSummary() returns their latency
+ * statistics (count, mean, p50, p95), and the throughput. The percentiles are
+ * computed over a bounded random sample of the durations of each kind of
+ * event, which is exact up to MaxDurationSamples events.
+ *
+ * Events can also be added with explicit times relative to the time origin
+ * of the profiler, on a named lane (e.g. the device that has run a TensorFlow
+ * op). Otherwise, the lane is the thread that has recorded the event.
+ * GetCostTable() ranks the kinds of events of one category by total duration.
+ *
+ * Events can be recorded from multiple threads.
+ *
+ * \ingroup OTBTensorflow
+ */
+class ITK_EXPORT TensorflowProfiler : public itk::Object
+{
+public:
+
+  /** Standard class typedefs. */
+  typedef TensorflowProfiler                 Self;
+  typedef itk::Object                        Superclass;
+  typedef itk::SmartPointer<Self>            Pointer;
+  typedef itk::SmartPointer<const Self>      ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro(Self);
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro(TensorflowProfiler, itk::Object);
+
+  /** Typedefs for time */
+  typedef std::chrono::steady_clock          ClockType;
+  typedef ClockType::time_point              TimePointType;
+
+  /** Typedefs for events */
+  typedef std::map<std::string, std::string> ArgumentsType;
+  struct EventType
+  {
+    std::string   name;      // Name of the event, e.g. "run"
+    std::string   category;  // Category of the event, e.g. the filter name
+    double        start;     // Start time (microseconds, relative to the profiler creation)
+    double        duration;  // Duration (microseconds)
+    unsigned int  lane;      // Lane of the event (thread, or named lane)
+    ArgumentsType args;      // Arguments
+  };
+
+  /** Maximum number of durations kept to compute the percentiles of one kind of event */
+  static const unsigned int MaxDurationSamples = 10000;
+
+  /** Current time */
+  TimePointType Now() const { return ClockType::now(); }
+
+  /** Record an event */
+  void AddEvent(const std::string & name, const std::string & category,
+      const TimePointType & start, const TimePointType & end,
+      const ArgumentsType & args = ArgumentsType());
+
+  /** Record an event on a named lane, with times in microseconds */
+  void AddEvent(const std::string & name, const std::string & category,
+      double start, double duration, const std::string & lane,
+      const ArgumentsType & args = ArgumentsType());
+
+  /** Microseconds elapsed between the time origin and the given time */
+  double ToMicroseconds(const TimePointType & time) const;
+
+  /** Accumulate the work done */
+  void AddProcessedPixels(unsigned long count);
+  void AddProcessedSamples(unsigned long count);
+
+  /** Number of recorded events */
+  unsigned long GetNumberOfEvents() const;
+
+  /** Remove all statistics and counters */
+  void Reset();
+
+  /** Write the events recorded from now on in a Chrome trace-event JSON file */
+  void StartChromeTrace(const std::string & fileName);
+
+  /** Complete and close the trace file */
+  void FinishChromeTrace();
+
+  /** Latency statistics of the events, and throughput */
+  typedef std::set<std::string>              CategorySetType;
+  std::string GetSummary(const CategorySetType & excludedCategories = CategorySetType()) const;
+
+  /** Kinds of events of one category, ranked by total duration */
+  std::string GetCostTable(const std::string & category, unsigned int maxRows = 20) const;
+
+protected:
+  TensorflowProfiler();
+  virtual ~TensorflowProfiler();
+
+  virtual void PrintSelf(std::ostream & os, itk::Indent indent) const;
+
+private:
+  TensorflowProfiler(const Self&); //purposely not implemented
+  void operator=(const Self&); //purposely not implemented
+
+  /** Statistics of one kind of event */
+  struct StatisticsType
+  {
+    unsigned long       count;      // Number of events
+    double              total;      // Total duration (microseconds)
+    double              first;      // Earliest start time (microseconds)
+    double              last;       // Latest end time (microseconds)
+    std::vector<double> durations;  // Random sample of the durations (microseconds)
+  };
+  typedef std::pair<std::string, std::string>            KindType;
+  typedef std::map<KindType, StatisticsType>             StatisticsMapType;
+
+  unsigned int GetLane(const std::string & laneName);
+  void RecordEvent(const EventType & event);
+  void WriteLane(unsigned int lane);
+
+  mutable std::mutex                      m_Mutex;             // Protects the members below
+  TimePointType                           m_Origin;            // Time origin of the events
+  StatisticsMapType                       m_Statistics;        // Statistics of each kind of event
+  std::minstd_rand                        m_Generator;         // Sampling of the durations
+  std::ofstream                           m_Trace;             // Trace file
+  std::string                             m_TraceFileName;     // Name of the trace file
+  bool                                    m_TraceEmpty;        // True if nothing is written in the trace file yet
+  std::map<std::thread::id, unsigned int> m_Threads;           // Small ids of the threads
+  std::vector<std::string>                m_Lanes;             // Names of the lanes
+  unsigned long                           m_ProcessedPixels;   // Number of pixels processed
+  unsigned long                           m_ProcessedSamples;  // Number of samples processed
+
+}; // end class
+
+} // end namespace otb
+
+#include "otbTensorflowProfiler.cxx"
+
+#endif
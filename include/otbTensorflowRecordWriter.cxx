@@ -0,0 +1,284 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbTensorflowRecordWriter.h"
+
+#include "itkMacro.h"
+#include "otbTensorflowCommon.h"
+
+// STD
+#include <array>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+namespace otb {
+namespace tf {
+
+namespace
+{
+
+//
+// Append a varint (protobuf wire format)
+//
+void AppendVarint(std::string & buffer, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  buffer.push_back(static_cast<char>(value));
+}
+
+//
+// Append a length-delimited field (protobuf wire format)
+//
+void AppendLengthDelimited(std::string & buffer, unsigned int field, const std::string & value)
+{
+  AppendVarint(buffer, (field << 3) | 2);
+  AppendVarint(buffer, value.size());
+  buffer.append(value);
+}
+
+//
+// Append a little-endian fixed size value
+//
+template<class TValue>
+void AppendFixed(std::string & buffer, TValue value)
+{
+  char bytes[sizeof(TValue)];
+  std::memcpy(bytes, &value, sizeof(TValue));
+  buffer.append(bytes, sizeof(TValue));
+}
+
+//
+// Append an entry of the Features map: key (field 1) and Feature (field 2).
+// In the Feature message, the float_list is the field 2 and the int64_list
+// is the field 3.
+//
+void AppendFeature(std::string & features, const std::string & key, unsigned int listField, const std::string & list)
+{
+  std::string feature;
+  AppendLengthDelimited(feature, listField, list);
+  std::string entry;
+  AppendLengthDelimited(entry, 1, key);
+  AppendLengthDelimited(entry, 2, feature);
+  AppendLengthDelimited(features, 1, entry);
+}
+
+} // end anonymous namespace
+
+//
+// Compute the crc32c (Castagnoli polynomial, reflected)
+//
+uint32_t Crc32c(const char * data, std::size_t size)
+{
+  static const std::array<uint32_t, 256> table = []()
+  {
+    std::array<uint32_t, 256> t;
+    for (uint32_t i = 0 ; i < 256 ; i++)
+    {
+      uint32_t crc = i;
+      for (unsigned int k = 0 ; k < 8 ; k++)
+        crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+      t[i] = crc;
+    }
+    return t;
+  }();
+
+  uint32_t crc = 0xFFFFFFFF;
+  for (std::size_t i = 0 ; i < size ; i++)
+    crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFF;
+}
+
+//
+// Mask a crc32c, as in the TFRecord format
+//
+uint32_t MaskCrc32c(uint32_t crc)
+{
+  return ((crc >> 15) | (crc << 17)) + 0xA282EAD8;
+}
+
+//
+// Add a feature with a FloatList (packed values)
+//
+void ExampleBuilder::AddFloatList(const std::string & key, const float * values, std::size_t count)
+{
+  std::string packed;
+  packed.reserve(count * sizeof(float));
+  for (std::size_t i = 0 ; i < count ; i++)
+    AppendFixed(packed, values[i]);
+  std::string list;
+  AppendLengthDelimited(list, 1, packed);
+  AppendFeature(m_Features, key, 2, list);
+}
+
+//
+// Add a feature with an Int64List (packed values)
+//
+void ExampleBuilder::AddInt64List(const std::string & key, const int64_t * values, std::size_t count)
+{
+  std::string packed;
+  for (std::size_t i = 0 ; i < count ; i++)
+    AppendVarint(packed, static_cast<uint64_t>(values[i]));
+  std::string list;
+  AppendLengthDelimited(list, 1, packed);
+  AppendFeature(m_Features, key, 3, list);
+}
+
+//
+// Serialized tf.train.Example: the Features message is its field 1
+//
+std::string ExampleBuilder::Serialize() const
+{
+  std::string example;
+  AppendLengthDelimited(example, 1, m_Features);
+  return example;
+}
+
+TFRecordWriter::TFRecordWriter(const std::string & fileName) : m_FileName(fileName)
+{
+  m_Stream.open(fileName.c_str(), std::ios::binary);
+  if (!m_Stream.is_open())
+  {
+    itkGenericExceptionMacro("Unable to open the TFRecord file " << fileName);
+  }
+}
+
+//
+// Append one record: length, masked crc of the length, data, masked crc of the data
+//
+void TFRecordWriter::Write(const std::string & record)
+{
+  std::string header;
+  AppendFixed(header, static_cast<uint64_t>(record.size()));
+  std::string footer;
+  AppendFixed(footer, MaskCrc32c(Crc32c(record.data(), record.size())));
+
+  m_Stream.write(header.data(), header.size());
+  const uint32_t lengthCrc = MaskCrc32c(Crc32c(header.data(), header.size()));
+  m_Stream.write(reinterpret_cast<const char*>(&lengthCrc), sizeof(uint32_t));
+  m_Stream.write(record.data(), record.size());
+  m_Stream.write(footer.data(), footer.size());
+  if (!m_Stream.good())
+  {
+    itkGenericExceptionMacro("Error while writing the TFRecord file " << m_FileName);
+  }
+}
+
+void TFRecordWriter::Close()
+{
+  m_Stream.close();
+  if (m_Stream.fail())
+  {
+    itkGenericExceptionMacro("Error while closing the TFRecord file " << m_FileName);
+  }
+}
+
+//
+// Name of one shard, following the TensorFlow convention: the shard index and
+// count are inserted before the extension
+//
+std::string GetShardFileName(const std::string & fileName, unsigned int shardIndex, unsigned int shardCount)
+{
+  if (shardCount <= 1)
+    return fileName;
+
+  std::string::size_type dot = fileName.find_last_of('.');
+  const std::string::size_type slash = fileName.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    dot = fileName.size();
+
+  std::stringstream ss;
+  ss << fileName.substr(0, dot) << "-" << std::setw(5) << std::setfill('0') << shardIndex
+      << "-of-" << std::setw(5) << std::setfill('0') << shardCount << fileName.substr(dot);
+  return ss.str();
+}
+
+//
+// Write the samples of images of patches concatenated in the y dimension
+// (e.g. the outputs of the TensorflowSampler) in sharded TFRecord files.
+// Each sample is a tf.train.Example with:
+//  -one FloatList feature per patches image, with the given name (HWC values)
+//  -a "label" Int64List feature, if the label image is set
+//  -a "position" FloatList feature (x, y), if positions are given
+// Samples are distributed in a round-robin fashion over the shards, which are
+// written in parallel. Records are written one by one.
+//
+template<class TImage>
+void WriteTFRecordShards(const std::string & fileName, unsigned int shardCount,
+    const std::vector<typename TImage::Pointer> & patchesImages, const std::vector<std::string> & names,
+    const typename TImage::Pointer labelImage, const std::vector<typename TImage::PointType> & positions)
+{
+  if (patchesImages.size() == 0 || patchesImages.size() != names.size())
+  {
+    itkGenericExceptionMacro("The number of patches images and the number of features names are not the same");
+  }
+  if (shardCount == 0)
+  {
+    itkGenericExceptionMacro("The number of shards must be at least 1");
+  }
+
+  // Number of values of one sample, for each image
+  const unsigned long nSamples = labelImage.IsNotNull() ? labelImage->GetLargestPossibleRegion().GetSize(1) :
+      positions.size();
+  std::vector<unsigned long> nValues;
+  for (auto& image: patchesImages)
+  {
+    const typename TImage::RegionType region = image->GetBufferedRegion();
+    if (region != image->GetLargestPossibleRegion() || nSamples == 0 || region.GetSize(1) % nSamples != 0)
+    {
+      itkGenericExceptionMacro("The images of patches must be buffered, and hold the same number of samples");
+    }
+    nValues.push_back(region.GetNumberOfPixels() / nSamples * image->GetNumberOfComponentsPerPixel());
+  }
+  if (positions.size() > 0 && positions.size() != nSamples)
+  {
+    itkGenericExceptionMacro("The number of positions (" << positions.size() << ") is not the "
+        "number of samples (" << nSamples << ")");
+  }
+
+  ParallelFor(shardCount, shardCount, [&](unsigned long begin, unsigned long end)
+  {
+    for (unsigned long shard = begin ; shard < end ; shard++)
+    {
+      TFRecordWriter writer(GetShardFileName(fileName, shard, shardCount));
+      ExampleBuilder example;
+      std::vector<float> values;
+      for (unsigned long i = shard ; i < nSamples ; i += shardCount)
+      {
+        example.Clear();
+        for (unsigned int k = 0 ; k < patchesImages.size() ; k++)
+        {
+          const typename TImage::InternalPixelType * sample = patchesImages[k]->GetBufferPointer() + i * nValues[k];
+          values.assign(sample, sample + nValues[k]);
+          example.AddFloatList(names[k], values.data(), values.size());
+        }
+        if (labelImage.IsNotNull())
+        {
+          const int64_t label = static_cast<int64_t>(labelImage->GetBufferPointer()[i]);
+          example.AddInt64List("label", &label, 1);
+        }
+        if (positions.size() > 0)
+        {
+          const float position[2] = {static_cast<float>(positions[i][0]), static_cast<float>(positions[i][1])};
+          example.AddFloatList("position", position, 2);
+        }
+        writer.Write(example.Serialize());
+      }
+      writer.Close();
+    }
+  });
+}
+
+} // end namespace tf
+} // end namespace otb
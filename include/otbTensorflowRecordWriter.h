@@ -0,0 +1,91 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowRecordWriter_h
+#define otbTensorflowRecordWriter_h
+
+// STD
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//
+// TFRecord files of tf.train.Example protos
+//
+// These helpers do not depend on the TensorFlow or protobuf libraries, so
+// that they can be used in the TensorFlow-independent applications: the
+// tf.train.Example messages are encoded with the protobuf wire format, and
+// the records are framed like tf.io.TFRecordWriter does (length, masked
+// crc32c of the length, data, masked crc32c of the data).
+//
+namespace otb {
+namespace tf {
+
+// Compute the crc32c (Castagnoli) of a buffer
+uint32_t Crc32c(const char * data, std::size_t size);
+
+// Mask a crc32c, as in the TFRecord format
+uint32_t MaskCrc32c(uint32_t crc);
+
+//
+// Builder of a serialized tf.train.Example, feature by feature
+//
+class ExampleBuilder
+{
+public:
+  // Add a feature with a FloatList / Int64List
+  void AddFloatList(const std::string & key, const float * values, std::size_t count);
+  void AddInt64List(const std::string & key, const int64_t * values, std::size_t count);
+
+  // Serialized tf.train.Example
+  std::string Serialize() const;
+
+  // Remove all features
+  void Clear() { m_Features.clear(); }
+
+private:
+  std::string m_Features; // Serialized entries of the Features map
+};
+
+//
+// Writer of one TFRecord file
+//
+class TFRecordWriter
+{
+public:
+  TFRecordWriter(const std::string & fileName);
+
+  // Append one record
+  void Write(const std::string & record);
+
+  // Flush and close the file
+  void Close();
+
+private:
+  std::string   m_FileName;
+  std::ofstream m_Stream;
+};
+
+// Name of one shard: "name-00001-of-00004.ext" (the file name itself when there is one shard)
+std::string GetShardFileName(const std::string & fileName, unsigned int shardIndex, unsigned int shardCount);
+
+// Write the samples of images of patches concatenated in the y dimension in sharded TFRecord files
+template<class TImage>
+void WriteTFRecordShards(const std::string & fileName, unsigned int shardCount,
+    const std::vector<typename TImage::Pointer> & patchesImages, const std::vector<std::string> & names,
+    const typename TImage::Pointer labelImage, const std::vector<typename TImage::PointType> & positions);
+
+} // end namespace tf
+} // end namespace otb
+
+#include "otbTensorflowRecordWriter.cxx"
+
+#endif
@@ -0,0 +1,109 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbTensorflowRegressionMetrics.h"
+
+#include "otbTensorflowCommon.h"
+
+// STD
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+namespace otb {
+namespace tf {
+
+//
+// Merge two accumulators (Chan et al.)
+//
+void RegressionAccumulator::Merge(const RegressionAccumulator & other)
+{
+  if (other.m_Count == 0)
+    return;
+  if (m_Count == 0)
+  {
+    *this = other;
+    return;
+  }
+
+  const double n1 = m_Count;
+  const double n2 = other.m_Count;
+  const double n = n1 + n2;
+
+  const double errorDelta = other.m_ErrorMean - m_ErrorMean;
+  m_ErrorMean += errorDelta * n2 / n;
+  m_ErrorM2 += other.m_ErrorM2 + errorDelta * errorDelta * n1 * n2 / n;
+  m_AbsErrorMean = (n1 * m_AbsErrorMean + n2 * other.m_AbsErrorMean) / n;
+
+  const double referenceDelta = other.m_ReferenceMean - m_ReferenceMean;
+  m_ReferenceMean += referenceDelta * n2 / n;
+  m_ReferenceM2 += other.m_ReferenceM2 + referenceDelta * referenceDelta * n1 * n2 / n;
+
+  m_Count += other.m_Count;
+}
+
+//
+// The mean squared error is the variance of the errors plus the squared bias,
+// and the residual sum of squares is count times the mean squared error
+//
+RegressionMetrics RegressionAccumulator::GetMetrics() const
+{
+  RegressionMetrics metrics;
+  metrics.count = m_Count;
+  if (m_Count == 0)
+  {
+    metrics.rmse = metrics.mae = metrics.bias = metrics.r2 = std::numeric_limits<double>::quiet_NaN();
+    return metrics;
+  }
+
+  const double mse = m_ErrorM2 / m_Count + m_ErrorMean * m_ErrorMean;
+  metrics.rmse = std::sqrt(mse);
+  metrics.mae = m_AbsErrorMean;
+  metrics.bias = m_ErrorMean;
+  metrics.r2 = m_ReferenceM2 > 0 ? 1.0 - mse * m_Count / m_ReferenceM2 : std::numeric_limits<double>::quiet_NaN();
+  return metrics;
+}
+
+//
+// Accumulate the pairs in parallel. Small arrays are processed by fewer
+// threads.
+//
+template<class TReference, class TPredicted>
+void AccumulateRegressionMetrics(std::vector<RegressionAccumulator> & accumulators,
+    const TReference * references, std::size_t referencesStride,
+    const TPredicted * predictions, std::size_t nChannels,
+    unsigned long count, bool useNoData, double noData, unsigned int nThreads)
+{
+  const unsigned long minimumCountPerThread = 65536;
+  nThreads = std::max(1ul, std::min(static_cast<unsigned long>(nThreads), count / minimumCountPerThread));
+  accumulators.resize(nChannels);
+
+  std::mutex mutex;
+  ParallelFor(count, nThreads, [&](unsigned long begin, unsigned long end)
+  {
+    std::vector<RegressionAccumulator> partials(nChannels);
+    for (unsigned long i = begin ; i < end ; i++)
+      for (std::size_t c = 0 ; c < nChannels ; c++)
+      {
+        const double reference = static_cast<double>(references[i * referencesStride + c]);
+        if (useNoData && reference == noData)
+          continue;
+        partials[c].Add(reference, static_cast<double>(predictions[i * nChannels + c]));
+      }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (std::size_t c = 0 ; c < nChannels ; c++)
+      accumulators[c].Merge(partials[c]);
+  });
+}
+
+} // end namespace tf
+} // end namespace otb
@@ -0,0 +1,90 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef otbTensorflowRegressionMetrics_h
+#define otbTensorflowRegressionMetrics_h
+
+// STD
+#include <cstddef>
+#include <vector>
+
+namespace otb {
+namespace tf {
+
+// Regression metrics of one channel
+struct RegressionMetrics
+{
+  unsigned long count; // Number of (reference, prediction) pairs
+  double        rmse;  // Root mean square error
+  double        mae;   // Mean absolute error
+  double        bias;  // Mean error (prediction - reference)
+  double        r2;    // Coefficient of determination (NaN when the references are constant)
+};
+
+//
+// Streaming accumulator of the regression metrics of one channel
+//
+// The means and the sums of squared deviations of the errors and of the
+// references are updated with the Welford algorithm, which is numerically
+// stable over many values. Two accumulators can be merged (e.g. the partial
+// accumulators of several threads) with the formulas of Chan et al.
+//
+class RegressionAccumulator
+{
+public:
+  RegressionAccumulator() : m_Count(0), m_ErrorMean(0), m_ErrorM2(0), m_AbsErrorMean(0),
+    m_ReferenceMean(0), m_ReferenceM2(0) {}
+
+  // Add a (reference, prediction) pair
+  void Add(double reference, double predicted)
+  {
+    m_Count++;
+    const double error = predicted - reference;
+    const double errorDelta = error - m_ErrorMean;
+    m_ErrorMean += errorDelta / m_Count;
+    m_ErrorM2 += errorDelta * (error - m_ErrorMean);
+    m_AbsErrorMean += ((error < 0 ? -error : error) - m_AbsErrorMean) / m_Count;
+    const double referenceDelta = reference - m_ReferenceMean;
+    m_ReferenceMean += referenceDelta / m_Count;
+    m_ReferenceM2 += referenceDelta * (reference - m_ReferenceMean);
+  }
+
+  // Add the pairs of another accumulator
+  void Merge(const RegressionAccumulator & other);
+
+  // Metrics of the pairs added
+  RegressionMetrics GetMetrics() const;
+
+private:
+  unsigned long m_Count;         // Number of pairs
+  double        m_ErrorMean;     // Mean of the errors
+  double        m_ErrorM2;       // Sum of the squared deviations of the errors
+  double        m_AbsErrorMean;  // Mean of the absolute errors
+  double        m_ReferenceMean; // Mean of the references
+  double        m_ReferenceM2;   // Sum of the squared deviations of the references
+};
+
+// Accumulate the pairs of count pixels, one accumulator per channel. The
+// predictions have nChannels values per pixel, and the references
+// referencesStride values per pixel (the first nChannels ones are used).
+// References equal to the no-data value are skipped when useNoData is true.
+// Each thread fills partial accumulators, which are then merged.
+template<class TReference, class TPredicted>
+void AccumulateRegressionMetrics(std::vector<RegressionAccumulator> & accumulators,
+    const TReference * references, std::size_t referencesStride,
+    const TPredicted * predictions, std::size_t nChannels,
+    unsigned long count, bool useNoData, double noData, unsigned int nThreads);
+
+} // end namespace tf
+} // end namespace otb
+
+#include "otbTensorflowRegressionMetrics.cxx"
+
+#endif
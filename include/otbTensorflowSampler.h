@@ -35,7 +35,8 @@ namespace otb
  * Samples are concatenated in y dimension to form a single big image of
  * extracted patches.
  * Label image is also created from the value of the m_Field field of the
- * input vector data
+ * input vector data. The positions of the accepted samples are kept in
+ * the same order as the samples.
  *
  * TODO:
  * -must inherit from itk::imageToImageFilter
@@ -80,6 +81,7 @@ public:
                                                   ExtractROIMultiFilterPointerType;
   typedef typename std::vector<ImagePointerType>  ImagePointerListType;
   typedef typename std::vector<SizeType>          SizeListType;
+  typedef typename std::vector<PointType>         PointListType;
 
   /** Vector data typedefs */
   typedef TVectorData                             VectorDataType;
@@ -110,6 +112,7 @@ public:
   /** Get outputs */
   itkGetMacro(OutputPatchImages, ImagePointerListType);
   itkGetMacro(OutputLabelImage, ImagePointerType);
+  itkGetMacro(OutputPositions, PointListType);
   itkGetMacro(NumberOfAcceptedSamples, unsigned long);
   itkGetMacro(NumberOfRejectedSamples, unsigned long);
 
@@ -131,6 +134,7 @@ private:
   // Read only
   ImagePointerListType m_OutputPatchImages;
   ImagePointerType     m_OutputLabelImage;
+  PointListType        m_OutputPositions;  // Centers of the accepted samples
   unsigned long        m_NumberOfAcceptedSamples;
   unsigned long        m_NumberOfRejectedSamples;
 
@@ -149,6 +149,9 @@ TensorflowSampler<TInputImage, TVectorData>
     m_OutputPatchImages.push_back(newImage);
   }
 
+  m_OutputPositions.clear();
+  m_OutputPositions.reserve(nTotal);
+
   itk::ProgressReporter progess(this, 0, nTotal);
 
   // Iterate on the vector data
@@ -188,6 +191,9 @@ TensorflowSampler<TInputImage, TVectorData>
         labelIndex[1] = count;
         m_OutputLabelImage->SetPixel(labelIndex, labelPix);
 
+        // Keep the position
+        m_OutputPositions.push_back(point);
+
         // update count
         count++;
       }
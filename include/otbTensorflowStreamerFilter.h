@@ -14,6 +14,13 @@
 #include "itkImageToImageFilter.h"
 #include "itkProgressReporter.h"
 
+// Journal
+#include <set>
+#include <string>
+
+// Profiling
+#include "otbTensorflowProfiler.h"
+
 namespace otb
 {
 
@@ -22,6 +29,25 @@ namespace otb
  * \brief This filter generates an output image with an internal
  * explicit streaming mechanism.
  *
+ * The output is computed tile by tile, tiles being aligned on a grid
+ * of size OutputGridSize starting at the origin of the largest possible region.
+ *
+ * A journal directory can be set with SetJournalDirectory() to make the
+ * processing resumable. Each computed tile is stored in a raw chunk file of
+ * this directory, then recorded in a journal file. When the processing is run
+ * again with the same journal directory, the tiles of the journal are read
+ * back from their chunk files instead of being computed. The journal records
+ * the grid, the image size, origin and spacing, the number of components, and
+ * a hash of the journal key (set with SetJournalKey(), e.g. the model and the
+ * input files), and an exception is thrown if they don't match the current
+ * output. Once the output is entirely written, RemoveJournal() deletes the
+ * chunk files and the journal. The journal file is named after JournalName
+ * ("journal" by default): processes that compute disjoint tiles of the same
+ * output in the same directory (e.g. shards) must use different names.
+ *
+ * An optional profiler (otb::TensorflowProfiler) can be set with SetProfiler()
+ * to record, for each tile, the upstream update and the copy to the output.
+ *
  * \ingroup OTBTensorflow
  */
 template <class TInputImage, class TOutputImage>
@@ -52,9 +78,33 @@ public:
 
   typedef TOutputImage                             OutputImageType;
 
+  typedef typename OutputImageType::InternalPixelType OutputInternalPixelType;
+  typedef std::set<unsigned long>                  TileIdSetType;
+
+  typedef TensorflowProfiler                       ProfilerType;
+
   itkSetMacro(OutputGridSize, SizeType);
   itkGetMacro(OutputGridSize, SizeType);
 
+  /** Journal directory (empty: no journal) */
+  void SetJournalDirectory(const std::string & directory);
+  itkGetMacro(JournalDirectory, std::string);
+
+  /** Journal name: the journal file is <JournalDirectory>/<JournalName>.txt */
+  void SetJournalName(const std::string & name);
+  itkGetMacro(JournalName, std::string);
+
+  /** Journal key, that identifies what is computed (e.g. the model and the inputs) */
+  void SetJournalKey(const std::string & key);
+  itkGetMacro(JournalKey, std::string);
+
+  /** Delete the chunk files and the journal */
+  virtual void RemoveJournal();
+
+  /** Profiler (optional) */
+  itkSetObjectMacro(Profiler, ProfilerType);
+  itkGetObjectMacro(Profiler, ProfilerType);
+
 protected:
   TensorflowStreamerFilter();
   virtual ~TensorflowStreamerFilter() {};
@@ -63,11 +113,27 @@ protected:
 
   virtual void GenerateData();
 
+  virtual IndexValueType GetNumberOfTilesX();
+  virtual std::string GetJournalFileName();
+  virtual std::string GetChunkFileName(IndexValueType tx, IndexValueType ty);
+  virtual std::string GetJournalSignature();
+  virtual void LoadJournal();
+  virtual void ReadChunk(IndexValueType tx, IndexValueType ty, const RegionType & region, OutputImageType * image);
+  virtual void WriteChunk(IndexValueType tx, IndexValueType ty, const RegionType & region, const ImageType * image);
+
 private:
   TensorflowStreamerFilter(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
   SizeType                   m_OutputGridSize;       // Output grid size
+  std::string                m_JournalDirectory;     // Journal directory
+  std::string                m_JournalName;          // Journal name
+  std::string                m_JournalKey;           // Journal key
+  ProfilerType::Pointer      m_Profiler;             // Profiler (optional)
+
+  // Internal
+  TileIdSetType              m_CompletedTiles;       // Tiles recorded in the journal
+  bool                       m_JournalLoaded;        // Journal loaded on/off
 
 }; // end class
 
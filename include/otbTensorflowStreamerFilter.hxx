@@ -13,6 +13,14 @@
 
 #include "otbTensorflowStreamerFilter.h"
 #include "itkImageAlgorithm.h"
+#include "itkImageRegionConstIterator.h"
+#include "itksys/SystemTools.hxx"
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
 
 namespace otb
 {
@@ -22,6 +30,279 @@ TensorflowStreamerFilter<TInputImage, TOutputImage>
 ::TensorflowStreamerFilter()
  {
   m_OutputGridSize.Fill(1);
+  m_JournalName = "journal";
+  m_JournalLoaded = false;
+ }
+
+template <class TInputImage, class TOutputImage>
+void
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::SetJournalDirectory(const std::string & directory)
+ {
+  if (m_JournalDirectory != directory)
+    {
+    m_JournalDirectory = directory;
+    m_JournalLoaded = false;
+    this->Modified();
+    }
+ }
+
+template <class TInputImage, class TOutputImage>
+void
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::SetJournalName(const std::string & name)
+ {
+  if (m_JournalName != name)
+    {
+    m_JournalName = name;
+    m_JournalLoaded = false;
+    this->Modified();
+    }
+ }
+
+template <class TInputImage, class TOutputImage>
+void
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::SetJournalKey(const std::string & key)
+ {
+  if (m_JournalKey != key)
+    {
+    m_JournalKey = key;
+    m_JournalLoaded = false;
+    this->Modified();
+    }
+ }
+
+/**
+ * Number of tiles of the grid in the x dimension of the largest possible region
+ */
+template <class TInputImage, class TOutputImage>
+typename TensorflowStreamerFilter<TInputImage, TOutputImage>::IndexValueType
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::GetNumberOfTilesX()
+ {
+  const IndexValueType sizeX = this->GetOutput()->GetLargestPossibleRegion().GetSize(0);
+  return (sizeX + m_OutputGridSize[0] - 1) / m_OutputGridSize[0];
+ }
+
+/**
+ * Journal file name
+ */
+template <class TInputImage, class TOutputImage>
+std::string
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::GetJournalFileName()
+ {
+  return m_JournalDirectory + "/" + m_JournalName + ".txt";
+ }
+
+/**
+ * Chunk file name of the tile (tx, ty)
+ */
+template <class TInputImage, class TOutputImage>
+std::string
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::GetChunkFileName(IndexValueType tx, IndexValueType ty)
+ {
+  std::stringstream ss;
+  ss << m_JournalDirectory << "/tile_" << tx << "_" << ty << ".bin";
+  return ss.str();
+ }
+
+/**
+ * The journal signature describes the tiling and the geometry of the output,
+ * with a hash (64 bits FNV-1a) of the journal key
+ */
+template <class TInputImage, class TOutputImage>
+std::string
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::GetJournalSignature()
+ {
+  unsigned long long hash = 14695981039346656037ULL;
+  for (auto& c: m_JournalKey)
+    {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+    }
+
+  const OutputImageType * outputPtr = this->GetOutput();
+  const SizeType size = outputPtr->GetLargestPossibleRegion().GetSize();
+  std::stringstream ss;
+  ss << std::setprecision(17);
+  ss << "otbtf-journal grid " << m_OutputGridSize[0] << " " << m_OutputGridSize[1]
+     << " size " << size[0] << " " << size[1]
+     << " origin " << outputPtr->GetOrigin()[0] << " " << outputPtr->GetOrigin()[1]
+     << " spacing " << outputPtr->GetSignedSpacing()[0] << " " << outputPtr->GetSignedSpacing()[1]
+     << " components " << outputPtr->GetNumberOfComponentsPerPixel()
+     << " bytes " << sizeof(OutputInternalPixelType)
+     << " key " << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return ss.str();
+ }
+
+/**
+ * Read the journal, or create it if it doesn't exist
+ */
+template <class TInputImage, class TOutputImage>
+void
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::LoadJournal()
+ {
+  m_CompletedTiles.clear();
+
+  if (!itksys::SystemTools::FileIsDirectory(m_JournalDirectory) &&
+      !itksys::SystemTools::MakeDirectory(m_JournalDirectory))
+    {
+    itkExceptionMacro("Unable to create the journal directory " << m_JournalDirectory);
+    }
+
+  const std::string signature = GetJournalSignature();
+  const std::string journalFileName = GetJournalFileName();
+  std::ifstream journal(journalFileName.c_str());
+  if (journal.good())
+    {
+    std::string line;
+    std::getline(journal, line);
+    if (line != signature)
+      {
+      itkExceptionMacro("The journal " << journalFileName << " was created for another output.\n"
+          << "Journal signature: " << line << "\n"
+          << "Output signature : " << signature);
+      }
+    unsigned long tileId;
+    while (journal >> tileId)
+      {
+      m_CompletedTiles.insert(tileId);
+      }
+    }
+  else
+    {
+    std::ofstream newJournal(journalFileName.c_str());
+    newJournal << signature << std::endl;
+    if (!newJournal.good())
+      {
+      itkExceptionMacro("Unable to create the journal " << journalFileName);
+      }
+    }
+
+  m_JournalLoaded = true;
+ }
+
+/**
+ * Delete the chunk files and the journal. The tiles recorded in the journal are
+ * forgotten, and the journal is created again if the output is generated again.
+ */
+template <class TInputImage, class TOutputImage>
+void
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::RemoveJournal()
+ {
+  if (m_JournalDirectory.empty())
+    {
+    return;
+    }
+
+  // Load the journal, if the output has not been generated
+  const std::string journalFileName = GetJournalFileName();
+  if (!m_JournalLoaded && itksys::SystemTools::FileExists(journalFileName))
+    {
+    LoadJournal();
+    }
+
+  // The journal is deleted first, so that it never records a deleted chunk
+  if (itksys::SystemTools::FileExists(journalFileName) && !itksys::SystemTools::RemoveFile(journalFileName))
+    {
+    itkExceptionMacro("Unable to delete the journal " << journalFileName);
+    }
+  const IndexValueType nbTilesX = GetNumberOfTilesX();
+  for (auto& tileId: m_CompletedTiles)
+    {
+    const std::string fileName = GetChunkFileName(tileId % nbTilesX, tileId / nbTilesX);
+    if (itksys::SystemTools::FileExists(fileName) && !itksys::SystemTools::RemoveFile(fileName))
+      {
+      itkExceptionMacro("Unable to delete the chunk file " << fileName);
+      }
+    }
+
+  m_CompletedTiles.clear();
+  m_JournalLoaded = false;
+ }
+
+/**
+ * Read a tile from its chunk file, and copy the given region into the image
+ */
+template <class TInputImage, class TOutputImage>
+void
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::ReadChunk(IndexValueType tx, IndexValueType ty, const RegionType & region, OutputImageType * image)
+ {
+  typename OutputImageType::Pointer chunk = OutputImageType::New();
+  chunk->SetNumberOfComponentsPerPixel(image->GetNumberOfComponentsPerPixel());
+  chunk->SetRegions(region);
+  chunk->Allocate();
+
+  const std::string fileName = GetChunkFileName(tx, ty);
+  const size_t nElem = region.GetNumberOfPixels() * chunk->GetNumberOfComponentsPerPixel();
+  FILE * file = fopen(fileName.c_str(), "rb");
+  if (file == NULL)
+    {
+    itkExceptionMacro("Unable to open the chunk file " << fileName);
+    }
+  const size_t nRead = fread(chunk->GetBufferPointer(), sizeof(OutputInternalPixelType), nElem, file);
+  fclose(file);
+  if (nRead != nElem)
+    {
+    itkExceptionMacro("Chunk file " << fileName << " is truncated (" << nRead << " values read, "
+        << nElem << " expected)");
+    }
+
+  RegionType cpyRegion(region);
+  cpyRegion.Crop(image->GetBufferedRegion());
+  itk::ImageAlgorithm::Copy( chunk.GetPointer(), image, cpyRegion, cpyRegion );
+ }
+
+/**
+ * Write the region of the image in a chunk file, then record it in the journal.
+ * The chunk is first written in a temporary file, that is renamed once complete.
+ */
+template <class TInputImage, class TOutputImage>
+void
+TensorflowStreamerFilter<TInputImage, TOutputImage>
+::WriteChunk(IndexValueType tx, IndexValueType ty, const RegionType & region, const ImageType * image)
+ {
+  const unsigned int nComponents = image->GetNumberOfComponentsPerPixel();
+  std::vector<OutputInternalPixelType> buffer;
+  buffer.reserve(region.GetNumberOfPixels() * nComponents);
+  itk::ImageRegionConstIterator<ImageType> it(image, region);
+  for (it.GoToBegin(); !it.IsAtEnd(); ++it)
+    {
+    const typename ImageType::PixelType pix = it.Get();
+    for (unsigned int c = 0 ; c < nComponents ; c++)
+      buffer.push_back(static_cast<OutputInternalPixelType>(pix[c]));
+    }
+
+  const std::string fileName = GetChunkFileName(tx, ty);
+  const std::string tmpFileName = fileName + ".tmp";
+  FILE * file = fopen(tmpFileName.c_str(), "wb");
+  if (file == NULL)
+    {
+    itkExceptionMacro("Unable to create the chunk file " << tmpFileName);
+    }
+  const size_t nWritten = fwrite(buffer.data(), sizeof(OutputInternalPixelType), buffer.size(), file);
+  const bool closed = (fclose(file) == 0);
+  if (nWritten != buffer.size() || !closed || std::rename(tmpFileName.c_str(), fileName.c_str()) != 0)
+    {
+    itkExceptionMacro("Unable to write the chunk file " << fileName);
+    }
+
+  // Record the tile in the journal
+  const unsigned long tileId = ty * this->GetNumberOfTilesX() + tx;
+  std::ofstream journal(GetJournalFileName().c_str(), std::ios::app);
+  journal << tileId << std::endl;
+  if (!journal.good())
+    {
+    itkExceptionMacro("Unable to update the journal " << GetJournalFileName());
+    }
+  m_CompletedTiles.insert(tileId);
  }
 
 /**
@@ -38,6 +319,13 @@ TensorflowStreamerFilter<TInputImage, TOutputImage>
   outputPtr->SetBufferedRegion(outputReqRegion);
   outputPtr->Allocate();
 
+  // Journal
+  const bool useJournal = !m_JournalDirectory.empty();
+  if (useJournal && !m_JournalLoaded)
+    {
+    LoadJournal();
+    }
+
   // Compute the aligned region
   RegionType region;
   for(unsigned int dim = 0; dim<OutputImageType::ImageDimension; ++dim)
@@ -87,13 +375,73 @@ TensorflowStreamerFilter<TInputImage, TOutputImage>
       RegionType cpyRegion(subRegion);
       cpyRegion.Crop(outputReqRegion);
 
-      // Propagate region
-      inputImage->SetRequestedRegion(cpyRegion);
-      inputImage->PropagateRequestedRegion();
-      inputImage->UpdateOutputData();
+      // Profiling
+      ProfilerType::TimePointType startTime;
+      ProfilerType::ArgumentsType args;
+      if (m_Profiler)
+      {
+        startTime = m_Profiler->Now();
+        std::stringstream ss;
+        ss << tx << " " << ty;
+        args["tile"] = ss.str();
+        args["bytes"] = std::to_string(cpyRegion.GetNumberOfPixels() * outputPtr->GetNumberOfComponentsPerPixel()
+            * sizeof(OutputInternalPixelType));
+      }
+
+      if (useJournal)
+      {
+        // With the journal, the entire tile is processed then stored
+        RegionType tileRegion(subRegion);
+        tileRegion.Crop(outputPtr->GetLargestPossibleRegion());
+        const IndexValueType tileX = subRegion.GetIndex(0) / m_OutputGridSize[0];
+        const IndexValueType tileY = subRegion.GetIndex(1) / m_OutputGridSize[1];
+        if (m_CompletedTiles.count(tileY * GetNumberOfTilesX() + tileX) == 0)
+        {
+          inputImage->SetRequestedRegion(tileRegion);
+          inputImage->PropagateRequestedRegion();
+          inputImage->UpdateOutputData();
+          if (m_Profiler)
+          {
+            const ProfilerType::TimePointType time = m_Profiler->Now();
+            m_Profiler->AddEvent("upstream", this->GetNameOfClass(), startTime, time, args);
+            startTime = time;
+          }
+          WriteChunk(tileX, tileY, tileRegion, inputImage);
+          itk::ImageAlgorithm::Copy( inputImage, outputPtr, cpyRegion, cpyRegion );
+          if (m_Profiler)
+          {
+            m_Profiler->AddEvent("write chunk", this->GetNameOfClass(), startTime, m_Profiler->Now(), args);
+          }
+        }
+        else
+        {
+          ReadChunk(tileX, tileY, tileRegion, outputPtr);
+          if (m_Profiler)
+          {
+            m_Profiler->AddEvent("read chunk", this->GetNameOfClass(), startTime, m_Profiler->Now(), args);
+          }
+        }
+      }
+      else
+      {
+        // Propagate region
+        inputImage->SetRequestedRegion(cpyRegion);
+        inputImage->PropagateRequestedRegion();
+        inputImage->UpdateOutputData();
+        if (m_Profiler)
+        {
+          const ProfilerType::TimePointType time = m_Profiler->Now();
+          m_Profiler->AddEvent("upstream", this->GetNameOfClass(), startTime, time, args);
+          startTime = time;
+        }
 
-      // Copy the subregion to output
-      itk::ImageAlgorithm::Copy( inputImage, outputPtr, cpyRegion, cpyRegion );
+        // Copy the subregion to output
+        itk::ImageAlgorithm::Copy( inputImage, outputPtr, cpyRegion, cpyRegion );
+        if (m_Profiler)
+        {
+          m_Profiler->AddEvent("copy", this->GetNameOfClass(), startTime, m_Profiler->Now(), args);
+        }
+      }
 
       progress.CompletedPixel();
     }
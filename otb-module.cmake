@@ -15,6 +15,7 @@ otb_module(OTBTensorflow
 	TEST_DEPENDS
 		OTBTestKernel
 		OTBCommandLine
+		OTBAppImageUtils
 	DESCRIPTION
 		"${DOCUMENTATION}"
 )
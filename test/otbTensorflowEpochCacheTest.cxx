@@ -0,0 +1,114 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbTensorflowMultisourceModelLearningBase.h"
+#include "otbTensorflowGraphOperations.h"
+#include "otbImageFileReader.h"
+#include "otbMultiChannelExtractROI.h"
+#include "otbVectorImage.h"
+
+namespace
+{
+
+typedef otb::VectorImage<float, 2> ImageType;
+
+/**
+ * Learning filter that only reads the batches
+ */
+class BatchReaderFilter : public otb::TensorflowMultisourceModelLearningBase<ImageType>
+{
+public:
+  typedef BatchReaderFilter                                       Self;
+  typedef otb::TensorflowMultisourceModelLearningBase<ImageType>  Superclass;
+  typedef itk::SmartPointer<Self>                                 Pointer;
+
+  itkNewMacro(Self);
+  itkTypeMacro(BatchReaderFilter, TensorflowMultisourceModelLearningBase);
+
+protected:
+  BatchReaderFilter() {};
+
+  void ProcessBatch(DictType & inputs, const IndexValueType & sampleStart, const IndexValueType & batchSize)
+  {
+    (void) inputs; (void) sampleStart; (void) batchSize;
+  }
+};
+
+} // end anonymous namespace
+
+//
+// The blocks of the epoch cache are kept when the filter runs again (like at
+// each epoch of the training): the second epoch decodes all of them instead
+// of reading them through the pipeline.
+//
+// Arguments: an image of at least 16x128 pixels with 4 bands, and the model1
+// of the tests (with a placeholder "x" of patches of 16x16x4)
+//
+int otbTensorflowEpochCacheTest(int argc, char * argv[])
+{
+  if (argc != 3)
+    {
+    std::cerr << "Usage: " << argv[0] << " image model_dir" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  tensorflow::SavedModelBundle bundle;
+  otb::tf::LoadModel(argv[2], bundle);
+
+  // Patches image of 8 patches of 16x16 pixels
+  typedef otb::ImageFileReader<ImageType> ReaderType;
+  typedef otb::MultiChannelExtractROI<float, float> ExtractROIFilterType;
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(argv[1]);
+  ExtractROIFilterType::Pointer extract = ExtractROIFilterType::New();
+  extract->SetInput(reader->GetOutput());
+  extract->SetStartX(0);
+  extract->SetStartY(0);
+  extract->SetSizeX(16);
+  extract->SetSizeY(128);
+
+  // Blocks of 2 samples, without LRU cache (only the last block is kept)
+  BatchReaderFilter::SizeType patchSize;
+  patchSize.Fill(16);
+  BatchReaderFilter::Pointer filter = BatchReaderFilter::New();
+  filter->SetGraph(bundle.meta_graph_def.graph_def());
+  filter->SetSession(bundle.session.get());
+  filter->SetInput(0, extract->GetOutput());
+  filter->SetInputPlaceholders({"x"});
+  filter->SetInputReceptiveFields({patchSize});
+  filter->SetBatchSize(4);
+  filter->SetUseStreaming(true);
+  filter->SetStreamingBlockSize(2);
+  filter->SetStreamingCacheRAM(0);
+  filter->SetEpochCacheRAM(1);
+
+  // Epoch 1: the blocks are read, and stored in the epoch cache
+  filter->Update();
+  std::cout << "Epoch 1: " << filter->GetEpochCacheNumberOfBlocks() << " blocks in the epoch cache, "
+      << filter->GetEpochCacheHits() << " hits" << std::endl;
+  if (filter->GetEpochCacheNumberOfBlocks() != 4 || filter->GetEpochCacheHits() != 0)
+    {
+    std::cerr << "Epoch 1 should store 4 blocks in the epoch cache, without hits" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Epoch 2: the blocks are decoded from the epoch cache
+  filter->Modified();
+  filter->Update();
+  std::cout << "Epoch 2: " << filter->GetEpochCacheNumberOfBlocks() << " blocks in the epoch cache, "
+      << filter->GetEpochCacheHits() << " hits" << std::endl;
+  if (filter->GetEpochCacheNumberOfBlocks() != 4 || filter->GetEpochCacheHits() != 4)
+    {
+    std::cerr << "Epoch 2 should decode the 4 blocks from the epoch cache" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
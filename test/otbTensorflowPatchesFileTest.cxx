@@ -0,0 +1,72 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbTensorflowPatchesFileReader.h"
+#include "otbImageFileWriter.h"
+#include "otbVectorImage.h"
+
+//
+// A patches file is read back as the image of patches concatenated in the y
+// dimension, which is written to be compared with the tall image written by
+// the PatchesExtraction application from the same samples.
+//
+// Arguments: the patches file, the expected data type of its values (e.g.
+// "float32"), the expected compression (e.g. "zstd"), and the output image
+//
+int otbTensorflowPatchesFileTest(int argc, char * argv[])
+{
+  if (argc != 5)
+    {
+    std::cerr << "Usage: " << argv[0] << " patches_file data_type compression out_image" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  typedef otb::VectorImage<float, 2> ImageType;
+  typedef otb::TensorflowPatchesFileReader<ImageType> ReaderType;
+  typedef otb::ImageFileWriter<ImageType> WriterType;
+
+  ReaderType::Pointer reader = ReaderType::New();
+  reader->SetFileName(argv[1]);
+  reader->UpdateOutputInformation();
+
+  // Header
+  const otb::tf::PatchesFileHeader & header = reader->GetHeader();
+  std::cout << "Samples: " << header.numberOfSamples << ", patch size: " << reader->GetPatchSize()
+      << ", components: " << header.numberOfComponents
+      << ", data type: " << otb::tf::GetPatchesFileDataTypeName(header.dataType)
+      << ", compression: " << otb::tf::GetPatchesFileCompressionName(header.compression) << std::endl;
+  if (otb::tf::GetPatchesFileDataTypeName(header.dataType) != argv[2])
+    {
+    std::cerr << "The data type of the values should be " << argv[2] << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (otb::tf::GetPatchesFileCompressionName(header.compression) != argv[3])
+    {
+    std::cerr << "The compression should be " << argv[3] << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Index
+  const ReaderType::PointListType positions = reader->GetPositions();
+  if (positions.size() != header.numberOfSamples)
+    {
+    std::cerr << "The index has " << positions.size() << " positions but the file has "
+        << header.numberOfSamples << " samples" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Samples
+  WriterType::Pointer writer = WriterType::New();
+  writer->SetInput(reader->GetOutput());
+  writer->SetFileName(argv[4]);
+  writer->Update();
+
+  return EXIT_SUCCESS;
+}
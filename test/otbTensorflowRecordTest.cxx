@@ -0,0 +1,116 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbTensorflowRecordWriter.h"
+#include "otbImageFileReader.h"
+#include "otbVectorImage.h"
+#include <algorithm>
+#include <memory>
+
+// TensorFlow
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/lib/io/record_reader.h"
+#include "tensorflow/core/example/example.pb.h"
+
+//
+// The TFRecord shards written by the PatchesExtraction application are read
+// with the TensorFlow record reader (which checks the crc32c of the records),
+// and the tf.train.Example of each sample is compared with the tall image and
+// the labels image written from the same samples.
+//
+// Arguments: the TFRecord file, the number of shards, the tall image of the
+// patches of "source1", and the labels image
+//
+int otbTensorflowRecordTest(int argc, char * argv[])
+{
+  if (argc != 5)
+    {
+    std::cerr << "Usage: " << argv[0] << " tfrecord_file shards patches_image labels_image" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  typedef otb::VectorImage<float, 2> ImageType;
+  typedef otb::ImageFileReader<ImageType> ReaderType;
+
+  ReaderType::Pointer patchesReader = ReaderType::New();
+  patchesReader->SetFileName(argv[3]);
+  patchesReader->Update();
+  ReaderType::Pointer labelsReader = ReaderType::New();
+  labelsReader->SetFileName(argv[4]);
+  labelsReader->Update();
+  const ImageType * patches = patchesReader->GetOutput();
+  const ImageType * labels = labelsReader->GetOutput();
+
+  // Number of values of one sample
+  const unsigned long nSamples = labels->GetLargestPossibleRegion().GetSize(1);
+  const unsigned long nValues = patches->GetLargestPossibleRegion().GetNumberOfPixels() / nSamples *
+      patches->GetNumberOfComponentsPerPixel();
+
+  // Samples are distributed over the shards in turn
+  const unsigned int shardCount = std::stoi(argv[2]);
+  unsigned long nRecords = 0;
+  for (unsigned int shard = 0 ; shard < shardCount ; shard++)
+    {
+    const std::string fileName = otb::tf::GetShardFileName(argv[1], shard, shardCount);
+    std::unique_ptr<tensorflow::RandomAccessFile> file;
+    TF_CHECK_OK(tensorflow::Env::Default()->NewRandomAccessFile(fileName, &file));
+    tensorflow::io::RecordReader reader(file.get());
+    tensorflow::uint64 offset = 0;
+    std::string record;
+    for (unsigned long i = shard ; reader.ReadRecord(&offset, &record).ok() ; i += shardCount)
+      {
+      tensorflow::Example example;
+      if (i >= nSamples || !example.ParseFromString(record))
+        {
+        std::cerr << "Record of sample " << i << " in " << fileName << " is not a valid example" << std::endl;
+        return EXIT_FAILURE;
+        }
+      const auto & features = example.features().feature();
+      for (auto& key: {"source1", "label", "position"})
+        if (features.count(key) == 0)
+          {
+          std::cerr << "Feature \"" << key << "\" is missing in the example of sample " << i << std::endl;
+          return EXIT_FAILURE;
+          }
+
+      // Values of the patch
+      const auto & values = features.at("source1").float_list().value();
+      const float * expected = patches->GetBufferPointer() + i * nValues;
+      if (static_cast<unsigned long>(values.size()) != nValues || !std::equal(values.begin(), values.end(), expected))
+        {
+        std::cerr << "The values of sample " << i << " are not the values of its patch" << std::endl;
+        return EXIT_FAILURE;
+        }
+
+      // Label and position
+      const auto & label = features.at("label").int64_list().value();
+      if (label.size() != 1 || label.Get(0) != static_cast<tensorflow::int64>(labels->GetBufferPointer()[i]))
+        {
+        std::cerr << "The label of sample " << i << " is not its label in the labels image" << std::endl;
+        return EXIT_FAILURE;
+        }
+      if (features.at("position").float_list().value_size() != 2)
+        {
+        std::cerr << "The position of sample " << i << " should have 2 values" << std::endl;
+        return EXIT_FAILURE;
+        }
+      nRecords++;
+      }
+    }
+
+  std::cout << nRecords << " records read in " << shardCount << " shard(s)" << std::endl;
+  if (nRecords != nSamples)
+    {
+    std::cerr << "The shards should hold " << nSamples << " records" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,18 @@
+/*=========================================================================
+
+  Copyright (c) Remi Cresson (IRSTEA). All rights reserved.
+
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "otbTestMain.h"
+
+void RegisterTests()
+{
+  REGISTER_TEST(otbTensorflowEpochCacheTest);
+  REGISTER_TEST(otbTensorflowPatchesFileTest);
+  REGISTER_TEST(otbTensorflowRecordTest);
+}